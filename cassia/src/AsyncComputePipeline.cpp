@@ -0,0 +1,48 @@
+#include "AsyncComputePipeline.h"
+
+#include <cassert>
+#include <cstdio>
+
+namespace cassia {
+
+    void AsyncComputePipeline::Create(const wgpu::Device& device,
+                                      const wgpu::ComputePipelineDescriptor& descriptor) {
+        if (mState != nullptr) {
+            return;
+        }
+        mState = std::make_shared<State>();
+
+        device.CreateComputePipelineAsync(&descriptor, [](WGPUCreatePipelineAsyncStatus status,
+                WGPUComputePipeline pipeline, const char* message, void* userdata) {
+            std::unique_ptr<std::shared_ptr<State>> state(static_cast<std::shared_ptr<State>*>(userdata));
+            (*state)->done = true;
+            if (status == WGPUCreatePipelineAsyncStatus_Success) {
+                (*state)->pipeline = wgpu::ComputePipeline::Acquire(pipeline);
+            } else if (message != nullptr) {
+                fprintf(stderr, "Pipeline creation failed: %s\n", message);
+            }
+        }, new std::shared_ptr<State>(mState));
+    }
+
+    bool AsyncComputePipeline::IsStarted() const {
+        return mState != nullptr;
+    }
+
+    bool AsyncComputePipeline::IsReady() const {
+        return mState != nullptr && mState->pipeline != nullptr;
+    }
+
+    bool AsyncComputePipeline::Wait(const wgpu::Device& device) const {
+        assert(mState != nullptr);
+        while (!mState->done) {
+            device.Tick();
+        }
+        return mState->pipeline != nullptr;
+    }
+
+    const wgpu::ComputePipeline& AsyncComputePipeline::Get() const {
+        assert(IsReady());
+        return mState->pipeline;
+    }
+
+} // namespace cassia
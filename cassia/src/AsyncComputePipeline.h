@@ -0,0 +1,36 @@
+#ifndef CASSIA_ASYNCCOMPUTEPIPELINE_H
+#define CASSIA_ASYNCCOMPUTEPIPELINE_H
+
+#include "webgpu/webgpu_cpp.h"
+
+#include <memory>
+
+namespace cassia {
+
+    // A compute pipeline created with CreateComputePipelineAsync. It stays null until the device
+    // delivers the creation callback, which happens in Device::Tick.
+    class AsyncComputePipeline {
+      public:
+        // Starts creating the pipeline, does nothing if it was already started.
+        void Create(const wgpu::Device& device, const wgpu::ComputePipelineDescriptor& descriptor);
+
+        bool IsStarted() const;
+        // Whether the creation finished successfully and Get() can be used.
+        bool IsReady() const;
+        // Ticks the device until the creation finishes and returns whether it succeeded.
+        bool Wait(const wgpu::Device& device) const;
+
+        const wgpu::ComputePipeline& Get() const;
+
+      private:
+        // Shared with the creation callback so that it can outlive the AsyncComputePipeline.
+        struct State {
+            bool done = false;
+            wgpu::ComputePipeline pipeline;
+        };
+        std::shared_ptr<State> mState;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_ASYNCCOMPUTEPIPELINE_H
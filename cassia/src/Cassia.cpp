@@ -2,8 +2,21 @@
 
 #include "EncodingContext.h"
 #include "CommonWGSL.h"
+#include "CpuRasterizer.h"
+#include "FrameStats.h"
+#include "HostSegmentSorter.h"
+#include "KernelAutotuner.h"
 #include "NaiveComputeRasterizer.h"
+#include "PipelineCache.h"
+#include "RadixSorter.h"
+#include "RenderThread.h"
+#include "ResourcePool.h"
+#include "SegmentCompactor.h"
+#include "StagingRing.h"
+#include "ThreadPool.h"
+#include "TileParallelRasterizer.h"
 #include "TileWorkgroupRasterizer.h"
+#include "TraceWriter.h"
 
 #include <webgpu/webgpu_cpp.h>
 #include <dawn/dawn_proc.h>
@@ -15,26 +28,53 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <string>
 
 namespace cassia {
 
     enum Raster {
-        RasterNaive,
-        RasterTile,
+        RasterNaive = CassiaRasterizer_Naive,
+        RasterTile = CassiaRasterizer_TileWorkgroup,
+        RasterCpu = CassiaRasterizer_Cpu,
+        RasterTileParallel = CassiaRasterizer_TileParallel,
         Raster_Count,
     };
 
+    // Set with cassia_set_pipeline_cache_directory before the Cassia is created.
+    static std::string sPipelineCacheDirectory;
+
+    static std::string GetPipelineCacheDirectory() {
+        if (!sPipelineCacheDirectory.empty()) {
+            return sPipelineCacheDirectory;
+        }
+        if (const char* directory = std::getenv("CASSIA_PIPELINE_CACHE_DIR")) {
+            return directory;
+        }
+        return "";
+    }
+
     class Cassia {
       public:
-        Cassia(uint32_t width, uint32_t height): mWidth(width), mHeight(height) {
+        Cassia(uint32_t width, uint32_t height, bool headless)
+            : mWidth(width), mHeight(height), mHeadless(headless) {
             // Setup dawn native and its instance
             mInstance = std::make_unique<dawn_native::Instance>();
             DawnProcTable nativeProcs = dawn_native::GetProcs();
             dawnProcSetProcs(&nativeProcs);
 
+            // Reuse the shaders compiled by the previous processes.
+            std::string pipelineCacheDirectory = GetPipelineCacheDirectory();
+            if (!pipelineCacheDirectory.empty()) {
+                mPipelineCache = std::make_unique<PipelineCache>(pipelineCacheDirectory);
+                mInstance->SetPlatform(mPipelineCache.get());
+            }
+
             // Create a device, set it up to print errors.
             mInstance->DiscoverDefaultAdapters();
             // TODO choose an adapter that we like instead of the first one?
@@ -42,6 +82,7 @@ namespace cassia {
             wgpu::AdapterProperties adapterProperties;
             adapter.GetProperties(&adapterProperties);
             std::cout << "Using adapter " << adapterProperties.name << std::endl;
+            mAdapterName = adapterProperties.name;
 
             // Check for timestamp support.
             mTimestampsSupported = false;
@@ -60,11 +101,366 @@ namespace cassia {
                 deviceDesc.forceDisabledToggles.push_back("disallow_unsafe_apis");
             }
             mDevice = wgpu::Device::Acquire(adapter.CreateDevice(&deviceDesc));
-            mDevice.SetUncapturedErrorCallback([](WGPUErrorType, const char* message, void*) {
+            mDevice.SetUncapturedErrorCallback([](WGPUErrorType, const char* message, void* userdata) {
                 std::cerr << "Dawn error: " << message;
-            }, nullptr);
+                static_cast<Cassia*>(userdata)->mErrorCount++;
+            }, this);
             mQueue = mDevice.GetQueue();
 
+            // Create sub components
+            mPool = std::make_unique<ResourcePool>(mDevice);
+            mContext = std::make_unique<EncodingContext>(mDevice, mTimestampsSupported);
+            mContext->SetTimingsCallback([this](const FrameTimings& timings) {
+                if (timings.failed) {
+                    return;
+                }
+                mFrameStats.AddFrame(timings);
+                if (mTraceWriter != nullptr) {
+                    mTraceWriter->AddFrame(timings);
+                }
+            });
+            mStagingRing = std::make_unique<StagingRing>(mDevice);
+            mThreadPool = std::make_unique<ThreadPool>();
+            KernelAutotuner(mDevice, mAdapterName).LoadCachedConfig(&mKernelConfig);
+
+            // The rasterizers and the blit pipeline are created when first used so that startup
+            // doesn't compile the shaders of the ones that aren't.
+            if (!mHeadless) {
+                CreateWindowAndSwapchain();
+            }
+        }
+
+        void Render(
+            const uint64_t* psegments,
+            size_t psegmentCount,
+            const CassiaStyling* stylings,
+            size_t stylingCount
+        ) {
+            if (!mHeadless) {
+                glfwPollEvents();
+            }
+
+            if (mRenderThread != nullptr) {
+                mRenderThread->Push(psegments, psegmentCount, stylings, stylingCount);
+                return;
+            }
+            RenderFrame(psegments, psegmentCount, stylings, stylingCount);
+        }
+
+        void SetRenderThread(uint32_t framesInFlight) {
+            mRenderThread = nullptr;
+            mMaxFramesInFlight = framesInFlight;
+            if (framesInFlight != 0) {
+                mRenderThread = std::make_unique<RenderThread>(framesInFlight,
+                    [this](const uint64_t* psegments, size_t psegmentCount,
+                           const CassiaStyling* stylings, size_t stylingCount) {
+                        RenderFrame(psegments, psegmentCount, stylings, stylingCount);
+                    });
+            }
+        }
+
+        // Renders the frames queued for the render thread so that the caller can use the device.
+        void FinishQueuedFrames() {
+            if (mRenderThread != nullptr) {
+                mRenderThread->Finish();
+            }
+        }
+
+        bool Autotune() {
+            if (!mTimestampsSupported) {
+                std::cerr << "Cassia: autotuning needs timestamp queries." << std::endl;
+                return false;
+            }
+
+            mKernelConfig = KernelAutotuner(mDevice, mAdapterName).Tune();
+            mRasterizers[RasterTile] = nullptr;
+            return true;
+        }
+
+        bool Precompile() {
+            uint64_t errorCount = mErrorCount;
+            bool success = true;
+            for (uint32_t r = 0; r < Raster_Count; r++) {
+                success = GetRasterizer(static_cast<Raster>(r))->Precompile() && success;
+            }
+            if (mPackPipeline == nullptr) {
+                CreateReadbackPipeline();
+            }
+            if (!mHeadless && mBlitPipeline == nullptr) {
+                CreateBlitPipeline();
+            }
+
+            mDevice.Tick();
+            return success && mErrorCount == errorCount;
+        }
+
+        bool SetRasterizer(CassiaRasterizer rasterizer) {
+            if (static_cast<uint32_t>(rasterizer) >= Raster_Count) {
+                return false;
+            }
+            mRasterOnScreen = static_cast<Raster>(rasterizer);
+            // Start creating the pipelines, the previous rasterizer is used until they are ready.
+            GetRasterizer(mRasterOnScreen);
+            return true;
+        }
+
+        bool SetBenchmarkedRasterizers(const CassiaRasterizer* rasterizers, size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                if (static_cast<uint32_t>(rasterizers[i]) >= Raster_Count) {
+                    return false;
+                }
+            }
+
+            mRastersToBench.clear();
+            for (size_t i = 0; i < count; i++) {
+                mRastersToBench.push_back(static_cast<Raster>(rasterizers[i]));
+                GetRasterizer(mRastersToBench.back());
+            }
+            return true;
+        }
+
+        void SetSortMode(CassiaSortMode mode) {
+            mSortMode = mode;
+        }
+
+        void SetCompactUpload(bool enabled) {
+            mCompactUpload = enabled;
+        }
+
+        void SetIncrementalRendering(bool enabled) {
+            mIncrementalRendering = enabled;
+        }
+
+        void SetLayerCacheBoundary(uint32_t layer) {
+            mLayerCacheBoundary = layer;
+        }
+
+        size_t GetFrameStats(CassiaScopeStats* stats, size_t capacity) {
+            // Delivers the timings of the frames that finished, the render thread does it itself
+            // and owns the device while it runs.
+            if (mRenderThread == nullptr) {
+                mDevice.Tick();
+            }
+
+            std::vector<ScopeStats> scopeStats = mFrameStats.GetScopeStats();
+            for (size_t i = 0; i < std::min(capacity, scopeStats.size()); i++) {
+                const ScopeStats& scope = scopeStats[i];
+                stats[i].name = scope.name->c_str();
+                stats[i].hasGPU = scope.hasGPU;
+                stats[i].sampleCount = scope.sampleCount;
+                stats[i].frameCount = scope.frameCount;
+                stats[i].lastCpuTimeMs = scope.lastCpuTimeMs;
+                stats[i].lastGpuTimeMs = scope.lastGpuTimeMs;
+                stats[i].cpuP50Ms = scope.cpuPercentilesMs[0];
+                stats[i].cpuP95Ms = scope.cpuPercentilesMs[1];
+                stats[i].cpuP99Ms = scope.cpuPercentilesMs[2];
+                stats[i].gpuP50Ms = scope.gpuPercentilesMs[0];
+                stats[i].gpuP95Ms = scope.gpuPercentilesMs[1];
+                stats[i].gpuP99Ms = scope.gpuPercentilesMs[2];
+            }
+            return scopeStats.size();
+        }
+
+        bool StartTrace(const char* path) {
+            if (!mTimestampsSupported) {
+                std::cerr << "Cassia: tracing needs timestamp queries." << std::endl;
+                return false;
+            }
+            mTraceWriter = TraceWriter::Create(path);
+            return mTraceWriter != nullptr;
+        }
+
+        void StopTrace() {
+            mTraceWriter = nullptr;
+        }
+
+        void SetTimestampSampling(uint32_t interval) {
+            mContext->SetSamplingInterval(interval);
+        }
+
+        void SetRasterCounters(bool enabled) {
+            mGatherCounters = enabled;
+        }
+
+        bool GetRasterCounters(CassiaRasterCounters* counters) {
+            // Delivers the counters of the frames that finished.
+            mDevice.Tick();
+
+            Rasterizer* rasterizer = mRasterizers[mFrameRasterOnScreen].get();
+            return rasterizer != nullptr && rasterizer->GetCounters(counters);
+        }
+
+        uint64_t GetDroppedCarries() {
+            // Delivers the stats of the frames that finished.
+            mDevice.Tick();
+
+            Rasterizer* rasterizer = mRasterizers[mFrameRasterOnScreen].get();
+            return rasterizer != nullptr ? rasterizer->GetDroppedCarries() : 0;
+        }
+
+        uint64_t* AcquireSegmentSpan(size_t psegmentCapacity) {
+            return static_cast<uint64_t*>(mStagingRing->Acquire(psegmentCapacity * sizeof(uint64_t)));
+        }
+
+        void CommitSegments(
+            size_t psegmentCount,
+            const CassiaStyling* stylings,
+            size_t stylingCount
+        ) {
+            if (!mHeadless) {
+                glfwPollEvents();
+            }
+
+            // The committed psegments are only in GPU memory.
+            ChooseFrameRasterizers(false);
+            {
+                ScopedCPUPass pass(mContext.get(), "Cassia::CommitSegments");
+                mHostTileRanges = nullptr;
+                mHostSortedPsegments = nullptr;
+
+                uint64_t segmentsSize = psegmentCount * sizeof(uint64_t);
+                mSegmentsBuffer = mPool->GetBuffer("Cassia::Segments", segmentsSize,
+                        wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst);
+                if (!mStagingRing->Commit(mContext.get(), segmentsSize, mSegmentsBuffer)) {
+                    std::cerr << "cassia_commit_segments called without a large enough acquired span" << std::endl;
+                    return;
+                }
+            }
+
+            PresentPicture(RasterizePicture(psegmentCount, stylings, stylingCount));
+        }
+
+        bool RenderToBuffer(
+            const uint64_t* psegments,
+            size_t psegmentCount,
+            const CassiaStyling* stylings,
+            size_t stylingCount,
+            uint8_t* rgba,
+            size_t rgbaSize
+        ) {
+            uint64_t pixelBytes = uint64_t(mWidth) * mHeight * 4;
+            if (rgbaSize < pixelBytes) {
+                return false;
+            }
+            if (mPackPipeline == nullptr) {
+                CreateReadbackPipeline();
+            }
+
+            ChooseFrameRasterizers(mSortMode != CassiaSortMode_GPU);
+            psegmentCount = UploadSegments(psegments, psegmentCount);
+            wgpu::Texture picture = RasterizePicture(psegmentCount, stylings, stylingCount);
+
+            // Convert the picture to tightly packed RGBA8 and copy it in the mappable buffer.
+            {
+                if (mPackBindGroup.IsStale({picture.Get()})) {
+                    mPackBindGroup.Set(utils::MakeBindGroup(mDevice, mPackPipeline.GetBindGroupLayout(0), {
+                        {0, picture.CreateView()},
+                        {1, mPackedPixels},
+                    }));
+                }
+
+                ScopedComputePass pass(mContext.get(), "Cassia::PackToRGBA8");
+                pass->SetPipeline(mPackPipeline);
+                pass->SetBindGroup(0, mPackBindGroup.Get());
+                pass->Dispatch((mWidth + 7) / 8, (mHeight + 7) / 8);
+            }
+            mContext->GetEncoder().CopyBufferToBuffer(mPackedPixels, 0, mReadbackBuffer, 0, pixelBytes);
+
+            mContext->SubmitOn(mQueue);
+            mStagingRing->OnSubmitted();
+            for (auto& rasterizer : mRasterizers) {
+                if (rasterizer != nullptr) {
+                    rasterizer->OnSubmitted();
+                }
+            }
+
+            // Wait for the GPU to be done and copy the result in the caller's buffer.
+            bool mapped = false;
+            bool mapSuccess = false;
+            struct MapUserdata {
+                bool* mapped;
+                bool* success;
+            } mapUserdata = {&mapped, &mapSuccess};
+            mReadbackBuffer.MapAsync(wgpu::MapMode::Read, 0, pixelBytes, [](WGPUBufferMapAsyncStatus status, void* userdataIn) {
+                MapUserdata* userdata = static_cast<MapUserdata*>(userdataIn);
+                *userdata->mapped = true;
+                *userdata->success = status == WGPUBufferMapAsyncStatus_Success;
+            }, &mapUserdata);
+            while (!mapped) {
+                mDevice.Tick();
+            }
+            if (!mapSuccess) {
+                return false;
+            }
+
+            memcpy(rgba, mReadbackBuffer.GetConstMappedRange(0, pixelBytes), pixelBytes);
+            mReadbackBuffer.Unmap();
+            return true;
+        }
+
+        ~Cassia() {
+            mRenderThread = nullptr;
+            for (auto& rasterizer : mRasterizers) {
+                rasterizer = nullptr;
+            }
+
+            mPackPipeline = nullptr;
+            mPackedPixels = nullptr;
+            mReadbackBuffer = nullptr;
+            mPackBindGroup = CachedBindGroup();
+            mBlitBindGroup = CachedBindGroup();
+            mBlitSampler = nullptr;
+            mBlitPipeline = nullptr;
+            mSegmentsBuffer = nullptr;
+            mStylingsBuffer = nullptr;
+            mHostTileRanges = nullptr;
+            mRadixSorter = nullptr;
+            mSegmentCompactor = nullptr;
+            mHostSorter = nullptr;
+            mThreadPool = nullptr;
+            mStagingRing = nullptr;
+            mContext = nullptr;
+            mPool = nullptr;
+            mSwapchain = nullptr;
+            mSurface = nullptr;
+            mQueue = nullptr;
+            mDevice = nullptr;
+            mInstance = nullptr;
+            mPipelineCache = nullptr;
+            if (mWindow) {
+                glfwDestroyWindow(mWindow);
+                mWindow = nullptr;
+            }
+        }
+
+      private:
+        Rasterizer* GetRasterizer(Raster raster) {
+            std::unique_ptr<Rasterizer>& rasterizer = mRasterizers[raster];
+            if (rasterizer != nullptr) {
+                return rasterizer.get();
+            }
+
+            switch (raster) {
+                case RasterNaive:
+                    rasterizer = std::make_unique<NaiveComputeRasterizer>(mDevice, mPool.get());
+                    break;
+                case RasterTile:
+                    rasterizer = std::make_unique<TileWorkgroupRasterizer>(mDevice, mPool.get(), mKernelConfig);
+                    break;
+                case RasterCpu:
+                    rasterizer = std::make_unique<CpuRasterizer>(mDevice, mPool.get(), mThreadPool.get());
+                    break;
+                case RasterTileParallel:
+                    rasterizer = std::make_unique<TileParallelRasterizer>(mDevice, mPool.get());
+                    break;
+                case Raster_Count:
+                    assert(false);
+                    break;
+            }
+            return rasterizer.get();
+        }
+
+        void CreateWindowAndSwapchain() {
             // Create the GLFW window
             glfwSetErrorCallback([](int code, const char* message) {
                 std::cerr << "GLFW error: " << code << " - " << message << std::endl;
@@ -74,7 +470,7 @@ namespace cassia {
             }
             glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
             glfwWindowHint(GLFW_COCOA_RETINA_FRAMEBUFFER, GLFW_FALSE);
-            mWindow = glfwCreateWindow(width, height, "Paths!", nullptr, nullptr);
+            mWindow = glfwCreateWindow(mWidth, mHeight, "Paths!", nullptr, nullptr);
 
             // Create the swapchain
             mSurface = utils::CreateSurfaceForWindow(mInstance->Get(), mWindow);
@@ -82,12 +478,13 @@ namespace cassia {
             swapchainDesc.label = "cassia swapchain";
             swapchainDesc.usage = wgpu::TextureUsage::RenderAttachment;
             swapchainDesc.format = wgpu::TextureFormat::BGRA8Unorm;
-            swapchainDesc.width = width;
-            swapchainDesc.height = height;
+            swapchainDesc.width = mWidth;
+            swapchainDesc.height = mHeight;
             swapchainDesc.presentMode = wgpu::PresentMode::Mailbox;
             mSwapchain = mDevice.CreateSwapChain(mSurface, &swapchainDesc);
+        }
 
-            // Create the pipeline used to blit on the screen
+        void CreateBlitPipeline() {
             wgpu::ShaderModule blitModule = utils::CreateShaderModule(mDevice, R"(
                 struct VertexOutput {
                     [[builtin(position)]] Position : vec4<f32>;
@@ -126,42 +523,254 @@ namespace cassia {
             pDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleStrip;
             pDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Uint32;
             mBlitPipeline = mDevice.CreateRenderPipeline(&pDesc);
+            mBlitSampler = mDevice.CreateSampler();
+        }
 
-            // Create sub components
-            mRasterizers[RasterNaive] = std::make_unique<NaiveComputeRasterizer>(mDevice);
-            mRasterizers[RasterTile] = std::make_unique<TileWorkgroupRasterizer>(mDevice);
+        void CreateReadbackPipeline() {
+            // Packs the rasterized picture in a buffer so that it can be copied without the
+            // bytesPerRow alignment constraints of texture to buffer copies.
+            wgpu::ShaderModule packModule = utils::CreateShaderModule(mDevice, R"(
+                [[group(0), binding(0)]] var picture : texture_2d<f32>;
+                [[block]] struct Pixels {
+                    data: array<u32>;
+                };
+                [[group(0), binding(1)]] var<storage, read_write> pixels : Pixels;
+
+                [[stage(compute), workgroup_size(8, 8)]]
+                fn main([[builtin(global_invocation_id)]] GlobalId : vec3<u32>) {
+                    var size = textureDimensions(picture);
+                    if (i32(GlobalId.x) >= size.x || i32(GlobalId.y) >= size.y) {
+                        return;
+                    }
+
+                    var color = textureLoad(picture, vec2<i32>(GlobalId.xy), 0);
+                    pixels.data[GlobalId.y * u32(size.x) + GlobalId.x] = pack4x8unorm(color);
+                }
+            )");
+            wgpu::ComputePipelineDescriptor pDesc;
+            pDesc.label = "pack to RGBA8 pipeline";
+            pDesc.compute.module = packModule;
+            pDesc.compute.entryPoint = "main";
+            mPackPipeline = mDevice.CreateComputePipeline(&pDesc);
+
+            wgpu::BufferDescriptor bufDesc;
+            bufDesc.size = uint64_t(mWidth) * mHeight * 4;
+            bufDesc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc;
+            mPackedPixels = mDevice.CreateBuffer(&bufDesc);
+
+            bufDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+            mReadbackBuffer = mDevice.CreateBuffer(&bufDesc);
         }
 
-        void Render(
-            const uint64_t* psegmentsIn,
+        // Returns the number of psegments uploaded, which is smaller than psegmentCount when
+        // sorting on the host dropped psegments that aren't on screen.
+        size_t UploadSegments(const uint64_t* psegments, size_t psegmentCount) {
+            mHostTileRanges = nullptr;
+            mHostSortedPsegments = nullptr;
+            mSegmentsCompacted = false;
+            if (mSortMode == CassiaSortMode_CPU) {
+                psegmentCount = SortAndUploadSegmentsOnHost(psegments, psegmentCount);
+            } else {
+                if (mSortMode == CassiaSortMode_None) {
+                    mHostSortedPsegments = psegments;
+                }
+
+                ScopedCPUPass pass(mContext.get(), "Cassia::UploadSegments");
+
+                // The pooled buffers are rewritten in place, the previous frames' commands that
+                // use them are ordered before these writes on the queue.
+                uint64_t segmentsSize = psegmentCount * sizeof(uint64_t);
+                mSegmentsBuffer = mPool->GetBuffer("Cassia::Segments", segmentsSize,
+                        wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst);
+                WriteSegments(psegments, psegmentCount);
+            }
+
+            // Recorded outside of the CPU scopes since scopes don't nest.
+            if (mSegmentsCompacted) {
+                mSegmentCompactor->Expand(mContext.get(), mSegmentsBuffer);
+            }
+            return psegmentCount;
+        }
+
+        // Writes the psegments to mSegmentsBuffer, or their compact encoding that is expanded to
+        // it in UploadSegments. The psegments sorted on the GPU aren't sorted yet, so they have
+        // short runs and are written as is like the ones whose encoding would be larger.
+        void WriteSegments(const uint64_t* psegments, size_t psegmentCount) {
+            if (mCompactUpload && mSortMode != CassiaSortMode_GPU) {
+                if (mSegmentCompactor == nullptr) {
+                    mSegmentCompactor = std::make_unique<SegmentCompactor>(mDevice, mPool.get());
+                }
+                mSegmentsCompacted = mSegmentCompactor->Upload(psegments, psegmentCount);
+            }
+            if (!mSegmentsCompacted) {
+                mQueue.WriteBuffer(mSegmentsBuffer, 0, psegments, psegmentCount * sizeof(uint64_t));
+            }
+        }
+
+        size_t SortAndUploadSegmentsOnHost(const uint64_t* psegments, size_t psegmentCount) {
+            ScopedCPUPass pass(mContext.get(), "Cassia::SortSegmentsOnHost");
+
+            if (mHostSorter == nullptr) {
+                mHostSorter = std::make_unique<HostSegmentSorter>(mThreadPool.get());
+            }
+
+            // Sort directly in mapped memory to avoid another copy, unless the application holds
+            // the staging span, the sorted psegments are needed on the host after the upload or
+            // they are encoded before it.
+            uint64_t* sorted = nullptr;
+            if (!NeedsHostInputs() && !mCompactUpload) {
+                sorted = static_cast<uint64_t*>(mStagingRing->Acquire(psegmentCount * sizeof(uint64_t)));
+            }
+            bool staged = sorted != nullptr;
+            if (!staged) {
+                mHostSortedSegments.resize(psegmentCount);
+                sorted = mHostSortedSegments.data();
+                mHostSortedPsegments = sorted;
+            }
+
+            size_t sortedCount = mHostSorter->Sort(psegments, psegmentCount,
+                    WidthInTiles(mWidth), HeightInTiles(mHeight), sorted);
+
+            uint64_t segmentsSize = sortedCount * sizeof(uint64_t);
+            mSegmentsBuffer = mPool->GetBuffer("Cassia::Segments", segmentsSize,
+                    wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst);
+            if (staged) {
+                mStagingRing->Commit(mContext.get(), segmentsSize, mSegmentsBuffer);
+            } else {
+                WriteSegments(sorted, sortedCount);
+            }
+
+            // The tile ranges are a by-product of the sort so the GPU doesn't need to compute them.
+            const std::vector<TileRange>& tileRanges = mHostSorter->GetTileRanges();
+            uint64_t tileRangesSize = tileRanges.size() * sizeof(TileRange);
+            mHostTileRanges = mPool->GetBuffer("Cassia::TileRanges", tileRangesSize,
+                    wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst);
+            mQueue.WriteBuffer(mHostTileRanges, 0, tileRanges.data(), tileRangesSize);
+
+            return sortedCount;
+        }
+
+        void RenderFrame(
+            const uint64_t* psegments,
             size_t psegmentCount,
             const CassiaStyling* stylings,
             size_t stylingCount
         ) {
-            glfwPollEvents();
+            WaitForFramesInFlight();
+            ChooseFrameRasterizers(mSortMode != CassiaSortMode_GPU);
+            psegmentCount = UploadSegments(psegments, psegmentCount);
+            PresentPicture(RasterizePicture(psegmentCount, stylings, stylingCount));
+        }
+
+        // With a render thread, its frames wait for the GPU to be less than mMaxFramesInFlight
+        // frames behind so that the queue doesn't grow without bounds.
+        void WaitForFramesInFlight() {
+            while (mMaxFramesInFlight != 0 && mFramesInFlight.load() >= mMaxFramesInFlight) {
+                mDevice.Tick();
+            }
+        }
+
+        // Picks the rasterizers used for this frame among the ones whose pipelines are ready, the
+        // others are skipped until their asynchronous creation finishes. hostInputsAvailable is
+        // whether the psegments of the frame can be given to rasterizers running on the CPU.
+        void ChooseFrameRasterizers(bool hostInputsAvailable) {
+            GetRasterizer(mRasterOnScreen);
+            // Delivers the callbacks of the pipelines that finished their creation.
+            mDevice.Tick();
+
+            mFrameRasters.clear();
+            for (Raster r : mRastersToBench) {
+                if (GetRasterizer(r)->IsReady() && (hostInputsAvailable || !GetRasterizer(r)->NeedsHostInputs()) &&
+                    std::find(mFrameRasters.begin(), mFrameRasters.end(), r) == mFrameRasters.end()) {
+                    mFrameRasters.push_back(r);
+                }
+            }
+
+            auto CanShow = [&](Raster r) {
+                return mRasterizers[r] != nullptr && mRasterizers[r]->IsReady() &&
+                       (hostInputsAvailable || !mRasterizers[r]->NeedsHostInputs());
+            };
+            mFrameRasterOnScreen = Raster_Count;
+            if (CanShow(mRasterOnScreen)) {
+                mFrameRasterOnScreen = mRasterOnScreen;
+            } else {
+                // Show the picture of a rasterizer that was already created until then.
+                for (uint32_t r = 0; r < Raster_Count; r++) {
+                    if (CanShow(static_cast<Raster>(r))) {
+                        mFrameRasterOnScreen = static_cast<Raster>(r);
+                        break;
+                    }
+                }
+                if (mFrameRasterOnScreen == Raster_Count && hostInputsAvailable) {
+                    mFrameRasterOnScreen = RasterCpu;
+                }
+                if (mFrameRasterOnScreen == Raster_Count) {
+                    // Nothing else can draw the frame, wait for the pipelines.
+                    if (!GetRasterizer(mRasterOnScreen)->Precompile()) {
+                        std::cerr << "Cassia: the pipelines of the rasterizer couldn't be created." << std::endl;
+                    }
+                    mFrameRasterOnScreen = mRasterOnScreen;
+                }
+            }
 
-            std::vector<uint64_t> psegments(psegmentsIn, psegmentsIn + psegmentCount);
+            if (std::find(mFrameRasters.begin(), mFrameRasters.end(), mFrameRasterOnScreen) == mFrameRasters.end()) {
+                mFrameRasters.push_back(mFrameRasterOnScreen);
+            }
+        }
 
-            // Run all the steps of the algorithm.
-            EncodingContext context(mDevice, mTimestampsSupported);
+        bool NeedsHostInputs() {
+            for (Raster r : mFrameRasters) {
+                if (GetRasterizer(r)->NeedsHostInputs()) {
+                    return true;
+                }
+            }
+            return false;
+        }
 
-            wgpu::Buffer sortedPsegments;
-            wgpu::Buffer stylingsBuffer;
+        wgpu::Buffer SortSegments(size_t psegmentCount, size_t stylingCount) {
+            if (mSortMode != CassiaSortMode_GPU) {
+                return mSegmentsBuffer;
+            }
+            if (mRadixSorter == nullptr) {
+                mRadixSorter = std::make_unique<RadixSorter>(mDevice, mPool.get(), "Cassia::SegmentSorter");
+            }
+
+            // Only the layer bits that can be set for this styling count need to be sorted. The
+            // tile bits all need to be sorted because segments can be out of the screen.
+            uint32_t layerBits = 0;
+            while (layerBits < 16 && (uint64_t(1) << layerBits) < stylingCount) {
+                layerBits++;
+            }
+            uint64_t layerMask = ((uint64_t(1) << layerBits) - 1) << PSEGMENT_LAYER_OFFSET;
+            uint64_t tileMask = ~uint64_t(0) << PSEGMENT_TILE_X_OFFSET;
+
+            return mRadixSorter->Sort(mContext.get(), mSegmentsBuffer, static_cast<uint32_t>(psegmentCount),
+                                      layerMask | tileMask);
+        }
+
+        wgpu::Texture RasterizePicture(
+            size_t psegmentCount,
+            const CassiaStyling* stylings,
+            size_t stylingCount
+        ) {
+            EncodingContext* context = mContext.get();
             {
-                ScopedCPUPass pass(&context, "Cassia::UploadBuffers");
+                ScopedCPUPass pass(context, "Cassia::UploadStylings");
 
-                sortedPsegments = utils::CreateBufferFromData(
-                        mDevice, psegments.data(), psegments.size() * sizeof(uint64_t),
-                        wgpu::BufferUsage::Storage);
-                stylingsBuffer = utils::CreateBufferFromData(
-                        mDevice, stylings, stylingCount * sizeof(CassiaStyling),
-                        wgpu::BufferUsage::Storage);
+                // Stylings usually don't change between frames so only upload them when they do.
+                bool stylingsChanged = mUploadedStylings.size() != stylingCount || (stylingCount != 0 &&
+                    memcmp(mUploadedStylings.data(), stylings, stylingCount * sizeof(CassiaStyling)) != 0);
+                uint64_t stylingsSize = stylingCount * sizeof(CassiaStyling);
+                wgpu::Buffer stylingsBuffer = mPool->GetBuffer("Cassia::Stylings", stylingsSize,
+                        wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst);
+                if (stylingsChanged || stylingsBuffer.Get() != mStylingsBuffer.Get()) {
+                    mStylingsBuffer = stylingsBuffer;
+                    mQueue.WriteBuffer(mStylingsBuffer, 0, stylings, stylingsSize);
+                    mUploadedStylings.assign(stylings, stylings + stylingCount);
+                }
             }
 
-            // ----- THIS IS STUFF YOU CHANGE TO SELECT WHAT TO RUN
-            Raster rasterOnScreen = RasterTile;
-            std::vector<Raster> rastersToBench = {RasterTile};
-            // -----
+            wgpu::Buffer sortedPsegments = SortSegments(psegmentCount, stylingCount);
 
             Rasterizer::Config config = {
                 mWidth,
@@ -169,76 +778,181 @@ namespace cassia {
                 static_cast<uint32_t>(psegmentCount),
                 static_cast<uint32_t>(stylingCount)
             };
+            Rasterizer::Inputs inputs;
+            inputs.sortedPsegments = sortedPsegments;
+            inputs.stylings = mStylingsBuffer;
+            inputs.tileRanges = mHostTileRanges;
+            inputs.hostSortedPsegments = mHostSortedPsegments;
+            inputs.hostStylings = stylings;
+            if (mHostTileRanges != nullptr) {
+                inputs.hostTileRanges = mHostSorter->GetTileRanges().data();
+            }
+            inputs.reusePreviousPicture = mIncrementalRendering;
+            inputs.layerCacheBoundary = mLayerCacheBoundary;
+            inputs.gatherCounters = mGatherCounters;
+
             wgpu::Texture picture;
-            for (Raster r : rastersToBench) {
-                wgpu::Texture tempPicture = mRasterizers[r]->Rasterize(&context, sortedPsegments, stylingsBuffer, config);
-                if (r == rasterOnScreen) {
+            for (Raster r : mFrameRasters) {
+                wgpu::Texture tempPicture = GetRasterizer(r)->Rasterize(context, inputs, config);
+                if (r == mFrameRasterOnScreen) {
                     picture = tempPicture;
                 }
             }
-            assert(picture != nullptr); // rasterOnScreen must be in rastersToBench.
+            assert(picture != nullptr);
 
-            // Do the blit into the swapchain.
-            {
-                wgpu::BindGroup blitBindGroup = utils::MakeBindGroup(
-                        mDevice, mBlitPipeline.GetBindGroupLayout(0), {
-                    {0, mDevice.CreateSampler()},
-                    {1, picture.CreateView()},
-                });
-
-                utils::ComboRenderPassDescriptor rpDesc({{mSwapchain.GetCurrentTextureView()}});
-                rpDesc.cColorAttachments[0].loadOp = wgpu::LoadOp::Clear;
-                rpDesc.cColorAttachments[0].storeOp = wgpu::StoreOp::Store;
-                rpDesc.cColorAttachments[0].clearColor = {0.0, 0.0, 0.0, 0.0};
-                ScopedRenderPass pass(&context, rpDesc, "Cassia::BlitToSwapChain");
+            return picture;
+        }
 
-                pass->SetPipeline(mBlitPipeline);
-                pass->SetBindGroup(0, blitBindGroup);
-                pass->Draw(4);
+        void PresentPicture(wgpu::Texture picture) {
+            if (!mHeadless) {
+                BlitToSwapChain(picture);
             }
 
             // Submit all the commands!
-            context.SubmitOn(mQueue);
-            mSwapchain.Present();
-        }
-
-        ~Cassia() {
+            mContext->SubmitOn(mQueue);
+            if (mMaxFramesInFlight != 0) {
+                mFramesInFlight++;
+                mQueue.OnSubmittedWorkDone(0, [](WGPUQueueWorkDoneStatus, void* userdata) {
+                    static_cast<Cassia*>(userdata)->mFramesInFlight--;
+                }, this);
+            }
+            mStagingRing->OnSubmitted();
             for (auto& rasterizer : mRasterizers) {
-                rasterizer = nullptr;
+                if (rasterizer != nullptr) {
+                    rasterizer->OnSubmitted();
+                }
+            }
+            if (!mHeadless) {
+                mSwapchain.Present();
             }
+        }
 
-            mBlitPipeline = nullptr;
-            mWindow = nullptr;
-            mSwapchain = nullptr;
-            mQueue = nullptr;
-            mDevice = nullptr;
-            mInstance = nullptr;
-            if (mWindow) {
-                glfwDestroyWindow(mWindow);
+        void BlitToSwapChain(wgpu::Texture picture) {
+            if (mBlitPipeline == nullptr) {
+                CreateBlitPipeline();
+            }
+            if (mBlitBindGroup.IsStale({picture.Get()})) {
+                mBlitBindGroup.Set(utils::MakeBindGroup(mDevice, mBlitPipeline.GetBindGroupLayout(0), {
+                    {0, mBlitSampler},
+                    {1, picture.CreateView()},
+                }));
             }
+
+            utils::ComboRenderPassDescriptor rpDesc({{mSwapchain.GetCurrentTextureView()}});
+            rpDesc.cColorAttachments[0].loadOp = wgpu::LoadOp::Clear;
+            rpDesc.cColorAttachments[0].storeOp = wgpu::StoreOp::Store;
+            rpDesc.cColorAttachments[0].clearColor = {0.0, 0.0, 0.0, 0.0};
+            ScopedRenderPass pass(mContext.get(), rpDesc, "Cassia::BlitToSwapChain");
+
+            pass->SetPipeline(mBlitPipeline);
+            pass->SetBindGroup(0, mBlitBindGroup.Get());
+            pass->Draw(4);
         }
 
-      private:
         std::array<std::unique_ptr<Rasterizer>, Raster_Count> mRasterizers;
+        // Chosen with cassia_set_rasterizer and cassia_set_benchmarked_rasterizers. The on-screen
+        // rasterizer always runs, the benchmarked ones also run to time them.
+        Raster mRasterOnScreen = RasterTile;
+        std::vector<Raster> mRastersToBench;
+        // The rasterizers that are ready for the current frame, see ChooseFrameRasterizers.
+        Raster mFrameRasterOnScreen = RasterTile;
+        std::vector<Raster> mFrameRasters;
+        std::unique_ptr<ResourcePool> mPool;
+        std::unique_ptr<EncodingContext> mContext;
+        std::unique_ptr<StagingRing> mStagingRing;
+        std::unique_ptr<RadixSorter> mRadixSorter;
+        std::unique_ptr<ThreadPool> mThreadPool;
+        std::unique_ptr<HostSegmentSorter> mHostSorter;
+        std::unique_ptr<SegmentCompactor> mSegmentCompactor;
+        CassiaSortMode mSortMode = CassiaSortMode_None;
+        bool mCompactUpload = false;
+        // Whether the psegments of the frame were uploaded compacted and need to be expanded.
+        bool mSegmentsCompacted = false;
+        bool mIncrementalRendering = false;
+        std::unique_ptr<RenderThread> mRenderThread;
+        uint32_t mMaxFramesInFlight = 0;
+        std::atomic<uint32_t> mFramesInFlight{0};
+        uint32_t mLayerCacheBoundary = 0;
+        bool mGatherCounters = false;
+        FrameStats mFrameStats;
+        std::unique_ptr<TraceWriter> mTraceWriter;
+
+        // Per-frame inputs, kept to avoid reuploading stylings when they don't change.
+        wgpu::Buffer mSegmentsBuffer;
+        wgpu::Buffer mStylingsBuffer;
+        std::vector<CassiaStyling> mUploadedStylings;
+        // Only set for frames sorted on the host.
+        wgpu::Buffer mHostTileRanges;
+        std::vector<uint64_t> mHostSortedSegments;
+        // The psegments for the rasterizers that run on the host, null if they are only on the GPU.
+        const uint64_t* mHostSortedPsegments = nullptr;
 
+        // Only used when rendering on screen.
         wgpu::RenderPipeline mBlitPipeline;
-        wgpu::Queue mQueue;
-        wgpu::Device mDevice;
+        wgpu::Sampler mBlitSampler;
+        CachedBindGroup mBlitBindGroup;
         wgpu::SwapChain mSwapchain;
         wgpu::Surface mSurface;
-        std::unique_ptr<dawn_native::Instance> mInstance;
         GLFWwindow* mWindow = nullptr;
 
+        // Only used when reading back the picture.
+        wgpu::ComputePipeline mPackPipeline;
+        CachedBindGroup mPackBindGroup;
+        wgpu::Buffer mPackedPixels;
+        wgpu::Buffer mReadbackBuffer;
+
+        wgpu::Queue mQueue;
+        wgpu::Device mDevice;
+        std::unique_ptr<dawn_native::Instance> mInstance;
+        // Must outlive the instance.
+        std::unique_ptr<PipelineCache> mPipelineCache;
+
+        std::string mAdapterName;
+        TileWorkgroupKernelConfig mKernelConfig;
+        uint64_t mErrorCount = 0;
         uint32_t mWidth, mHeight;
+        bool mHeadless;
         bool mTimestampsSupported;
     };
 
     static std::unique_ptr<Cassia> sCassia;
 
+    // The entry points other than cassia_render use the device from the caller's thread, so they
+    // first wait for the frames queued for the render thread.
+    static Cassia* GetIdleCassia() {
+        sCassia->FinishQueuedFrames();
+        return sCassia.get();
+    }
+
 } // namespace cassia
 
+void cassia_get_tile_shifts(uint32_t* widthShift, uint32_t* heightShift) {
+    *widthShift = cassia::TILE_WIDTH_SHIFT;
+    *heightShift = cassia::TILE_HEIGHT_SHIFT;
+}
+
+void cassia_set_pipeline_cache_directory(const char* directory) {
+    cassia::sPipelineCacheDirectory = directory != nullptr ? directory : "";
+}
+
+bool cassia_precompile() {
+    return cassia::GetIdleCassia()->Precompile();
+}
+
+bool cassia_set_rasterizer(CassiaRasterizer rasterizer) {
+    return cassia::GetIdleCassia()->SetRasterizer(rasterizer);
+}
+
+bool cassia_set_benchmarked_rasterizers(const CassiaRasterizer* rasterizers, size_t count) {
+    return cassia::GetIdleCassia()->SetBenchmarkedRasterizers(rasterizers, count);
+}
+
 void cassia_init(uint32_t width, uint32_t height) {
-    cassia::sCassia = std::make_unique<cassia::Cassia>(width, height);
+    cassia::sCassia = std::make_unique<cassia::Cassia>(width, height, false);
+}
+
+void cassia_init_headless(uint32_t width, uint32_t height) {
+    cassia::sCassia = std::make_unique<cassia::Cassia>(width, height, true);
 }
 
 void cassia_render(
@@ -250,6 +964,82 @@ void cassia_render(
     cassia::sCassia->Render(psegments, psegmentCount, stylings, stylingCount);
 }
 
+bool cassia_autotune() {
+    return cassia::GetIdleCassia()->Autotune();
+}
+
+void cassia_set_sort_mode(CassiaSortMode mode) {
+    cassia::GetIdleCassia()->SetSortMode(mode);
+}
+
+void cassia_set_compact_upload(bool enabled) {
+    cassia::GetIdleCassia()->SetCompactUpload(enabled);
+}
+
+void cassia_set_incremental_rendering(bool enabled) {
+    cassia::GetIdleCassia()->SetIncrementalRendering(enabled);
+}
+
+void cassia_set_layer_cache_boundary(uint32_t layer) {
+    cassia::GetIdleCassia()->SetLayerCacheBoundary(layer);
+}
+
+void cassia_set_render_thread(uint32_t framesInFlight) {
+    cassia::GetIdleCassia()->SetRenderThread(framesInFlight);
+}
+
+size_t cassia_get_frame_stats(CassiaScopeStats* stats, size_t capacity) {
+    // Doesn't wait for the queued frames, the FrameStats are safe to read while they render.
+    return cassia::sCassia->GetFrameStats(stats, capacity);
+}
+
+bool cassia_start_trace(const char* path) {
+    return cassia::GetIdleCassia()->StartTrace(path);
+}
+
+void cassia_stop_trace() {
+    cassia::GetIdleCassia()->StopTrace();
+}
+
+void cassia_set_timestamp_sampling(uint32_t interval) {
+    cassia::GetIdleCassia()->SetTimestampSampling(interval);
+}
+
+void cassia_set_raster_counters(bool enabled) {
+    cassia::GetIdleCassia()->SetRasterCounters(enabled);
+}
+
+bool cassia_get_raster_counters(CassiaRasterCounters* counters) {
+    return cassia::GetIdleCassia()->GetRasterCounters(counters);
+}
+
+uint64_t cassia_get_dropped_carries() {
+    return cassia::GetIdleCassia()->GetDroppedCarries();
+}
+
+uint64_t* cassia_acquire_segment_span(size_t psegmentCapacity) {
+    return cassia::GetIdleCassia()->AcquireSegmentSpan(psegmentCapacity);
+}
+
+void cassia_commit_segments(
+    size_t psegmentCount,
+    const CassiaStyling* stylings,
+    size_t stylingCount
+) {
+    cassia::GetIdleCassia()->CommitSegments(psegmentCount, stylings, stylingCount);
+}
+
+bool cassia_render_to_buffer(
+    const uint64_t* psegments,
+    size_t psegmentCount,
+    const CassiaStyling* stylings,
+    size_t stylingCount,
+    uint8_t* rgba,
+    size_t rgbaSize
+) {
+    return cassia::GetIdleCassia()->RenderToBuffer(psegments, psegmentCount, stylings, stylingCount, rgba, rgbaSize);
+}
+
 void cassia_shutdown() {
     cassia::sCassia = nullptr;
 }
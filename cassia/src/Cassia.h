@@ -29,14 +29,174 @@ typedef struct CassiaStyling {
     uint32_t _padding[2];
 } CassiaStyling;
 
+typedef enum CassiaSortMode {
+    // The psegments are already sorted by the caller.
+    CassiaSortMode_None = 0,
+    // The psegments are sorted on the GPU before rasterization.
+    CassiaSortMode_GPU = 1,
+    // The psegments are sorted on the CPU by a pool of threads, which also computes the range of
+    // psegments in each tile. Psegments written in an acquired span must already be sorted.
+    CassiaSortMode_CPU = 2,
+} CassiaSortMode;
+
+typedef enum CassiaRasterizer {
+    // One invocation per pixel that walks all the psegments, only meant to check the others.
+    CassiaRasterizer_Naive = 0,
+    // A workgroup per row of tiles that passes the carries from tile to tile.
+    CassiaRasterizer_TileWorkgroup = 1,
+    // Rasterizes on the CPU with a pool of threads. It needs the psegments on the host so it
+    // can't be used with CassiaSortMode_GPU or cassia_commit_segments.
+    CassiaRasterizer_Cpu = 2,
+    // A workgroup per tile, with the carries computed beforehand by a prefix scan.
+    CassiaRasterizer_TileParallel = 3,
+} CassiaRasterizer;
+
+// The timings of a scope of the frames, the passes of a frame with the same name are summed.
+typedef struct CassiaScopeStats {
+    // Valid until cassia_shutdown.
+    const char* name;
+    bool hasGPU;
+    // The number of recent frames the percentiles are computed from.
+    uint32_t sampleCount;
+    // The number of frames timed with the scope since cassia_init, which tells whether the last
+    // times are from a new frame.
+    uint64_t frameCount;
+    double lastCpuTimeMs;
+    double lastGpuTimeMs;
+    double cpuP50Ms;
+    double cpuP95Ms;
+    double cpuP99Ms;
+    double gpuP50Ms;
+    double gpuP95Ms;
+    double gpuP99Ms;
+} CassiaScopeStats;
+
+// The work of the raster kernels in a frame, summed over its rows of tiles.
+typedef struct CassiaRasterCounters {
+    uint32_t rows;
+    uint32_t tiles;
+    // The tiles without psegments or carries.
+    uint32_t emptyTiles;
+    uint32_t psegments;
+    // The most psegments processed by a row of tiles.
+    uint32_t peakRowPsegments;
+    // The layers accumulated in the tiles, including the carry-only ones.
+    uint32_t layersVisited;
+    uint32_t carriesEnqueued;
+    // The carries past the queue in workgroup memory that went to memory.
+    uint32_t carriesSpilled;
+    // The carries dropped for lack of room, which make the picture wrong.
+    uint32_t carriesDropped;
+    // The iterations of the loop over the psegments and carries of the tiles, each with a barrier.
+    uint32_t barrierIterations;
+} CassiaRasterCounters;
+
 extern "C" {
+    // The log2 of the size of the tiles the library is built with, chosen with CASSIA_TILE_SIZE.
+    // The local and tile coordinates of the psegments must be encoded for it.
+    CASSIA_EXPORT void cassia_get_tile_shifts(uint32_t* widthShift, uint32_t* heightShift);
+    // The directory where the compiled shaders are kept between processes, which must be set
+    // before cassia_init. Defaults to $CASSIA_PIPELINE_CACHE_DIR, and to no cache when it isn't set.
+    // The cassia_precompile tool can fill a directory ahead of time.
+    CASSIA_EXPORT void cassia_set_pipeline_cache_directory(const char* directory);
     CASSIA_EXPORT void cassia_init(uint32_t width, uint32_t height);
+    // Initializes cassia without a window or swapchain, pictures can only be read back.
+    CASSIA_EXPORT void cassia_init_headless(uint32_t width, uint32_t height);
     CASSIA_EXPORT void cassia_render(
         const uint64_t* psegments,
         size_t psegmentCount,
         const CassiaStyling* stylings,
         size_t stylingCount
     );
+    // Times the variants of the rasterization kernels on the adapter and switches to the fastest.
+    // The result is saved and reused by the next cassia_init on the same adapter. Returns false if
+    // the adapter doesn't support timestamp queries.
+    CASSIA_EXPORT bool cassia_autotune();
+    // Creates the pipelines of all the rasterizers, which are otherwise created when first used,
+    // so that they are validated and stored in the pipeline cache. Returns false if any failed.
+    CASSIA_EXPORT bool cassia_precompile();
+    // Chooses the rasterizer whose picture is shown, defaults to CassiaRasterizer_TileWorkgroup.
+    // Its pipelines are created in the background and frames are drawn with an already created
+    // rasterizer until they are ready. Returns false for an unknown rasterizer.
+    CASSIA_EXPORT bool cassia_set_rasterizer(CassiaRasterizer rasterizer);
+    // Chooses rasterizers that also run each frame, once their pipelines are ready, so that they
+    // show up in the timings. None by default. Returns false for an unknown rasterizer.
+    CASSIA_EXPORT bool cassia_set_benchmarked_rasterizers(const CassiaRasterizer* rasterizers, size_t count);
+    // Chooses where the psegments are sorted, defaults to CassiaSortMode_None.
+    CASSIA_EXPORT void cassia_set_sort_mode(CassiaSortMode mode);
+    // When enabled, the psegments are uploaded with the bits from the layer up stored once per
+    // run of psegments in the same tile and layer, then expanded on the GPU. It takes a few
+    // bytes per psegment instead of 8 when they are sorted, for when uploads are the bottleneck.
+    // Unsorted psegments have short runs and their encoding grows instead, so they are uploaded
+    // as is with CassiaSortMode_GPU or when the encoding is larger. Psegments written in an
+    // acquired span are copied as is. Disabled by default.
+    CASSIA_EXPORT void cassia_set_compact_upload(bool enabled);
+    // When enabled, the rows of tiles whose psegments are the same as in the previous frame keep
+    // their pixels and only the other rows are rasterized again, unless the stylings changed.
+    // Only CassiaRasterizer_TileWorkgroup supports it. Disabled by default so that the timings
+    // measure whole frames.
+    CASSIA_EXPORT void cassia_set_incremental_rendering(bool enabled);
+    // The layers below `layer` are composited once and kept between frames, then only the layers
+    // from `layer` up are rasterized over them. The kept layers are rasterized again in the rows
+    // where their psegments change, or everywhere when their stylings change. 0, the default,
+    // disables the cache. Only CassiaRasterizer_TileWorkgroup supports it.
+    CASSIA_EXPORT void cassia_set_layer_cache_boundary(uint32_t layer);
+    // With a non-zero framesInFlight, cassia_render copies the frame in a queue and returns while
+    // a thread owned by cassia renders it, so the caller can prepare the next frame meanwhile. At
+    // most framesInFlight frames are queued and at most framesInFlight are on the GPU, after which
+    // cassia_render waits. The other functions first wait for the queued frames to be rendered.
+    // 0, the default, renders on the caller's thread.
+    CASSIA_EXPORT void cassia_set_render_thread(uint32_t framesInFlight);
+    // Copies the statistics of up to `capacity` scopes of the recent frames in `stats` and
+    // returns the number of scopes. Frames are only timed when the adapter supports timestamp
+    // queries, and their timings arrive a few frames after they are rendered. Unlike the other
+    // functions it doesn't wait for the frames queued on the render thread. With a render thread
+    // the timings only arrive while it renders frames, so the last few frames before it goes
+    // idle aren't counted until the next ones are rendered.
+    CASSIA_EXPORT size_t cassia_get_frame_stats(CassiaScopeStats* stats, size_t capacity);
+    // Writes the timings of the next frames to a Chrome trace at `path`, with the CPU scopes and
+    // the GPU passes on one timeline, until cassia_stop_trace. Returns false if the file can't be
+    // created or the adapter doesn't support timestamp queries.
+    CASSIA_EXPORT bool cassia_start_trace(const char* path);
+    CASSIA_EXPORT void cassia_stop_trace();
+    // Only times one frame every `interval` frames, the others are rendered without timestamp
+    // queries or readbacks. Defaults to 1, which times every frame.
+    CASSIA_EXPORT void cassia_set_timestamp_sampling(uint32_t interval);
+    // Switches to builds of the raster kernels that count their work, which are slower and
+    // compiled when first enabled. Only CassiaRasterizer_TileWorkgroup counts everything,
+    // CassiaRasterizer_TileParallel only counts the rows, tiles, psegments and dropped carries.
+    // Disabled by default.
+    CASSIA_EXPORT void cassia_set_raster_counters(bool enabled);
+    // Copies the counters of the last frame that was counted by the on-screen rasterizer in
+    // `counters`. They are read back a few frames after the frame is rendered. Returns false if
+    // there are none yet.
+    CASSIA_EXPORT bool cassia_get_raster_counters(CassiaRasterCounters* counters);
+    // The carries, or runs for CassiaRasterizer_TileParallel, that the on-screen rasterizer
+    // dropped for lack of room since it was created, which makes frames render wrong. Only the
+    // frames whose stats were read back are counted, so any non-zero value is a problem even
+    // when cassia_set_raster_counters is disabled.
+    CASSIA_EXPORT uint64_t cassia_get_dropped_carries();
+    // Returns mapped GPU-visible memory for up to psegmentCapacity psegments so that they can be
+    // written without intermediate copies. Only one span can be acquired at a time and it
+    // stays valid until cassia_commit_segments. Returns NULL if a span is already acquired.
+    CASSIA_EXPORT uint64_t* cassia_acquire_segment_span(size_t psegmentCapacity);
+    // Renders the frame like cassia_render using the first psegmentCount psegments written in
+    // the acquired span.
+    CASSIA_EXPORT void cassia_commit_segments(
+        size_t psegmentCount,
+        const CassiaStyling* stylings,
+        size_t stylingCount
+    );
+    // Renders the frame and copies the picture as tightly packed RGBA8 rows, top row first.
+    // Returns false if rgbaSize is smaller than width * height * 4 or if the readback failed.
+    CASSIA_EXPORT bool cassia_render_to_buffer(
+        const uint64_t* psegments,
+        size_t psegmentCount,
+        const CassiaStyling* stylings,
+        size_t stylingCount,
+        uint8_t* rgba,
+        size_t rgbaSize
+    );
     CASSIA_EXPORT void cassia_shutdown();
 }
 
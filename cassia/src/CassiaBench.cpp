@@ -0,0 +1,778 @@
+#include "Cassia.h"
+#include "JSON.h"
+#include "SceneFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Renders scenes with each rasterizer at several resolutions and reports the min, median and 99th
+// percentile of the time of each pass as JSON. With --compare, the medians are also compared with
+// those of a previous report and regressions make the process fail.
+
+namespace {
+
+    struct RasterizerName {
+        CassiaRasterizer rasterizer;
+        const char* name;
+    };
+    constexpr RasterizerName kRasterizers[] = {
+        {CassiaRasterizer_Naive, "naive"},
+        {CassiaRasterizer_TileWorkgroup, "tile_workgroup"},
+        {CassiaRasterizer_Cpu, "cpu"},
+        {CassiaRasterizer_TileParallel, "tile_parallel"},
+    };
+
+    // Differences of the medians below it are noise, whatever their percentage.
+    constexpr double kMinRegressionMs = 0.01;
+
+    struct Resolution {
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct Options {
+        uint32_t warmupIterations = 10;
+        uint32_t iterations = 100;
+        std::vector<Resolution> resolutions;
+        std::vector<const RasterizerName*> rasterizers;
+        // The segment and styling files of each scene, or a scene file and an empty string.
+        std::vector<std::pair<std::string, std::string>> scenes;
+        std::string outputPath;
+        std::string baselinePath;
+        double thresholdPercent = 5.0;
+        bool verifyChecksums = false;
+    };
+
+    struct Scene {
+        // The frames rendered in turn, which point in the mapping of the scene file or in the
+        // vectors loaded from a segment and a styling file.
+        std::vector<cassia::SceneFrame> frames;
+        std::unique_ptr<cassia::SceneFile> file;
+        std::vector<uint64_t> psegments;
+        std::vector<CassiaStyling> stylings;
+    };
+
+    struct Summary {
+        double minMs;
+        double medianMs;
+        double p99Ms;
+    };
+
+    // The times of a pass in the measured frames.
+    struct PassSamples {
+        std::string name;
+        bool hasGPU = false;
+        std::vector<double> cpuTimesMs;
+        std::vector<double> gpuTimesMs;
+    };
+
+    struct Result {
+        std::string scene;
+        Resolution resolution;
+        const char* rasterizer;
+        // The wall time of the frames on the host, from cassia_render_to_buffer's call to its return.
+        std::vector<double> frameTimesMs;
+        std::vector<PassSamples> passes;
+    };
+
+    void PrintUsage() {
+        std::cout << "Usage: cassia_bench [OPTIONS] SCENE [SCENE...]\n"
+                  << "  Each SCENE is either a .scene file, rendered at its own resolution and cycling\n"
+                  << "  through its frames, or a SEGMENT_FILE and a STYLINGS_FILE.\n"
+                  << "  --warmup N          Frames rendered before measuring, defaults to 10.\n"
+                  << "  --iterations N      Frames measured, defaults to 100. The 99th percentile is\n"
+                  << "                      the maximum with less than 100.\n"
+                  << "  --resolutions LIST  Comma-separated WIDTHxHEIGHT, defaults to 1000x1000.\n"
+                  << "  --rasterizers LIST  Comma-separated among naive, tile_workgroup, cpu and\n"
+                  << "                      tile_parallel, defaults to all of them.\n"
+                  << "  --output FILE       Writes the JSON report to FILE instead of stdout.\n"
+                  << "  --compare FILE      Compares the medians with the report in FILE.\n"
+                  << "  --threshold PERCENT The slowdown of a median reported as a regression,\n"
+                  << "                      defaults to 5.\n"
+                  << "  --verify            Checks the checksums of the scene files before using them,\n"
+                  << "                      which reads them entirely." << std::endl;
+    }
+
+    std::vector<std::string> SplitList(const std::string& list) {
+        std::vector<std::string> items;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    bool ParseUint(const char* string, uint32_t* value) {
+        char* end = nullptr;
+        unsigned long parsed = strtoul(string, &end, 10);
+        if (end == string || *end != '\0' || parsed > UINT32_MAX) {
+            return false;
+        }
+        *value = static_cast<uint32_t>(parsed);
+        return true;
+    }
+
+    bool IsSceneFile(const std::string& path) {
+        const std::string extension = ".scene";
+        return path.size() > extension.size() &&
+               path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+    }
+
+    bool ParseOptions(int argc, const char** argv, Options* options) {
+        std::vector<std::string> files;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0) {
+                files.push_back(arg);
+                continue;
+            }
+            if (arg == "--verify") {
+                options->verifyChecksums = true;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                std::cerr << "Missing the value of " << arg << std::endl;
+                return false;
+            }
+            const char* value = argv[++i];
+
+            if (arg == "--warmup") {
+                if (!ParseUint(value, &options->warmupIterations)) {
+                    std::cerr << "Invalid warm-up iterations " << value << std::endl;
+                    return false;
+                }
+            } else if (arg == "--iterations") {
+                if (!ParseUint(value, &options->iterations) || options->iterations == 0) {
+                    std::cerr << "Invalid iterations " << value << std::endl;
+                    return false;
+                }
+            } else if (arg == "--resolutions") {
+                for (const std::string& item : SplitList(value)) {
+                    Resolution resolution;
+                    char end;
+                    if (sscanf(item.c_str(), "%ux%u%c", &resolution.width, &resolution.height, &end) != 2 ||
+                        resolution.width == 0 || resolution.height == 0) {
+                        std::cerr << "Invalid resolution " << item << std::endl;
+                        return false;
+                    }
+                    options->resolutions.push_back(resolution);
+                }
+            } else if (arg == "--rasterizers") {
+                for (const std::string& item : SplitList(value)) {
+                    auto it = std::find_if(std::begin(kRasterizers), std::end(kRasterizers),
+                                           [&](const RasterizerName& r) { return item == r.name; });
+                    if (it == std::end(kRasterizers)) {
+                        std::cerr << "Unknown rasterizer " << item << std::endl;
+                        return false;
+                    }
+                    options->rasterizers.push_back(it);
+                }
+            } else if (arg == "--output") {
+                options->outputPath = value;
+            } else if (arg == "--compare") {
+                options->baselinePath = value;
+            } else if (arg == "--threshold") {
+                char* end = nullptr;
+                options->thresholdPercent = strtod(value, &end);
+                if (end == value || *end != '\0' || options->thresholdPercent < 0.0) {
+                    std::cerr << "Invalid threshold " << value << std::endl;
+                    return false;
+                }
+            } else {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+
+        if (files.empty()) {
+            return false;
+        }
+        for (size_t i = 0; i < files.size(); i++) {
+            if (IsSceneFile(files[i])) {
+                options->scenes.emplace_back(files[i], "");
+                continue;
+            }
+            if (i + 1 >= files.size()) {
+                std::cerr << "Missing the styling file of " << files[i] << std::endl;
+                return false;
+            }
+            options->scenes.emplace_back(files[i], files[i + 1]);
+            i++;
+        }
+        if (options->resolutions.empty()) {
+            options->resolutions.push_back({1000, 1000});
+        }
+        if (options->rasterizers.empty()) {
+            for (const RasterizerName& rasterizer : kRasterizers) {
+                options->rasterizers.push_back(&rasterizer);
+            }
+        }
+        return true;
+    }
+
+    bool ReadFile(const std::string& path, std::string* contents) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Couldn't open " << path << std::endl;
+            return false;
+        }
+        contents->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    bool LoadScene(const std::string& segmentPath, const std::string& stylingPath, Scene* scene) {
+        std::string segments;
+        std::string stylings;
+        if (!ReadFile(segmentPath, &segments) || !ReadFile(stylingPath, &stylings)) {
+            return false;
+        }
+        if (segments.size() % sizeof(uint64_t) != 0 || stylings.size() % sizeof(CassiaStyling) != 0) {
+            std::cerr << "Truncated scene " << segmentPath << std::endl;
+            return false;
+        }
+
+        scene->psegments.resize(segments.size() / sizeof(uint64_t));
+        std::copy(segments.begin(), segments.end(), reinterpret_cast<char*>(scene->psegments.data()));
+        scene->stylings.resize(stylings.size() / sizeof(CassiaStyling));
+        std::copy(stylings.begin(), stylings.end(), reinterpret_cast<char*>(scene->stylings.data()));
+        scene->frames.push_back({scene->psegments.data(), scene->psegments.size(), scene->stylings.data(),
+                                 scene->stylings.size()});
+        return true;
+    }
+
+    bool LoadSceneFile(const std::string& path, bool verifyChecksum, Scene* scene) {
+        scene->file = cassia::SceneFile::Open(path);
+        if (scene->file == nullptr) {
+            return false;
+        }
+        if (verifyChecksum && !scene->file->VerifyChecksum()) {
+            std::cerr << path << " is corrupted, its checksum doesn't match." << std::endl;
+            return false;
+        }
+        if (scene->file->GetFrameCount() == 0) {
+            std::cerr << "No frames in " << path << std::endl;
+            return false;
+        }
+
+        // The psegments are only valid for the tile size they were encoded for.
+        uint32_t tileWidthShift;
+        uint32_t tileHeightShift;
+        cassia_get_tile_shifts(&tileWidthShift, &tileHeightShift);
+        if (scene->file->GetTileWidthShift() != tileWidthShift ||
+            scene->file->GetTileHeightShift() != tileHeightShift) {
+            std::cerr << path << " is encoded for " << (1u << scene->file->GetTileWidthShift()) << "x"
+                      << (1u << scene->file->GetTileHeightShift()) << " tiles instead of "
+                      << (1u << tileWidthShift) << "x" << (1u << tileHeightShift) << std::endl;
+            return false;
+        }
+
+        for (size_t i = 0; i < scene->file->GetFrameCount(); i++) {
+            scene->frames.push_back(scene->file->GetFrame(i));
+        }
+        return true;
+    }
+
+    Summary Summarize(std::vector<double> samples) {
+        if (samples.empty()) {
+            return {0.0, 0.0, 0.0};
+        }
+        // Nearest ranks, the smallest samples with at least 50% and 99% of the samples at or
+        // below them, computed on integers to avoid rounding 0.99 * n. The 99th percentile is
+        // the maximum below 100 samples.
+        std::sort(samples.begin(), samples.end());
+        size_t count = samples.size();
+        size_t medianRank = (count + 1) / 2 - 1;
+        size_t p99Rank = (99 * count + 99) / 100 - 1;
+        return {samples.front(), samples[medianRank], samples[p99Rank]};
+    }
+
+    // Returns the stats of all the scopes, whose last times are those of the last timed frame.
+    std::vector<CassiaScopeStats> GetFrameStats() {
+        std::vector<CassiaScopeStats> stats(16);
+        size_t count = cassia_get_frame_stats(stats.data(), stats.size());
+        if (count > stats.size()) {
+            stats.resize(count);
+            count = cassia_get_frame_stats(stats.data(), stats.size());
+        }
+        stats.resize(std::min(count, stats.size()));
+        return stats;
+    }
+
+    bool RunBenchmark(const Options& options, const Scene& scene, Result* result) {
+        const Resolution& resolution = result->resolution;
+        std::vector<uint8_t> rgba(size_t(resolution.width) * resolution.height * 4);
+        size_t frameIndex = 0;
+        auto RenderFrame = [&]() {
+            const cassia::SceneFrame& frame = scene.frames[frameIndex];
+            frameIndex = (frameIndex + 1) % scene.frames.size();
+            return cassia_render_to_buffer(frame.psegments, frame.psegmentCount, frame.stylings,
+                                           frame.stylingCount, rgba.data(), rgba.size());
+        };
+
+        for (uint32_t i = 0; i < options.warmupIterations; i++) {
+            if (!RenderFrame()) {
+                return false;
+            }
+        }
+
+        // cassia_render_to_buffer waits for the GPU so the timings of each frame are known when
+        // it returns. Only the scopes whose frame count changed were in the frame.
+        std::map<std::string, uint64_t> frameCounts;
+        for (const CassiaScopeStats& scope : GetFrameStats()) {
+            frameCounts[scope.name] = scope.frameCount;
+        }
+
+        for (uint32_t i = 0; i < options.iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            if (!RenderFrame()) {
+                return false;
+            }
+            auto end = std::chrono::steady_clock::now();
+            result->frameTimesMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+            for (const CassiaScopeStats& scope : GetFrameStats()) {
+                uint64_t& frameCount = frameCounts[scope.name];
+                if (scope.frameCount == frameCount) {
+                    continue;
+                }
+                frameCount = scope.frameCount;
+
+                auto pass = std::find_if(result->passes.begin(), result->passes.end(),
+                                         [&](const PassSamples& p) { return p.name == scope.name; });
+                if (pass == result->passes.end()) {
+                    result->passes.push_back({});
+                    pass = result->passes.end() - 1;
+                    pass->name = scope.name;
+                }
+                pass->hasGPU = pass->hasGPU || scope.hasGPU;
+                pass->cpuTimesMs.push_back(scope.lastCpuTimeMs);
+                pass->gpuTimesMs.push_back(scope.lastGpuTimeMs);
+            }
+        }
+        return true;
+    }
+
+    ///////////////////////////////////////////////////////////////////
+    // Report
+    ///////////////////////////////////////////////////////////////////
+
+    void WriteSummary(std::ostream& out, const Summary& summary) {
+        out << "{\"minMs\": " << summary.minMs << ", \"medianMs\": " << summary.medianMs
+            << ", \"p99Ms\": " << summary.p99Ms << "}";
+    }
+
+    void WriteReport(std::ostream& out, const Options& options, const std::vector<Result>& results) {
+        out << std::fixed << std::setprecision(4);
+        out << "{\n";
+        out << "  \"warmupIterations\": " << options.warmupIterations << ",\n";
+        out << "  \"iterations\": " << options.iterations << ",\n";
+        out << "  \"results\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            out << (i == 0 ? "\n" : ",\n");
+            out << "    {\n";
+            out << "      \"scene\": \"" << cassia::EscapeJSON(result.scene) << "\",\n";
+            out << "      \"width\": " << result.resolution.width << ",\n";
+            out << "      \"height\": " << result.resolution.height << ",\n";
+            out << "      \"rasterizer\": \"" << result.rasterizer << "\",\n";
+            out << "      \"frame\": ";
+            WriteSummary(out, Summarize(result.frameTimesMs));
+            out << ",\n";
+            out << "      \"passes\": [";
+            for (size_t j = 0; j < result.passes.size(); j++) {
+                const PassSamples& pass = result.passes[j];
+                out << (j == 0 ? "\n" : ",\n");
+                out << "        {\"name\": \"" << cassia::EscapeJSON(pass.name) << "\", \"samples\": "
+                    << pass.cpuTimesMs.size() << ", \"cpu\": ";
+                WriteSummary(out, Summarize(pass.cpuTimesMs));
+                if (pass.hasGPU) {
+                    out << ", \"gpu\": ";
+                    WriteSummary(out, Summarize(pass.gpuTimesMs));
+                }
+                out << "}";
+            }
+            out << "\n      ]\n";
+            out << "    }";
+        }
+        out << "\n  ]\n";
+        out << "}\n";
+    }
+
+    ///////////////////////////////////////////////////////////////////
+    // Comparison
+    ///////////////////////////////////////////////////////////////////
+
+    // Just enough JSON to read the reports back.
+    struct JsonValue {
+        enum class Type {
+            Null,
+            Bool,
+            Number,
+            String,
+            Array,
+            Object,
+        };
+        Type type = Type::Null;
+        bool boolean = false;
+        double number = 0.0;
+        std::string string;
+        std::vector<JsonValue> array;
+        std::vector<std::pair<std::string, JsonValue>> object;
+
+        // Returns null if the value isn't an object with that member.
+        const JsonValue* Get(const char* key) const {
+            for (const auto& member : object) {
+                if (member.first == key) {
+                    return &member.second;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    class JsonParser {
+      public:
+        JsonParser(const std::string& text) : mText(text) {
+        }
+
+        bool Parse(JsonValue* value) {
+            if (!ParseValue(value)) {
+                return false;
+            }
+            SkipSpaces();
+            return mPos == mText.size();
+        }
+
+      private:
+        void SkipSpaces() {
+            while (mPos < mText.size() && isspace(static_cast<unsigned char>(mText[mPos]))) {
+                mPos++;
+            }
+        }
+
+        bool Consume(char c) {
+            SkipSpaces();
+            if (mPos < mText.size() && mText[mPos] == c) {
+                mPos++;
+                return true;
+            }
+            return false;
+        }
+
+        bool ConsumeWord(const char* word) {
+            size_t length = strlen(word);
+            if (mText.compare(mPos, length, word) != 0) {
+                return false;
+            }
+            mPos += length;
+            return true;
+        }
+
+        bool ParseString(std::string* string) {
+            if (!Consume('"')) {
+                return false;
+            }
+            while (mPos < mText.size()) {
+                char c = mText[mPos++];
+                if (c == '"') {
+                    return true;
+                }
+                if (c != '\\') {
+                    *string += c;
+                    continue;
+                }
+                if (mPos >= mText.size()) {
+                    return false;
+                }
+                char escaped = mText[mPos++];
+                switch (escaped) {
+                    case 'n':
+                        *string += '\n';
+                        break;
+                    case 't':
+                        *string += '\t';
+                        break;
+                    case 'u':
+                        // The reports don't have other characters escaped, they are only kept
+                        // to compare names.
+                        if (mPos + 4 > mText.size()) {
+                            return false;
+                        }
+                        *string += "\\u" + mText.substr(mPos, 4);
+                        mPos += 4;
+                        break;
+                    default:
+                        *string += escaped;
+                        break;
+                }
+            }
+            return false;
+        }
+
+        bool ParseValue(JsonValue* value) {
+            SkipSpaces();
+            if (mPos >= mText.size()) {
+                return false;
+            }
+
+            switch (mText[mPos]) {
+                case '{':
+                    mPos++;
+                    value->type = JsonValue::Type::Object;
+                    if (Consume('}')) {
+                        return true;
+                    }
+                    do {
+                        std::pair<std::string, JsonValue> member;
+                        if (!ParseString(&member.first) || !Consume(':') || !ParseValue(&member.second)) {
+                            return false;
+                        }
+                        value->object.push_back(std::move(member));
+                    } while (Consume(','));
+                    return Consume('}');
+
+                case '[':
+                    mPos++;
+                    value->type = JsonValue::Type::Array;
+                    if (Consume(']')) {
+                        return true;
+                    }
+                    do {
+                        value->array.emplace_back();
+                        if (!ParseValue(&value->array.back())) {
+                            return false;
+                        }
+                    } while (Consume(','));
+                    return Consume(']');
+
+                case '"':
+                    value->type = JsonValue::Type::String;
+                    return ParseString(&value->string);
+
+                default:
+                    break;
+            }
+
+            if (ConsumeWord("true")) {
+                value->type = JsonValue::Type::Bool;
+                value->boolean = true;
+                return true;
+            }
+            if (ConsumeWord("false")) {
+                value->type = JsonValue::Type::Bool;
+                return true;
+            }
+            if (ConsumeWord("null")) {
+                value->type = JsonValue::Type::Null;
+                return true;
+            }
+
+            const char* start = mText.c_str() + mPos;
+            char* end = nullptr;
+            value->number = strtod(start, &end);
+            if (end == start) {
+                return false;
+            }
+            value->type = JsonValue::Type::Number;
+            mPos += end - start;
+            return true;
+        }
+
+        const std::string& mText;
+        size_t mPos = 0;
+    };
+
+    std::string MedianKey(const std::string& scene, uint32_t width, uint32_t height, const std::string& rasterizer,
+                          const std::string& pass, const char* clock) {
+        return scene + " " + std::to_string(width) + "x" + std::to_string(height) + " " + rasterizer + " " + pass +
+               " " + clock;
+    }
+
+    // The medians of a report by scene, resolution, rasterizer, pass and clock.
+    using Medians = std::map<std::string, double>;
+
+    Medians GetMedians(const std::vector<Result>& results) {
+        Medians medians;
+        for (const Result& result : results) {
+            const Resolution& res = result.resolution;
+            medians[MedianKey(result.scene, res.width, res.height, result.rasterizer, "Frame", "host")] =
+                    Summarize(result.frameTimesMs).medianMs;
+            for (const PassSamples& pass : result.passes) {
+                medians[MedianKey(result.scene, res.width, res.height, result.rasterizer, pass.name, "cpu")] =
+                        Summarize(pass.cpuTimesMs).medianMs;
+                if (pass.hasGPU) {
+                    medians[MedianKey(result.scene, res.width, res.height, result.rasterizer, pass.name, "gpu")] =
+                            Summarize(pass.gpuTimesMs).medianMs;
+                }
+            }
+        }
+        return medians;
+    }
+
+    bool ReadBaselineMedians(const std::string& path, Medians* medians) {
+        std::string text;
+        if (!ReadFile(path, &text)) {
+            return false;
+        }
+        JsonValue report;
+        if (!JsonParser(text).Parse(&report) || report.Get("results") == nullptr) {
+            std::cerr << "Invalid report " << path << std::endl;
+            return false;
+        }
+
+        auto MedianOf = [](const JsonValue* summary, double* median) {
+            const JsonValue* value = summary != nullptr ? summary->Get("medianMs") : nullptr;
+            if (value == nullptr || value->type != JsonValue::Type::Number) {
+                return false;
+            }
+            *median = value->number;
+            return true;
+        };
+
+        for (const JsonValue& result : report.Get("results")->array) {
+            const JsonValue* scene = result.Get("scene");
+            const JsonValue* width = result.Get("width");
+            const JsonValue* height = result.Get("height");
+            const JsonValue* rasterizer = result.Get("rasterizer");
+            if (scene == nullptr || width == nullptr || height == nullptr || rasterizer == nullptr) {
+                continue;
+            }
+            auto Key = [&](const std::string& pass, const char* clock) {
+                return MedianKey(scene->string, static_cast<uint32_t>(width->number),
+                                 static_cast<uint32_t>(height->number), rasterizer->string, pass, clock);
+            };
+
+            double median;
+            if (MedianOf(result.Get("frame"), &median)) {
+                (*medians)[Key("Frame", "host")] = median;
+            }
+            const JsonValue* passes = result.Get("passes");
+            if (passes == nullptr) {
+                continue;
+            }
+            for (const JsonValue& pass : passes->array) {
+                const JsonValue* name = pass.Get("name");
+                if (name == nullptr) {
+                    continue;
+                }
+                if (MedianOf(pass.Get("cpu"), &median)) {
+                    (*medians)[Key(name->string, "cpu")] = median;
+                }
+                if (MedianOf(pass.Get("gpu"), &median)) {
+                    (*medians)[Key(name->string, "gpu")] = median;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Prints the medians present in both reports and returns the number of regressions.
+    uint32_t CompareMedians(const Medians& baseline, const Medians& current, double thresholdPercent) {
+        uint32_t regressions = 0;
+        std::cerr << std::fixed << std::setprecision(4);
+        for (const auto& entry : current) {
+            auto base = baseline.find(entry.first);
+            if (base == baseline.end()) {
+                continue;
+            }
+
+            double delta = entry.second - base->second;
+            double percent = base->second > 0.0 ? 100.0 * delta / base->second : 0.0;
+            bool regressed = percent > thresholdPercent && delta > kMinRegressionMs;
+            regressions += regressed ? 1 : 0;
+
+            std::cerr << (regressed ? "REGRESSED " : "          ") << entry.first << ": " << base->second
+                      << "ms -> " << entry.second << "ms (" << std::showpos << std::setprecision(1) << percent
+                      << std::noshowpos << std::setprecision(4) << "%)" << std::endl;
+        }
+        return regressions;
+    }
+
+} // anonymous namespace
+
+int main(int argc, const char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for (const auto& files : options.scenes) {
+        Scene scene;
+        bool isSceneFile = files.second.empty();
+        if (isSceneFile ? !LoadSceneFile(files.first, options.verifyChecksums, &scene) : !LoadScene(files.first, files.second, &scene)) {
+            return 1;
+        }
+
+        // Scene files are encoded for a single resolution.
+        std::vector<Resolution> resolutions = options.resolutions;
+        if (isSceneFile) {
+            resolutions = {{scene.file->GetWidth(), scene.file->GetHeight()}};
+        }
+
+        for (const Resolution& resolution : resolutions) {
+            for (const RasterizerName* rasterizer : options.rasterizers) {
+                Result result;
+                result.scene = files.first;
+                result.resolution = resolution;
+                result.rasterizer = rasterizer->name;
+
+                // Each run starts from a fresh context so that the timings only have its frames.
+                cassia_init_headless(resolution.width, resolution.height);
+                bool success = cassia_set_rasterizer(rasterizer->rasterizer) && cassia_precompile() &&
+                               RunBenchmark(options, scene, &result);
+                cassia_shutdown();
+
+                if (!success) {
+                    std::cerr << "Failed to run " << rasterizer->name << " on " << files.first << " at "
+                              << resolution.width << "x" << resolution.height << std::endl;
+                    return 1;
+                }
+                results.push_back(std::move(result));
+            }
+        }
+    }
+
+    if (options.outputPath.empty()) {
+        WriteReport(std::cout, options, results);
+    } else {
+        std::ofstream output(options.outputPath, std::ios::trunc);
+        if (!output) {
+            std::cerr << "Couldn't create " << options.outputPath << std::endl;
+            return 1;
+        }
+        WriteReport(output, options, results);
+    }
+
+    if (!options.baselinePath.empty()) {
+        Medians baseline;
+        if (!ReadBaselineMedians(options.baselinePath, &baseline)) {
+            return 1;
+        }
+        uint32_t regressions = CompareMedians(baseline, GetMedians(results), options.thresholdPercent);
+        if (regressions != 0) {
+            std::cerr << regressions << " medians regressed by more than " << options.thresholdPercent << "%"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "Cassia.h"
+#include "SceneFile.h"
+#include "SceneGenerator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+    void PrintUsage() {
+        std::cout << "Usage: cassia_generate_scene KIND OUTPUT [OPTIONS]\n"
+                  << "Writes the OUTPUT scene file if it ends with .scene, otherwise OUTPUT.segs and\n"
+                  << "OUTPUT.stylings, for cassia_bench.\n"
+                  << "  KIND is one of circles, glyphs, layers, wide, offscreen_left and carry_spills.\n"
+                  << "  --count N         The number of shapes, or of layers for layers and carry_spills.\n"
+                  << "  --size WxH        The size of the canvas.\n"
+                  << "  --seed N          The seed of the random shapes and colors.\n"
+                  << "  --tile-size WxH   The tile size to encode the psegments for, defaults to the\n"
+                  << "                    one of the cassia library." << std::endl;
+    }
+
+    bool ParseUint(const char* string, uint32_t* value) {
+        char* end = nullptr;
+        unsigned long parsed = strtoul(string, &end, 10);
+        if (end == string || *end != '\0' || parsed > UINT32_MAX) {
+            return false;
+        }
+        *value = static_cast<uint32_t>(parsed);
+        return true;
+    }
+
+    bool ParseSize(const char* string, uint32_t* width, uint32_t* height) {
+        char end;
+        return sscanf(string, "%ux%u%c", width, height, &end) == 2;
+    }
+
+    uint32_t Log2(uint32_t value) {
+        uint32_t log2 = 0;
+        while ((2u << log2) <= value) {
+            log2++;
+        }
+        return log2;
+    }
+
+    bool WriteFile(const std::string& path, const void* data, size_t size) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(static_cast<const char*>(data), size);
+        if (!file) {
+            std::cerr << "Couldn't write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool WriteSceneFile(const std::string& path, const cassia::SceneParams& params,
+                        const cassia::GeneratedScene& scene) {
+        std::unique_ptr<cassia::SceneFileWriter> writer = cassia::SceneFileWriter::Create(
+                path, params.width, params.height, params.tileWidthShift, params.tileHeightShift);
+        if (writer == nullptr) {
+            return false;
+        }
+        if (!writer->AddFrame(scene.psegments.data(), scene.psegments.size(), scene.stylings.data(),
+                              scene.stylings.size()) ||
+            !writer->Finish()) {
+            std::cerr << "Couldn't write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+} // anonymous namespace
+
+int main(int argc, const char** argv) {
+    cassia::SceneKind kind;
+    if (argc < 3 || argc % 2 != 1 || !cassia::SceneGenerator::ParseKind(argv[1], &kind)) {
+        PrintUsage();
+        return 1;
+    }
+    std::string output = argv[2];
+
+    cassia::SceneParams params = cassia::SceneGenerator::GetDefaultParams(kind);
+    cassia_get_tile_shifts(&params.tileWidthShift, &params.tileHeightShift);
+
+    for (int i = 3; i < argc; i += 2) {
+        std::string option = argv[i];
+        const char* value = argv[i + 1];
+
+        bool valid = true;
+        if (option == "--count") {
+            valid = ParseUint(value, &params.count);
+        } else if (option == "--size") {
+            valid = ParseSize(value, &params.width, &params.height);
+        } else if (option == "--seed") {
+            valid = ParseUint(value, &params.seed);
+        } else if (option == "--tile-size") {
+            uint32_t tileWidth;
+            uint32_t tileHeight;
+            valid = ParseSize(value, &tileWidth, &tileHeight) && tileWidth != 0 && tileHeight != 0;
+            params.tileWidthShift = Log2(tileWidth);
+            params.tileHeightShift = Log2(tileHeight);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            PrintUsage();
+            return 1;
+        }
+
+        if (!valid) {
+            std::cerr << "Invalid value " << value << " for " << option << std::endl;
+            return 1;
+        }
+    }
+
+    cassia::GeneratedScene scene;
+    if (!cassia::SceneGenerator::Generate(params, &scene)) {
+        std::cerr << "Can't encode a " << params.width << "x" << params.height << " "
+                  << cassia::SceneGenerator::GetKindName(kind) << " scene with " << params.count
+                  << " shapes in psegments for " << (1u << params.tileWidthShift) << "x"
+                  << (1u << params.tileHeightShift) << " tiles." << std::endl;
+        return 1;
+    }
+
+    const std::string extension = ".scene";
+    if (output.size() > extension.size() &&
+        output.compare(output.size() - extension.size(), extension.size(), extension) == 0) {
+        if (!WriteSceneFile(output, params, scene)) {
+            return 1;
+        }
+    } else if (!WriteFile(output + ".segs", scene.psegments.data(), scene.psegments.size() * sizeof(uint64_t)) ||
+               !WriteFile(output + ".stylings", scene.stylings.data(),
+                          scene.stylings.size() * sizeof(CassiaStyling))) {
+        return 1;
+    }
+
+    std::cout << "Generated " << scene.psegments.size() << " psegments in " << scene.stylings.size()
+              << " layers for " << params.width << "x" << params.height << std::endl;
+    return 0;
+}
@@ -0,0 +1,23 @@
+#include "Cassia.h"
+
+#include <iostream>
+
+// Validates the WGSL of all the rasterizers and stores their compiled shaders in a pipeline
+// cache directory, so that the processes using it start without compiling them.
+int main(int argc, const char** argv) {
+    if (argc != 2) {
+        std::cout << "Usage: cassia_precompile [PIPELINE_CACHE_DIRECTORY]" << std::endl;
+        return 1;
+    }
+
+    cassia_set_pipeline_cache_directory(argv[1]);
+    cassia_init_headless(8, 8);
+    bool success = cassia_precompile();
+    cassia_shutdown();
+
+    if (!success) {
+        std::cout << "Compiling the shaders failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
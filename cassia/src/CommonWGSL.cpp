@@ -2,7 +2,7 @@
 
 namespace cassia {
 
-    const char kPSegmentWGSL[] = R"(
+    const std::string kPSegmentWGSL = Tile::WGSLConstants() + R"(
         // This is the definition of a PSegment in mold
         //
         // pub const TILE_WIDTH: usize = 8;
@@ -29,10 +29,6 @@ namespace cassia {
             hi: u32;
         };
 
-        // Also keep the constants in CommonWGSL.h in sync.
-        let TILE_WIDTH_SHIFT = 3u;
-        let TILE_HEIGHT_SHIFT = 3u;
-        let TILE_X_OFFSET = 256;
         let PIXEL_SIZE = 16;
         let PIXEL_AREA = 256;
 
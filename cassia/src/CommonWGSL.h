@@ -2,26 +2,113 @@
 #define CASSIA_COMMONWGSL_H_
 
 #include <cstdint>
+#include <string>
+
+// The size of the tiles is chosen when building cassia, see CASSIA_TILE_SIZE in CMakeLists.txt.
+#ifndef CASSIA_TILE_WIDTH_SHIFT
+#    define CASSIA_TILE_WIDTH_SHIFT 3
+#endif
+#ifndef CASSIA_TILE_HEIGHT_SHIFT
+#    define CASSIA_TILE_HEIGHT_SHIFT 3
+#endif
 
 namespace cassia {
 
-    // Also keep the constants in kPSegmentWGSL in sync.
-    constexpr uint32_t TILE_WIDTH_SHIFT = 3u;
-    constexpr uint32_t TILE_HEIGHT_SHIFT = 3u;
+    // Added to tile_x so that the psegments left of the picture sort before the others.
     constexpr uint32_t TILE_X_OFFSET = 256;
 
-    struct PSegment {
-        int64_t cover: 6;
-        int64_t area: 10;
-        uint64_t local_x: TILE_WIDTH_SHIFT;
-        uint64_t local_y: TILE_HEIGHT_SHIFT;
-        uint64_t layer: 16;
-        int64_t tile_x: (16 - TILE_WIDTH_SHIFT);
-        int64_t tile_y: (15 - TILE_HEIGHT_SHIFT);
-        uint64_t is_none: 1;
+    // Everything that depends on the size of the tiles: the PSegment layout for the host and the
+    // constants that kPSegmentWGSL and the kernels are generated with.
+    template <uint32_t WidthShift, uint32_t HeightShift>
+    struct TileGeometry {
+        static constexpr uint32_t kWidthShift = WidthShift;
+        static constexpr uint32_t kHeightShift = HeightShift;
+        static constexpr uint32_t kWidth = 1u << WidthShift;
+        static constexpr uint32_t kHeight = 1u << HeightShift;
+
+        // The rasterizers use a thread per row and per pixel of a tile, and tile_x needs room for
+        // TILE_X_OFFSET.
+        static_assert(kHeight >= 4 && kHeight <= 16, "Unsupported tile height.");
+        static_assert(kWidth >= 4 && kWidth <= 16 && kWidth * kHeight <= 256, "Unsupported tile width.");
+
+        struct PSegment {
+            int64_t cover: 6;
+            int64_t area: 10;
+            uint64_t local_x: WidthShift;
+            uint64_t local_y: HeightShift;
+            uint64_t layer: 16;
+            int64_t tile_x: (16 - WidthShift);
+            int64_t tile_y: (15 - HeightShift);
+            uint64_t is_none: 1;
+        };
+
+        static constexpr uint32_t kLayerBitOffset = 16 + WidthShift + HeightShift;
+        static constexpr uint32_t kTileXBitOffset = kLayerBitOffset + 16;
+        static constexpr uint32_t kTileYBitOffset = kTileXBitOffset + (16 - WidthShift);
+
+        static std::string WGSLConstants() {
+            return "let TILE_WIDTH_SHIFT = " + std::to_string(kWidthShift) + "u;\n" +
+                   "let TILE_HEIGHT_SHIFT = " + std::to_string(kHeightShift) + "u;\n" +
+                   "let TILE_WIDTH = " + std::to_string(kWidth) + "u;\n" +
+                   "let TILE_WIDTH_PLUS_ONE = " + std::to_string(kWidth + 1) + "u;\n" +
+                   "let TILE_HEIGHT = " + std::to_string(kHeight) + "u;\n" +
+                   "let TILE_X_OFFSET = " + std::to_string(TILE_X_OFFSET) + ";\n";
+        }
     };
 
-    extern const char kPSegmentWGSL[];
+    using Tile = TileGeometry<CASSIA_TILE_WIDTH_SHIFT, CASSIA_TILE_HEIGHT_SHIFT>;
+    using PSegment = Tile::PSegment;
+
+    constexpr uint32_t TILE_WIDTH_SHIFT = Tile::kWidthShift;
+    constexpr uint32_t TILE_HEIGHT_SHIFT = Tile::kHeightShift;
+    constexpr uint32_t TILE_WIDTH = Tile::kWidth;
+    constexpr uint32_t TILE_HEIGHT = Tile::kHeight;
+
+    // Offset of the first PSegment bit that the rasterizers need the segments to be sorted by.
+    // Sorting by the bits above it orders segments by tile_y, tile_x then layer.
+    constexpr uint32_t PSEGMENT_LAYER_OFFSET = Tile::kLayerBitOffset;
+    constexpr uint32_t PSEGMENT_TILE_X_OFFSET = Tile::kTileXBitOffset;
+    constexpr uint32_t PSEGMENT_TILE_Y_OFFSET = Tile::kTileYBitOffset;
+
+    constexpr uint32_t WidthInTiles(uint32_t width) {
+        return (width + (1u << TILE_WIDTH_SHIFT) - 1) >> TILE_WIDTH_SHIFT;
+    }
+    constexpr uint32_t HeightInTiles(uint32_t height) {
+        return (height + (1u << TILE_HEIGHT_SHIFT) - 1) >> TILE_HEIGHT_SHIFT;
+    }
+
+    // The range of sorted psegments in a tile. Tile ranges are stored row by row, each row
+    // starting with the tile_x == -1 tile that only contributes carries to the row:
+    // index = (tile_x + 1) + tile_y * (widthInTiles + 1).
+    struct TileRange {
+        uint32_t start;
+        uint32_t end; // Exclusive
+    };
+
+    constexpr uint32_t kInvalidTileRangeIndex = 0xFFFFFFFFu;
+
+    // The index of the psegment's tile range, or kInvalidTileRangeIndex if the psegment is none or
+    // outside of the grid of tiles.
+    inline uint32_t PSegmentTileRangeIndex(uint64_t psegment, uint32_t widthInTiles, uint32_t heightInTiles) {
+        // Negative tile coordinates wrap to large unsigned values that fail the bound checks.
+        uint32_t hi = uint32_t(psegment >> 32);
+        uint32_t column = ((hi >> (PSEGMENT_TILE_X_OFFSET - 32)) & ((1u << (16 - TILE_WIDTH_SHIFT)) - 1)) -
+                          (TILE_X_OFFSET - 1);
+        uint32_t tileY = (hi >> (PSEGMENT_TILE_Y_OFFSET - 32)) & ((1u << (15 - TILE_HEIGHT_SHIFT)) - 1);
+        bool isNone = (hi >> 31) != 0;
+
+        if (isNone || column > widthInTiles || tileY >= heightInTiles) {
+            return kInvalidTileRangeIndex;
+        }
+        return column + tileY * (widthInTiles + 1);
+    }
+
+    inline uint32_t PSegmentLayer(uint64_t psegment) {
+        return uint32_t(psegment >> PSEGMENT_LAYER_OFFSET) & 0xFFFF;
+    }
+
+    // Starts with the constants of the tile geometry.
+    extern const std::string kPSegmentWGSL;
     extern const char kStylingWGSL[];
 
 } // namespace cassia
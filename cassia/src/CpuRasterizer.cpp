@@ -0,0 +1,120 @@
+#include "CpuRasterizer.h"
+
+#include "EncodingContext.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace cassia {
+
+    namespace {
+
+        constexpr size_t kTileRangeChunkSize = 1 << 16;
+
+        CpuRasterizeTileRowFn SelectRasterizeTileRow() {
+#if defined(CASSIA_CPU_RASTERIZER_AVX2) && (defined(__GNUC__) || defined(__clang__))
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+                __builtin_cpu_supports("f16c")) {
+                return CpuRasterizeTileRowAVX2;
+            }
+#endif
+            return CpuRasterizeTileRowBaseline;
+        }
+
+    } // anonymous namespace
+
+    CpuRasterizer::CpuRasterizer(wgpu::Device device, ResourcePool* pool, ThreadPool* threadPool)
+        : mDevice(std::move(device)), mPool(pool), mThreadPool(threadPool),
+          mRasterizeTileRow(SelectRasterizeTileRow()) {
+    }
+
+    bool CpuRasterizer::NeedsHostInputs() const {
+        return true;
+    }
+
+    wgpu::Texture CpuRasterizer::Rasterize(EncodingContext* context, const Inputs& inputs,
+        const Config& config) {
+        ScopedCPUPass pass(context, "CpuRasterizer");
+
+        wgpu::Texture outTexture = mPool->GetTexture("CpuRasterizer::Output",
+                config.width, config.height, wgpu::TextureFormat::RGBA16Float,
+                wgpu::TextureUsage::CopyDst | wgpu::TextureUsage::TextureBinding);
+
+        if (inputs.hostSortedPsegments == nullptr ||
+            (config.stylingCount != 0 && inputs.hostStylings == nullptr)) {
+            std::cerr << "CpuRasterizer needs the sorted psegments and the stylings on the host." << std::endl;
+            return outTexture;
+        }
+
+        uint32_t widthInTiles = WidthInTiles(config.width);
+        uint32_t heightInTiles = HeightInTiles(config.height);
+
+        const TileRange* tileRanges = inputs.hostTileRanges;
+        if (tileRanges == nullptr) {
+            ComputeTileRanges(inputs.hostSortedPsegments, config.segmentCount, widthInTiles, heightInTiles);
+            tileRanges = mTileRanges.data();
+        }
+
+        mPixels.resize(size_t(config.width) * config.height * 4);
+
+        CpuRasterizerJob job = {
+            inputs.hostSortedPsegments,
+            tileRanges,
+            inputs.hostStylings,
+            config.stylingCount,
+            config.width,
+            config.height,
+            widthInTiles,
+            heightInTiles,
+            mPixels.data(),
+        };
+        mThreadPool->ParallelFor(heightInTiles, [&](size_t tileY) {
+            mRasterizeTileRow(job, static_cast<uint32_t>(tileY));
+        });
+
+        wgpu::ImageCopyTexture destination = {};
+        destination.texture = outTexture;
+        wgpu::TextureDataLayout layout = {};
+        layout.offset = 0;
+        layout.bytesPerRow = config.width * 4 * sizeof(uint16_t);
+        layout.rowsPerImage = config.height;
+        wgpu::Extent3D size = {config.width, config.height, 1};
+        mDevice.GetQueue().WriteTexture(&destination, mPixels.data(), mPixels.size() * sizeof(uint16_t),
+                                        &layout, &size);
+
+        return outTexture;
+    }
+
+    // Same as computeTileRanges in TileWorkgroupRasterizer: the ranges start and end where two
+    // consecutive psegments are in different tiles.
+    void CpuRasterizer::ComputeTileRanges(const uint64_t* sortedPsegments, uint32_t segmentCount,
+                                          uint32_t widthInTiles, uint32_t heightInTiles) {
+        mTileRanges.assign(size_t(widthInTiles + 1) * heightInTiles, TileRange{0, 0});
+
+        size_t chunkCount = (size_t(segmentCount) + kTileRangeChunkSize - 1) / kTileRangeChunkSize;
+        mThreadPool->ParallelFor(chunkCount, [&](size_t chunk) {
+            uint32_t begin = static_cast<uint32_t>(chunk * kTileRangeChunkSize);
+            uint32_t end = static_cast<uint32_t>(std::min(size_t(segmentCount), (chunk + 1) * kTileRangeChunkSize));
+
+            uint32_t tile = PSegmentTileRangeIndex(sortedPsegments[begin], widthInTiles, heightInTiles);
+            for (uint32_t i = begin; i < end; i++) {
+                uint32_t nextTile = kInvalidTileRangeIndex;
+                if (i + 1 < segmentCount) {
+                    nextTile = PSegmentTileRangeIndex(sortedPsegments[i + 1], widthInTiles, heightInTiles);
+                }
+
+                if (tile != nextTile) {
+                    if (tile != kInvalidTileRangeIndex) {
+                        mTileRanges[tile].end = i + 1;
+                    }
+                    if (nextTile != kInvalidTileRangeIndex) {
+                        mTileRanges[nextTile].start = i + 1;
+                    }
+                }
+                tile = nextTile;
+            }
+        });
+    }
+
+} // namespace cassia
@@ -0,0 +1,41 @@
+#ifndef CASSIA_CPURASTERIZER_H
+#define CASSIA_CPURASTERIZER_H
+
+#include "CpuRasterizerKernel.h"
+#include "Rasterizer.h"
+#include "ResourcePool.h"
+
+#include <vector>
+
+namespace cassia {
+
+    class ThreadPool;
+
+    // Rasterizes on the CPU with the same algorithm and output as TileWorkgroupRasterizer, with
+    // rows of tiles processed in parallel on the thread pool. The picture is then uploaded to a
+    // texture so it can be used like the output of the other rasterizers.
+    class CpuRasterizer final : public Rasterizer {
+      public:
+        CpuRasterizer(wgpu::Device device, ResourcePool* pool, ThreadPool* threadPool);
+        ~CpuRasterizer() override = default;
+
+        bool NeedsHostInputs() const override;
+        wgpu::Texture Rasterize(EncodingContext* context, const Inputs& inputs,
+            const Config& config) override;
+
+      private:
+        void ComputeTileRanges(const uint64_t* sortedPsegments, uint32_t segmentCount,
+                               uint32_t widthInTiles, uint32_t heightInTiles);
+
+        wgpu::Device mDevice;
+        ResourcePool* mPool;
+        ThreadPool* mThreadPool;
+        CpuRasterizeTileRowFn mRasterizeTileRow;
+
+        std::vector<TileRange> mTileRanges;
+        std::vector<uint16_t> mPixels;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_CPURASTERIZER_H
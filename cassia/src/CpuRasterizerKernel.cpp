@@ -0,0 +1,9 @@
+#include "CpuRasterizerKernelImpl.h"
+
+namespace cassia {
+
+    void CpuRasterizeTileRowBaseline(const CpuRasterizerJob& job, uint32_t tileY) {
+        CASSIA_SIMD_NAMESPACE::RasterizeTileRow(job, tileY);
+    }
+
+} // namespace cassia
@@ -0,0 +1,35 @@
+#ifndef CASSIA_CPURASTERIZERKERNEL_H
+#define CASSIA_CPURASTERIZERKERNEL_H
+
+#include "Cassia.h"
+#include "CommonWGSL.h"
+
+namespace cassia {
+
+    // Everything the CPU rasterization kernels need to rasterize a row of tiles.
+    struct CpuRasterizerJob {
+        const uint64_t* psegments;
+        const TileRange* tileRanges;
+        const CassiaStyling* stylings;
+        uint32_t stylingCount;
+        uint32_t width;
+        uint32_t height;
+        uint32_t widthInTiles;
+        uint32_t heightInTiles;
+        // Tightly packed RGBA16Float pixels.
+        uint16_t* output;
+    };
+
+    using CpuRasterizeTileRowFn = void (*)(const CpuRasterizerJob& job, uint32_t tileY);
+
+    // Uses the instruction sets the library is compiled for.
+    void CpuRasterizeTileRowBaseline(const CpuRasterizerJob& job, uint32_t tileY);
+
+#if defined(CASSIA_CPU_RASTERIZER_AVX2)
+    // Must only be called if the CPU supports AVX2, FMA and F16C.
+    void CpuRasterizeTileRowAVX2(const CpuRasterizerJob& job, uint32_t tileY);
+#endif
+
+} // namespace cassia
+
+#endif // CASSIA_CPURASTERIZERKERNEL_H
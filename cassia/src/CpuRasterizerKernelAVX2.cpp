@@ -0,0 +1,13 @@
+#include "CpuRasterizerKernelImpl.h"
+
+#if !defined(CASSIA_SIMD_AVX2)
+#error "CpuRasterizerKernelAVX2.cpp must be compiled with AVX2, FMA and F16C enabled."
+#endif
+
+namespace cassia {
+
+    void CpuRasterizeTileRowAVX2(const CpuRasterizerJob& job, uint32_t tileY) {
+        simd_avx2::RasterizeTileRow(job, tileY);
+    }
+
+} // namespace cassia
@@ -0,0 +1,283 @@
+#ifndef CASSIA_CPURASTERIZERKERNELIMPL_H
+#define CASSIA_CPURASTERIZERKERNELIMPL_H
+
+// The CPU rasterization kernel, compiled once for each instruction set in the CpuRasterizerKernel
+// files. Everything here must stay in CASSIA_SIMD_NAMESPACE, and not call inline functions from
+// other headers, so that code compiled for an instruction set can't leak into another file.
+
+#include "CpuRasterizerKernel.h"
+#include "SimdF32x8.h"
+
+#include <vector>
+
+namespace cassia {
+namespace CASSIA_SIMD_NAMESPACE {
+
+    // The rows of a tile are the lanes of the vectors and the columns are processed one by one,
+    // like the rows are the threads of the GPU kernels. Taller tiles use a vector per group of 8
+    // rows, and shorter ones leave the extra lanes at zero.
+    constexpr int32_t kTileWidth = TILE_WIDTH;
+    constexpr int32_t kTileHeight = TILE_HEIGHT;
+    constexpr int32_t kRowGroups = (kTileHeight + 7) / 8;
+    constexpr int32_t kPaddedTileHeight = kRowGroups * 8;
+
+    constexpr uint32_t kInvalidLayer = 0xFFFFFFFFu;
+    constexpr int32_t kPixelSizeShift = 4; // PIXEL_SIZE == 16
+    constexpr int32_t kPixelArea = 256;
+
+    // Mirrors the psegment accessors in kPSegmentWGSL.
+    inline uint32_t SegmentLayer(uint64_t psegment) {
+        return uint32_t(psegment >> PSEGMENT_LAYER_OFFSET) & 0xFFFF;
+    }
+    inline uint32_t SegmentLocalX(uint64_t psegment) {
+        return (uint32_t(psegment) >> 16) & (kTileWidth - 1);
+    }
+    inline uint32_t SegmentLocalY(uint64_t psegment) {
+        return (uint32_t(psegment) >> (16 + TILE_WIDTH_SHIFT)) & (kTileHeight - 1);
+    }
+    inline int32_t SegmentArea(uint64_t psegment) {
+        return int32_t(uint32_t(psegment) << 16) >> 22;
+    }
+    inline int32_t SegmentCover(uint64_t psegment) {
+        return int32_t(uint32_t(psegment) << 26) >> 26;
+    }
+
+    struct LayerCarry {
+        uint32_t layer;
+        int32_t covers[kPaddedTileHeight];
+    };
+
+    inline bool AnyNonZeroRows(const int32_t* covers) {
+        for (int32_t row = 0; row < kPaddedTileHeight; row += 8) {
+            if (AnyNonZero(LoadI(covers + row))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // A column of 8 rows of pixels of a tile.
+    struct PixelColumn {
+        F32x8 r, g, b, a;
+    };
+
+    // Mirrors styling_coverage_to_alpha.
+    inline F32x8 CoverageToAlpha(I32x8 coverage, uint32_t fillRule) {
+        const F32x8 inversePixelArea = Splat(1.0f / kPixelArea);
+
+        // NonZero
+        if (fillRule == 0) {
+            return Min(Max(Abs(ToFloat(coverage) * inversePixelArea), Splat(0.0f)), Splat(1.0f));
+        }
+
+        // EvenOdd
+        I32x8 windingNumber = ShiftRightArithmetic<8>(coverage);
+        F32x8 fractionalPart = ToFloat(coverage & SplatI(kPixelArea - 1)) * inversePixelArea;
+        Mask8 even = (windingNumber & SplatI(1)) == SplatI(0);
+        return Select(even, fractionalPart, Splat(1.0f) - fractionalPart);
+    }
+
+    // Mirrors the color computation of styling_do_blend for one of the channels.
+    inline F32x8 BlendChannel(uint32_t blendMode, F32x8 dst, F32x8 src) {
+        const F32x8 zero = Splat(0.0f);
+        const F32x8 half = Splat(0.5f);
+        const F32x8 one = Splat(1.0f);
+        const F32x8 two = Splat(2.0f);
+
+        switch (blendMode) {
+            // Over
+            case 0:
+                return src;
+            // Multiply
+            case 1:
+                return dst * src;
+            // Screen
+            case 2:
+                return Fma(dst, src * Splat(-1.0f), src);
+            // Overlay
+            case 3:
+                return two * Select(src <= half, dst * src, dst + src - Fma(dst, src, half));
+            // Darken
+            case 4:
+                return Min(dst, src);
+            // Lighten
+            case 5:
+                return Max(dst, src);
+            // ColorDodge
+            case 6:
+                return Select(src == zero, zero, Min(one, src / (one - dst)));
+            // ColorBurn
+            case 7:
+                return Select(src == one, one, one - Min(one, (one - src) / dst));
+            // HardLight
+            case 8:
+                return two * Select(dst <= half, dst * src, dst + src - Fma(dst, src, half));
+            // SoftLight
+            case 9: {
+                F32x8 d = Select(src <= Splat(0.25f),
+                                 src * Fma(Fma(Splat(16.0f), src, Splat(-12.0f)), src, Splat(4.0f)),
+                                 Sqrt(src));
+                return two * Select(dst <= half, src * (one - src),
+                                    Fma(d - src, Fma(two, dst, Splat(-1.0f)), src));
+            }
+            // Difference
+            case 10:
+                return Abs(dst - src);
+            // Exclusion
+            case 11:
+                return Fma(dst, Fma(Splat(-2.0f), src, one), src);
+            default:
+                return zero;
+        }
+    }
+
+    // Mirrors styling_accumulate_layer.
+    inline void AccumulateLayer(PixelColumn* pixels, I32x8 coverage, const CassiaStyling& styling) {
+        F32x8 alpha = Splat(styling.fill[3]) * CoverageToAlpha(coverage, styling.fillRule);
+        F32x8 inverseAlpha = Splat(1.0f) - alpha;
+
+        F32x8 r = BlendChannel(styling.blendMode, pixels->r, Splat(styling.fill[0]) * alpha);
+        F32x8 g = BlendChannel(styling.blendMode, pixels->g, Splat(styling.fill[1]) * alpha);
+        F32x8 b = BlendChannel(styling.blendMode, pixels->b, Splat(styling.fill[2]) * alpha);
+
+        pixels->r = Fma(pixels->r, inverseAlpha, r);
+        pixels->g = Fma(pixels->g, inverseAlpha, g);
+        pixels->b = Fma(pixels->b, inverseAlpha, b);
+        pixels->a = Fma(pixels->a, inverseAlpha, alpha);
+    }
+
+    inline void WriteTile(const CpuRasterizerJob& job, uint32_t tileX, uint32_t tileY,
+                          const PixelColumn (*pixels)[kTileWidth]) {
+        uint16_t channels[4][8];
+
+        for (uint32_t group = 0; group < uint32_t(kRowGroups); group++) {
+            for (uint32_t x = 0; x < uint32_t(kTileWidth); x++) {
+                uint32_t pixelX = tileX * kTileWidth + x;
+                if (pixelX >= job.width) {
+                    break;
+                }
+
+                const PixelColumn& column = pixels[group][x];
+                StoreHalf(column.r, channels[0]);
+                StoreHalf(column.g, channels[1]);
+                StoreHalf(column.b, channels[2]);
+                StoreHalf(column.a, channels[3]);
+
+                for (uint32_t y = 0; y < 8; y++) {
+                    uint32_t row = group * 8 + y;
+                    uint32_t pixelY = tileY * kTileHeight + row;
+                    if (row >= uint32_t(kTileHeight) || pixelY >= job.height) {
+                        break;
+                    }
+
+                    uint16_t* out = job.output + (size_t(pixelY) * job.width + pixelX) * 4;
+                    for (int c = 0; c < 4; c++) {
+                        out[c] = channels[c][y];
+                    }
+                }
+            }
+        }
+    }
+
+    // Same algorithm as TileWorkgroupRasterizer: the tiles of the row are processed from left to
+    // right, merging the sorted psegments of each tile with the carries from the previous tile.
+    // Every layer present in a tile is accumulated for all its pixels.
+    inline void RasterizeTileRow(const CpuRasterizerJob& job, uint32_t tileY) {
+        const uint64_t* segments = job.psegments;
+        const TileRange* rowRanges = job.tileRanges + size_t(tileY) * (job.widthInTiles + 1);
+
+        // Reused between rows to avoid allocations.
+        thread_local std::vector<LayerCarry> tInCarries;
+        thread_local std::vector<LayerCarry> tOutCarries;
+        std::vector<LayerCarry>& inCarries = tInCarries;
+        std::vector<LayerCarry>& outCarries = tOutCarries;
+        outCarries.clear();
+
+        // The tile at tile_x == -1 only produces carries for the first tile.
+        {
+            TileRange range = rowRanges[0];
+            uint32_t segmentIndex = range.start;
+            while (segmentIndex < range.end) {
+                LayerCarry carry = {SegmentLayer(segments[segmentIndex]), {}};
+                for (; segmentIndex < range.end && SegmentLayer(segments[segmentIndex]) == carry.layer;
+                     segmentIndex++) {
+                    uint64_t segment = segments[segmentIndex];
+                    carry.covers[SegmentLocalY(segment)] += SegmentCover(segment);
+                }
+
+                if (AnyNonZeroRows(carry.covers)) {
+                    outCarries.push_back(carry);
+                }
+            }
+        }
+
+        for (uint32_t tileX = 0; tileX < job.widthInTiles; tileX++) {
+            inCarries.swap(outCarries);
+            outCarries.clear();
+
+            PixelColumn pixels[kRowGroups][kTileWidth];
+            for (PixelColumn (&group)[kTileWidth] : pixels) {
+                for (PixelColumn& column : group) {
+                    column = {Splat(0.0f), Splat(0.0f), Splat(0.0f), Splat(0.0f)};
+                }
+            }
+
+            TileRange range = rowRanges[tileX + 1];
+            uint32_t segmentIndex = range.start;
+            size_t carryIndex = 0;
+
+            while (true) {
+                uint32_t segmentLayer = segmentIndex < range.end ? SegmentLayer(segments[segmentIndex]) : kInvalidLayer;
+                uint32_t carryLayer = carryIndex < inCarries.size() ? inCarries[carryIndex].layer : kInvalidLayer;
+                uint32_t layer = segmentLayer < carryLayer ? segmentLayer : carryLayer;
+                if (layer == kInvalidLayer) {
+                    break;
+                }
+
+                // covers[x + 1] holds the covers of the psegments with local_x == x, and covers[0]
+                // the covers carried from the previous tile.
+                int32_t covers[kTileWidth + 1][kPaddedTileHeight] = {};
+                int32_t areas[kTileWidth][kPaddedTileHeight] = {};
+
+                if (carryLayer == layer) {
+                    memcpy(covers[0], inCarries[carryIndex].covers, sizeof(covers[0]));
+                    carryIndex++;
+                }
+                for (; segmentIndex < range.end && SegmentLayer(segments[segmentIndex]) == layer; segmentIndex++) {
+                    uint64_t segment = segments[segmentIndex];
+                    uint32_t localX = SegmentLocalX(segment);
+                    uint32_t localY = SegmentLocalY(segment);
+                    covers[localX + 1][localY] += SegmentCover(segment);
+                    areas[localX][localY] += SegmentArea(segment);
+                }
+
+                // The prefix sum of the covers along the rows is done for 8 rows at once.
+                bool hasStyling = layer < job.stylingCount;
+                LayerCarry carry;
+                carry.layer = layer;
+                for (int32_t group = 0; group < kRowGroups; group++) {
+                    int32_t row = group * 8;
+                    I32x8 cover = SplatI(0);
+                    for (int32_t x = 0; x < kTileWidth; x++) {
+                        cover = cover + LoadI(covers[x] + row);
+                        if (hasStyling) {
+                            I32x8 coverage = LoadI(areas[x] + row) + ShiftLeft<kPixelSizeShift>(cover);
+                            AccumulateLayer(&pixels[group][x], coverage, job.stylings[layer]);
+                        }
+                    }
+                    StoreI(cover + LoadI(covers[kTileWidth] + row), carry.covers + row);
+                }
+
+                if (AnyNonZeroRows(carry.covers)) {
+                    outCarries.push_back(carry);
+                }
+            }
+
+            WriteTile(job, tileX, tileY, pixels);
+        }
+    }
+
+} // namespace CASSIA_SIMD_NAMESPACE
+} // namespace cassia
+
+#endif // CASSIA_CPURASTERIZERKERNELIMPL_H
@@ -1,5 +1,6 @@
 #include "EncodingContext.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <memory>
@@ -15,17 +16,34 @@ namespace cassia {
 
     // EncodingContext
 
-    EncodingContext::EncodingContext(wgpu::Device device, bool hasTimestamps) : mGatherTimestamps(hasTimestamps), mDevice(std::move(device)) {
-        mEncoder = mDevice.CreateCommandEncoder();
+    namespace {
+        // Each query set is resolved at an offset that is a multiple of 256 bytes.
+        constexpr uint32_t kQueriesPerSet = 256;
 
-        if (!mGatherTimestamps) {
-            return;
+        void PrintTimings(const FrameTimings& timings) {
+            std::cout << "Scopes:" << std::endl;
+            for (const PassTiming& timing : timings.passes) {
+                std::cout << " - " << timing.name << std::endl;
+                std::cout << "   - CPU time: " << timing.cpuTimeMs << "ms" << std::endl;
+
+                if (timing.hasGPU) {
+                    std::cout << "   - GPU time: " << timing.gpuTimeMs << "ms" << std::endl;
+                }
+            }
         }
+    }
+
+    EncodingContext::EncodingContext(wgpu::Device device, bool hasTimestamps) : mDevice(std::move(device)), mGatherTimestamps(hasTimestamps) {
+        mEncoder = mDevice.CreateCommandEncoder();
+        StartFrame();
+    }
 
-        wgpu::QuerySetDescriptor queryDesc;
-        queryDesc.type = wgpu::QueryType::Timestamp;
-        queryDesc.count = 1000;
-        mGpuTimestamps = mDevice.CreateQuerySet(&queryDesc);
+    EncodingContext::~EncodingContext() {
+        // Destroying the buffers calls the callbacks of their pending maps now, while the context
+        // is still alive.
+        for (std::unique_ptr<Readback>& readback : mReadbacks) {
+            readback->buffer.Destroy();
+        }
     }
 
     const wgpu::CommandEncoder& EncodingContext::GetEncoder() const {
@@ -33,64 +51,125 @@ namespace cassia {
     }
 
     void EncodingContext::SubmitOn(const wgpu::Queue& queue) {
-        // Resolve the queries as uint64_ts in readbackBuffer.
-        wgpu::Buffer timestampReadback;
-        if (mGatherTimestamps) {
-            wgpu::BufferDescriptor bufDesc;
-            bufDesc.size = sizeof(uint64_t) * mScopes.size() * 2;
-            bufDesc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
-            wgpu::Buffer resolveBuffer = mDevice.CreateBuffer(&bufDesc);
-
-            bufDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
-            timestampReadback = mDevice.CreateBuffer(&bufDesc);
-
-            mEncoder.ResolveQuerySet(mGpuTimestamps, 0, mScopes.size() * 2, resolveBuffer, 0);
-            mEncoder.CopyBufferToBuffer(resolveBuffer, 0, timestampReadback, 0, bufDesc.size);
+        // Resolve the queries as uint64_ts and copy them in a mappable buffer.
+        Readback* readback = nullptr;
+        if (mTimingFrame && !mScopes.empty()) {
+            uint64_t size = sizeof(uint64_t) * std::max(mQueryCount, 2u);
+            if (mResolveBufferSize < size) {
+                mResolveBufferSize = std::max(size, mResolveBufferSize * 2);
+                wgpu::BufferDescriptor bufDesc;
+                bufDesc.label = "EncodingContext::mResolveBuffer";
+                bufDesc.size = mResolveBufferSize;
+                bufDesc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+                mResolveBuffer = mDevice.CreateBuffer(&bufDesc);
+            }
+
+            for (uint32_t first = 0; first < mQueryCount; first += kQueriesPerSet) {
+                mEncoder.ResolveQuerySet(mQuerySets[first / kQueriesPerSet], 0,
+                                         std::min(kQueriesPerSet, mQueryCount - first), mResolveBuffer,
+                                         sizeof(uint64_t) * first);
+            }
+
+            readback = AcquireReadback(size);
+            mEncoder.CopyBufferToBuffer(mResolveBuffer, 0, readback->buffer, 0, size);
         }
 
         wgpu::CommandBuffer commands = mEncoder.Finish();
+        uint64_t submitCpuTimeNs = GetNowAsNS();
         queue.Submit(1, &commands);
 
-        mEncoder = nullptr;
-        mGpuTimestamps = nullptr;
-
-        // Map the timestamp buffer asynchronously and print timestamp data when done.
-        if (mGatherTimestamps) {
-            struct Userdata {
-                std::vector<Scope> scopes;
-                wgpu::Buffer gpuTimestampBuffer;
-
-                void PrintTimestamps() {
-                    const uint64_t* gpuTimestamps = reinterpret_cast<const uint64_t*>(gpuTimestampBuffer.GetConstMappedRange());
-                    std::cout << "Scopes:" << std::endl;
-                    for (size_t i = 0; i < scopes.size(); i++) {
-                        std::cout << " - " << scopes[i].name << std::endl;
-
-                        float cpuTimeMs = (scopes[i].endCpuTimeNs - scopes[i].startCpuTimeNs) / 1000'000.0;
-                        std::cout << "   - CPU time: " << cpuTimeMs << "ms" << std::endl;
-
-                        if (scopes[i].hasGPU) {
-                            float gpuTimeMs = (gpuTimestamps[i * 2 + 1] - gpuTimestamps[i * 2]) / 1000'000.0;
-                            std::cout << "   - GPU time: " << gpuTimeMs << "ms" << std::endl;
-                        }
-                    }
+        // Get ready to encode the next frame.
+        mEncoder = mDevice.CreateCommandEncoder();
+
+        // Map the timestamps asynchronously and report the timings when done. The vectors of
+        // scopes are swapped to keep their allocations.
+        if (readback != nullptr) {
+            readback->scopes.swap(mScopes);
+            readback->submitCpuTimeNs = submitCpuTimeNs;
+            readback->buffer.MapAsync(wgpu::MapMode::Read, 0, readback->size, [](WGPUBufferMapAsyncStatus status, void* userdata) {
+                Readback* readback = static_cast<Readback*>(userdata);
+                readback->context->OnReadbackMapped(readback, status == WGPUBufferMapAsyncStatus_Success);
+            }, readback);
+        }
+        mScopes.clear();
+        mQueryCount = 0;
+        StartFrame();
+    }
+
+    EncodingContext::Readback* EncodingContext::AcquireReadback(uint64_t size) {
+        Readback* readback = nullptr;
+        if (!mFreeReadbacks.empty()) {
+            readback = mFreeReadbacks.back();
+            mFreeReadbacks.pop_back();
+        } else {
+            mReadbacks.push_back(std::make_unique<Readback>());
+            readback = mReadbacks.back().get();
+            readback->context = this;
+            readback->capacity = 0;
+        }
+
+        if (readback->capacity < size) {
+            readback->capacity = std::max(size, readback->capacity * 2);
+            wgpu::BufferDescriptor bufDesc;
+            bufDesc.label = "EncodingContext::Readback";
+            bufDesc.size = readback->capacity;
+            bufDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+            readback->buffer = mDevice.CreateBuffer(&bufDesc);
+        }
+        readback->size = size;
+        return readback;
+    }
+
+    void EncodingContext::OnReadbackMapped(Readback* readback, bool success) {
+        FrameTimings timings;
+        timings.submitCpuTimeNs = readback->submitCpuTimeNs;
+        timings.failed = !success;
+        if (success) {
+            const uint64_t* gpuTimestamps = static_cast<const uint64_t*>(
+                    readback->buffer.GetConstMappedRange(0, readback->size));
+
+            for (const Scope& scope : readback->scopes) {
+                PassTiming timing = {scope.name, 0.0, 0.0, scope.hasGPU};
+                timing.cpuTimeMs = (scope.endCpuTimeNs - scope.startCpuTimeNs) / 1000'000.0;
+                timing.cpuStartNs = scope.startCpuTimeNs;
+                if (scope.hasGPU) {
+                    uint64_t gpuStartNs = gpuTimestamps[scope.queryIndex];
+                    timing.gpuTimeMs = (gpuTimestamps[scope.queryIndex + 1] - gpuStartNs) / 1000'000.0;
+                    timing.gpuStartNs = gpuStartNs;
                 }
-            };
-            Userdata* userdata = new Userdata;
-            userdata->scopes = std::move(mScopes);
-            userdata->gpuTimestampBuffer = timestampReadback;
-
-            timestampReadback.MapAsync(wgpu::MapMode::Read, 0, 0, [](WGPUBufferMapAsyncStatus, void* userdataIn) {
-                std::unique_ptr<Userdata> userdata(static_cast<Userdata*>(userdataIn));
-                userdata->PrintTimestamps();
-            }, userdata);
+                timings.passes.push_back(timing);
+            }
+            readback->buffer.Unmap();
         }
+
+        // Failed frames are still reported so that whoever waits for them can stop.
+        if (mTimingsCallback) {
+            mTimingsCallback(timings);
+        } else if (success) {
+            PrintTimings(timings);
+        }
+
+        readback->scopes.clear();
+        mFreeReadbacks.push_back(readback);
+    }
+
+    void EncodingContext::SetTimingsCallback(TimingsCallback callback) {
+        mTimingsCallback = std::move(callback);
+    }
+
+    void EncodingContext::SetSamplingInterval(uint32_t interval) {
+        mSamplingInterval = std::max(interval, 1u);
+    }
+
+    void EncodingContext::StartFrame() {
+        mTimingFrame = mGatherTimestamps && mFrameIndex % mSamplingInterval == 0;
+        mFrameIndex++;
     }
 
     void EncodingContext::OnStartPass(const char* name, bool hasGPU) {
         mEncoder.PushDebugGroup(name);
 
-        if (!mGatherTimestamps) {
+        if (!mTimingFrame) {
             return;
         }
 
@@ -99,20 +178,32 @@ namespace cassia {
         mScopes.back().startCpuTimeNs = GetNowAsNS();
         mScopes.back().hasGPU = hasGPU;
         if (hasGPU) {
-            mEncoder.WriteTimestamp(mGpuTimestamps, mScopes.size() * 2 - 2);
+            // The two queries of a scope are in the same query set since kQueriesPerSet is even.
+            uint32_t queryIndex = mQueryCount;
+            mQueryCount += 2;
+            if (mQuerySets.size() * kQueriesPerSet < mQueryCount) {
+                wgpu::QuerySetDescriptor queryDesc;
+                queryDesc.type = wgpu::QueryType::Timestamp;
+                queryDesc.count = kQueriesPerSet;
+                mQuerySets.push_back(mDevice.CreateQuerySet(&queryDesc));
+            }
+
+            mScopes.back().queryIndex = queryIndex;
+            mEncoder.WriteTimestamp(mQuerySets[queryIndex / kQueriesPerSet], queryIndex % kQueriesPerSet);
         }
     }
 
     void EncodingContext::OnEndPass() {
         mEncoder.PopDebugGroup();
 
-        if (!mGatherTimestamps) {
+        if (!mTimingFrame) {
             return;
         }
 
         mScopes.back().endCpuTimeNs = GetNowAsNS();
         if (mScopes.back().hasGPU) {
-            mEncoder.WriteTimestamp(mGpuTimestamps, mScopes.size() * 2 - 1);
+            uint32_t queryIndex = mScopes.back().queryIndex + 1;
+            mEncoder.WriteTimestamp(mQuerySets[queryIndex / kQueriesPerSet], queryIndex % kQueriesPerSet);
         }
     }
 
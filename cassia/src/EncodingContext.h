@@ -3,18 +3,51 @@
 
 #include "webgpu/webgpu_cpp.h"
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace cassia {
 
+    struct PassTiming {
+        std::string name;
+        double cpuTimeMs;
+        double gpuTimeMs;
+        bool hasGPU;
+        // When the pass started, on the host clock and on the GPU's timestamp clock.
+        uint64_t cpuStartNs = 0;
+        uint64_t gpuStartNs = 0;
+    };
+
+    struct FrameTimings {
+        // When the frame was submitted, on the host clock.
+        uint64_t submitCpuTimeNs;
+        std::vector<PassTiming> passes;
+        // The timestamps couldn't be read back, for example after a device loss, and there are no
+        // passes.
+        bool failed = false;
+    };
+
     class EncodingContext {
       public:
+        using TimingsCallback = std::function<void(const FrameTimings&)>;
+
         EncodingContext(wgpu::Device device, bool hasTimestamps);
+        // Resolves the pending timestamp readbacks, whose timings are dropped.
+        ~EncodingContext();
 
         const wgpu::CommandEncoder& GetEncoder() const;
+        // Submits the commands encoded so far and starts encoding the next frame.
         void SubmitOn(const wgpu::Queue& queue);
 
+        // The timings of the passes of each submitted frame go to the callback instead of being
+        // printed once they are read back. Only used when the context gathers timestamps.
+        void SetTimingsCallback(TimingsCallback callback);
+        // Only gathers the timings of one frame every `interval` frames, the others don't write
+        // timestamps. Defaults to 1.
+        void SetSamplingInterval(uint32_t interval);
+
       private:
         friend class ScopedCPUPass;
         friend class ScopedComputePass;
@@ -31,11 +64,41 @@ namespace cassia {
             uint64_t startCpuTimeNs;
             uint64_t endCpuTimeNs;
             bool hasGPU;
+            // The first of the two timestamp queries of the GPU scopes.
+            uint32_t queryIndex;
         };
         std::vector<Scope> mScopes;
 
+        // The timestamps of a submitted frame being mapped. They are reused once read.
+        struct Readback {
+            EncodingContext* context;
+            wgpu::Buffer buffer;
+            uint64_t capacity;
+            // The bytes of the buffer used by the frame.
+            uint64_t size;
+            std::vector<Scope> scopes;
+            uint64_t submitCpuTimeNs;
+        };
+        Readback* AcquireReadback(uint64_t size);
+        void OnReadbackMapped(Readback* readback, bool success);
+        // Starts timing the next frame if it is sampled.
+        void StartFrame();
+
         bool mGatherTimestamps;
-        wgpu::QuerySet mGpuTimestamps;
+        // Whether the frame being encoded is timed.
+        bool mTimingFrame = false;
+        uint32_t mSamplingInterval = 1;
+        uint64_t mFrameIndex = 0;
+
+        // The query sets only grow, each holds kQueriesPerSet queries. They are reused by the
+        // next frame right away because their resolve is ordered before its timestamp writes.
+        std::vector<wgpu::QuerySet> mQuerySets;
+        uint32_t mQueryCount = 0;
+        wgpu::Buffer mResolveBuffer;
+        uint64_t mResolveBufferSize = 0;
+        std::vector<std::unique_ptr<Readback>> mReadbacks;
+        std::vector<Readback*> mFreeReadbacks;
+        TimingsCallback mTimingsCallback;
     };
 
     class ScopedCPUPass {
@@ -0,0 +1,97 @@
+#include "FrameStats.h"
+
+#include <algorithm>
+
+namespace cassia {
+
+    namespace {
+        constexpr double kPercentiles[3] = {0.50, 0.95, 0.99};
+
+        void ComputePercentiles(std::vector<float> samples, double percentilesMs[3]) {
+            for (size_t i = 0; i < 3; i++) {
+                if (samples.empty()) {
+                    percentilesMs[i] = 0.0;
+                    continue;
+                }
+                size_t rank = std::min(samples.size() - 1, static_cast<size_t>(kPercentiles[i] * samples.size()));
+                std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+                percentilesMs[i] = samples[rank];
+            }
+        }
+    }
+
+    void FrameStats::AddFrame(const FrameTimings& frame) {
+        struct Sum {
+            Scope* scope;
+            double cpuTimeMs;
+            double gpuTimeMs;
+        };
+        std::vector<Sum> sums;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const PassTiming& pass : frame.passes) {
+            auto it = mScopeIndices.find(pass.name);
+            if (it == mScopeIndices.end()) {
+                it = mScopeIndices.emplace(pass.name, mScopes.size()).first;
+                mScopes.push_back(std::make_unique<Scope>());
+                mScopes.back()->name = pass.name;
+            }
+            Scope* scope = mScopes[it->second].get();
+            scope->hasGPU = scope->hasGPU || pass.hasGPU;
+
+            auto sum = std::find_if(sums.begin(), sums.end(), [&](const Sum& s) {
+                return s.scope == scope;
+            });
+            if (sum == sums.end()) {
+                sums.push_back({scope, 0.0, 0.0});
+                sum = sums.end() - 1;
+            }
+            sum->cpuTimeMs += pass.cpuTimeMs;
+            sum->gpuTimeMs += pass.gpuTimeMs;
+        }
+
+        for (const Sum& sum : sums) {
+            uint64_t count = sum.scope->sampleCount;
+            sum.scope->cpuTimesMs[count % kWindowSize] = static_cast<float>(sum.cpuTimeMs);
+            sum.scope->gpuTimesMs[count % kWindowSize] = static_cast<float>(sum.gpuTimeMs);
+            sum.scope->sampleCount = count + 1;
+        }
+    }
+
+    std::vector<ScopeStats> FrameStats::GetScopeStats() const {
+        struct Samples {
+            std::vector<float> cpuTimesMs;
+            std::vector<float> gpuTimesMs;
+        };
+        std::vector<ScopeStats> stats;
+        std::vector<Samples> samples;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (const std::unique_ptr<Scope>& scope : mScopes) {
+                uint64_t count = scope->sampleCount;
+                size_t windowCount = static_cast<size_t>(std::min(count, uint64_t(kWindowSize)));
+
+                ScopeStats scopeStats = {};
+                scopeStats.name = &scope->name;
+                scopeStats.hasGPU = scope->hasGPU;
+                scopeStats.sampleCount = static_cast<uint32_t>(windowCount);
+                scopeStats.frameCount = count;
+                if (count != 0) {
+                    scopeStats.lastCpuTimeMs = scope->cpuTimesMs[(count - 1) % kWindowSize];
+                    scopeStats.lastGpuTimeMs = scope->gpuTimesMs[(count - 1) % kWindowSize];
+                }
+                stats.push_back(scopeStats);
+                samples.push_back({{scope->cpuTimesMs.begin(), scope->cpuTimesMs.begin() + windowCount},
+                                   {scope->gpuTimesMs.begin(), scope->gpuTimesMs.begin() + windowCount}});
+            }
+        }
+
+        for (size_t i = 0; i < stats.size(); i++) {
+            ComputePercentiles(std::move(samples[i].cpuTimesMs), stats[i].cpuPercentilesMs);
+            ComputePercentiles(std::move(samples[i].gpuTimesMs), stats[i].gpuPercentilesMs);
+        }
+        return stats;
+    }
+
+} // namespace cassia
@@ -0,0 +1,60 @@
+#ifndef CASSIA_FRAMESTATS_H
+#define CASSIA_FRAMESTATS_H
+
+#include "EncodingContext.h"
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cassia {
+
+    // The timings of a scope over the recent frames.
+    struct ScopeStats {
+        const std::string* name;
+        bool hasGPU;
+        uint32_t sampleCount;
+        // The number of frames with the scope since the first one.
+        uint64_t frameCount;
+        double lastCpuTimeMs;
+        double lastGpuTimeMs;
+        // The 50th, 95th and 99th percentiles.
+        double cpuPercentilesMs[3];
+        double gpuPercentilesMs[3];
+    };
+
+    // Keeps the timings of the last kWindowSize frames for each scope name, the scopes that run
+    // several times in a frame are summed. Frames can be added by the render thread while another
+    // thread reads the statistics.
+    class FrameStats {
+      public:
+        static constexpr size_t kWindowSize = 256;
+
+        void AddFrame(const FrameTimings& frame);
+
+        // The statistics of each scope, in the order they were first seen. The names stay valid
+        // for the lifetime of the FrameStats.
+        std::vector<ScopeStats> GetScopeStats() const;
+
+      private:
+        // A ring of samples overwritten in place.
+        struct Scope {
+            std::string name;
+            bool hasGPU = false;
+            std::array<float, kWindowSize> cpuTimesMs;
+            std::array<float, kWindowSize> gpuTimesMs;
+            uint64_t sampleCount = 0;
+        };
+
+        // Guards the scopes, which are only held while copying samples and not while sorting them.
+        mutable std::mutex mMutex;
+        std::vector<std::unique_ptr<Scope>> mScopes;
+        std::unordered_map<std::string, size_t> mScopeIndices;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_FRAMESTATS_H
@@ -0,0 +1,270 @@
+#include "HostSegmentSorter.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CASSIA_HOST_SORTER_AVX2
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define CASSIA_HOST_SORTER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace cassia {
+
+    namespace {
+
+        // Chunks are the unit of work of the histogram and scatter passes. Each has its own
+        // histogram so they don't need any synchronization.
+        constexpr size_t kMinSegmentsPerChunk = 1 << 16;
+        constexpr size_t kChunksPerThread = 4;
+        // Buckets are computed for a block of psegments at a time to let them be vectorized.
+        constexpr size_t kBlockSize = 256;
+        constexpr size_t kInsertionSortThreshold = 32;
+
+        // The tile fields are both in the high 32 bits of a psegment.
+        constexpr uint32_t kTileXShift = PSEGMENT_TILE_X_OFFSET - 32;
+        constexpr uint32_t kTileXMask = (1u << (16 - TILE_WIDTH_SHIFT)) - 1;
+        constexpr uint32_t kTileYShift = PSEGMENT_TILE_Y_OFFSET - 32;
+        constexpr uint32_t kTileYMask = (1u << (15 - TILE_HEIGHT_SHIFT)) - 1;
+        // tile_x is stored with TILE_X_OFFSET added and the tile range columns start at tile_x == -1.
+        constexpr uint32_t kColumnBias = TILE_X_OFFSET - 1;
+
+        struct BucketGrid {
+            uint32_t widthInTiles;
+            uint32_t heightInTiles;
+            uint32_t dropBucket;
+        };
+
+        // Computes the tile range index of each psegment, or dropBucket for none and out of the grid
+        // psegments. The vectorized versions below implement the same checks as PSegmentTileRangeIndex.
+        void ComputeBucketsScalar(const uint64_t* psegments, size_t count, const BucketGrid& grid,
+                                  uint32_t* buckets) {
+            for (size_t i = 0; i < count; i++) {
+                uint32_t tile = PSegmentTileRangeIndex(psegments[i], grid.widthInTiles, grid.heightInTiles);
+                buckets[i] = tile == kInvalidTileRangeIndex ? grid.dropBucket : tile;
+            }
+        }
+
+#if defined(CASSIA_HOST_SORTER_AVX2)
+        __attribute__((target("avx2")))
+        void ComputeBucketsAVX2(const uint64_t* psegments, size_t count, const BucketGrid& grid,
+                                uint32_t* buckets) {
+            const __m256i tileXMask = _mm256_set1_epi32(kTileXMask);
+            const __m256i tileYMask = _mm256_set1_epi32(kTileYMask);
+            const __m256i columnBias = _mm256_set1_epi32(kColumnBias);
+            const __m256i lastColumn = _mm256_set1_epi32(grid.widthInTiles);
+            const __m256i lastRow = _mm256_set1_epi32(grid.heightInTiles - 1);
+            const __m256i rowStride = _mm256_set1_epi32(grid.widthInTiles + 1);
+            const __m256i dropBucket = _mm256_set1_epi32(grid.dropBucket);
+            const __m256i minusOne = _mm256_set1_epi32(-1);
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                __m256 a = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(psegments + i)));
+                __m256 b = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(psegments + i + 4)));
+                // Gather the high halves of the 8 psegments, in order.
+                __m256i hi = _mm256_permute4x64_epi64(
+                    _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))),
+                    _MM_SHUFFLE(3, 1, 2, 0));
+
+                __m256i column = _mm256_sub_epi32(
+                    _mm256_and_si256(_mm256_srli_epi32(hi, kTileXShift), tileXMask), columnBias);
+                __m256i tileY = _mm256_and_si256(_mm256_srli_epi32(hi, kTileYShift), tileYMask);
+
+                // Unsigned a <= b is max(a, b) == b.
+                __m256i inColumns = _mm256_cmpeq_epi32(_mm256_max_epu32(column, lastColumn), lastColumn);
+                __m256i inRows = _mm256_cmpeq_epi32(_mm256_max_epu32(tileY, lastRow), lastRow);
+                __m256i notNone = _mm256_cmpgt_epi32(hi, minusOne);
+                __m256i valid = _mm256_and_si256(inColumns, _mm256_and_si256(inRows, notNone));
+
+                __m256i bucket = _mm256_add_epi32(column, _mm256_mullo_epi32(tileY, rowStride));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(buckets + i),
+                                    _mm256_blendv_epi8(dropBucket, bucket, valid));
+            }
+
+            ComputeBucketsScalar(psegments + i, count - i, grid, buckets + i);
+        }
+#endif
+
+#if defined(CASSIA_HOST_SORTER_NEON)
+        void ComputeBucketsNEON(const uint64_t* psegments, size_t count, const BucketGrid& grid,
+                                uint32_t* buckets) {
+            const uint32x4_t tileXMask = vdupq_n_u32(kTileXMask);
+            const uint32x4_t tileYMask = vdupq_n_u32(kTileYMask);
+            const uint32x4_t columnBias = vdupq_n_u32(kColumnBias);
+            const uint32x4_t lastColumn = vdupq_n_u32(grid.widthInTiles);
+            const uint32x4_t height = vdupq_n_u32(grid.heightInTiles);
+            const uint32x4_t rowStride = vdupq_n_u32(grid.widthInTiles + 1);
+            const uint32x4_t dropBucket = vdupq_n_u32(grid.dropBucket);
+
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                // Deinterleaving loads put the high halves of the 4 psegments in val[1].
+                uint32x4_t hi = vld2q_u32(reinterpret_cast<const uint32_t*>(psegments + i)).val[1];
+
+                uint32x4_t column = vsubq_u32(vandq_u32(vshrq_n_u32(hi, kTileXShift), tileXMask), columnBias);
+                uint32x4_t tileY = vandq_u32(vshrq_n_u32(hi, kTileYShift), tileYMask);
+
+                uint32x4_t notNone = vcgeq_s32(vreinterpretq_s32_u32(hi), vdupq_n_s32(0));
+                uint32x4_t valid = vandq_u32(vandq_u32(vcleq_u32(column, lastColumn), vcltq_u32(tileY, height)),
+                                             notNone);
+
+                uint32x4_t bucket = vmlaq_u32(column, tileY, rowStride);
+                vst1q_u32(buckets + i, vbslq_u32(valid, bucket, dropBucket));
+            }
+
+            ComputeBucketsScalar(psegments + i, count - i, grid, buckets + i);
+        }
+#endif
+
+        using ComputeBucketsFn = void (*)(const uint64_t*, size_t, const BucketGrid&, uint32_t*);
+
+        ComputeBucketsFn SelectComputeBuckets() {
+#if defined(CASSIA_HOST_SORTER_AVX2)
+            if (__builtin_cpu_supports("avx2")) {
+                return ComputeBucketsAVX2;
+            }
+            return ComputeBucketsScalar;
+#elif defined(CASSIA_HOST_SORTER_NEON)
+            return ComputeBucketsNEON;
+#else
+            return ComputeBucketsScalar;
+#endif
+        }
+
+        // Calls f(index, bucket) for each psegment in [begin, end).
+        template <typename F>
+        void ForEachBucket(ComputeBucketsFn computeBuckets, const uint64_t* psegments,
+                           size_t begin, size_t end, const BucketGrid& grid, F&& f) {
+            uint32_t buckets[kBlockSize];
+            for (size_t blockStart = begin; blockStart < end; blockStart += kBlockSize) {
+                size_t blockCount = std::min(kBlockSize, end - blockStart);
+                computeBuckets(psegments + blockStart, blockCount, grid, buckets);
+                for (size_t i = 0; i < blockCount; i++) {
+                    f(blockStart + i, buckets[i]);
+                }
+            }
+        }
+
+        // All the bits above the layer are the same in a bucket so comparing them orders by layer.
+        bool LayerLess(uint64_t a, uint64_t b) {
+            return (a >> PSEGMENT_LAYER_OFFSET) < (b >> PSEGMENT_LAYER_OFFSET);
+        }
+
+        void SortBucketByLayer(uint64_t* begin, uint64_t* end) {
+            if (size_t(end - begin) > kInsertionSortThreshold) {
+                std::sort(begin, end, LayerLess);
+                return;
+            }
+
+            for (uint64_t* i = begin + 1; i < end; i++) {
+                uint64_t psegment = *i;
+                uint64_t* j = i;
+                for (; j > begin && LayerLess(psegment, *(j - 1)); j--) {
+                    *j = *(j - 1);
+                }
+                *j = psegment;
+            }
+        }
+
+    } // anonymous namespace
+
+    HostSegmentSorter::HostSegmentSorter(ThreadPool* pool) : mPool(pool) {
+    }
+
+    size_t HostSegmentSorter::Sort(const uint64_t* psegments, size_t count,
+                                   uint32_t widthInTiles, uint32_t heightInTiles, uint64_t* sorted) {
+        static const ComputeBucketsFn computeBuckets = SelectComputeBuckets();
+
+        uint32_t tileRangeCount = (widthInTiles + 1) * heightInTiles;
+        mTileRanges.assign(tileRangeCount, TileRange{0, 0});
+        if (count == 0 || tileRangeCount == 0) {
+            return 0;
+        }
+
+        // Dropped psegments go in an extra bucket after all the tiles.
+        BucketGrid grid = {widthInTiles, heightInTiles, tileRangeCount};
+        size_t bucketCount = tileRangeCount + 1;
+
+        size_t chunkCount = std::min(std::max(count / kMinSegmentsPerChunk, size_t(1)),
+                                     mPool->GetThreadCount() * kChunksPerThread);
+        size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+        chunkCount = (count + chunkSize - 1) / chunkSize;
+        mHistograms.resize(chunkCount * bucketCount);
+
+        // Count the psegments of each chunk in each bucket.
+        mPool->ParallelFor(chunkCount, [&](size_t chunk) {
+            uint32_t* histogram = &mHistograms[chunk * bucketCount];
+            std::fill(histogram, histogram + bucketCount, 0u);
+
+            size_t begin = chunk * chunkSize;
+            size_t end = std::min(count, begin + chunkSize);
+            ForEachBucket(computeBuckets, psegments, begin, end, grid, [&](size_t, uint32_t bucket) {
+                histogram[bucket]++;
+            });
+        });
+
+        // Compute where each bucket starts, then turn the histograms into the offset at which each
+        // chunk scatters its psegments so that they keep their input order within a bucket.
+        mBucketStarts.assign(bucketCount + 1, 0u);
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            const uint32_t* histogram = &mHistograms[chunk * bucketCount];
+            for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+                mBucketStarts[bucket + 1] += histogram[bucket];
+            }
+        }
+        for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+            mBucketStarts[bucket + 1] += mBucketStarts[bucket];
+        }
+
+        mBucketOffsets.assign(mBucketStarts.begin(), mBucketStarts.end() - 1);
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            uint32_t* histogram = &mHistograms[chunk * bucketCount];
+            for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+                uint32_t chunkBucketCount = histogram[bucket];
+                histogram[bucket] = mBucketOffsets[bucket];
+                mBucketOffsets[bucket] += chunkBucketCount;
+            }
+        }
+
+        size_t sortedCount = mBucketStarts[tileRangeCount];
+        mScratch.resize(sortedCount);
+
+        // Scatter the psegments in their bucket.
+        mPool->ParallelFor(chunkCount, [&](size_t chunk) {
+            uint32_t* offsets = &mHistograms[chunk * bucketCount];
+
+            size_t begin = chunk * chunkSize;
+            size_t end = std::min(count, begin + chunkSize);
+            ForEachBucket(computeBuckets, psegments, begin, end, grid, [&](size_t index, uint32_t bucket) {
+                if (bucket != grid.dropBucket) {
+                    mScratch[offsets[bucket]++] = psegments[index];
+                }
+            });
+        });
+
+        // Sort each bucket by layer and write it out, one row of tiles at a time.
+        mPool->ParallelFor(heightInTiles, [&](size_t row) {
+            size_t rowBegin = row * (widthInTiles + 1);
+            size_t rowEnd = rowBegin + widthInTiles + 1;
+            for (size_t bucket = rowBegin; bucket < rowEnd; bucket++) {
+                uint32_t start = mBucketStarts[bucket];
+                uint32_t end = mBucketStarts[bucket + 1];
+
+                SortBucketByLayer(mScratch.data() + start, mScratch.data() + end);
+                std::copy(mScratch.data() + start, mScratch.data() + end, sorted + start);
+                mTileRanges[bucket] = {start, end};
+            }
+        });
+
+        return sortedCount;
+    }
+
+    const std::vector<TileRange>& HostSegmentSorter::GetTileRanges() const {
+        return mTileRanges;
+    }
+
+} // namespace cassia
@@ -0,0 +1,44 @@
+#ifndef CASSIA_HOSTSEGMENTSORTER_H
+#define CASSIA_HOSTSEGMENTSORTER_H
+
+#include "CommonWGSL.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cassia {
+
+    class ThreadPool;
+
+    // Sorts psegments on the CPU in the order the rasterizers need: by tile_y, tile_x then layer.
+    // A first parallel pass buckets the psegments by tile using per-chunk histograms, then the
+    // buckets are sorted by layer independently. The bucket boundaries are the tile ranges that
+    // the GPU would otherwise reconstruct from the sorted psegments.
+    class HostSegmentSorter {
+      public:
+        HostSegmentSorter(ThreadPool* pool);
+
+        // Sorts the psegments for a grid of widthInTiles x heightInTiles tiles into sorted, which
+        // must have room for count psegments. Psegments that are none or outside of the grid are
+        // dropped. Returns the number of psegments written in sorted.
+        size_t Sort(const uint64_t* psegments, size_t count,
+                    uint32_t widthInTiles, uint32_t heightInTiles, uint64_t* sorted);
+
+        // The tile ranges in sorted of the last call to Sort.
+        const std::vector<TileRange>& GetTileRanges() const;
+
+      private:
+        ThreadPool* mPool;
+
+        // Per-chunk histograms of the buckets, turned into scatter offsets in place.
+        std::vector<uint32_t> mHistograms;
+        std::vector<uint32_t> mBucketStarts;
+        std::vector<uint32_t> mBucketOffsets;
+        std::vector<uint64_t> mScratch;
+        std::vector<TileRange> mTileRanges;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_HOSTSEGMENTSORTER_H
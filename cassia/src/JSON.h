@@ -0,0 +1,25 @@
+#ifndef CASSIA_JSON_H
+#define CASSIA_JSON_H
+
+#include <string>
+
+namespace cassia {
+
+    // Escapes a string to be written between quotes in JSON. The control characters are dropped
+    // since the names that are written don't need them.
+    inline std::string EscapeJSON(const std::string& string) {
+        std::string escaped;
+        for (char c : string) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            if (static_cast<unsigned char>(c) >= 0x20) {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+} // namespace cassia
+
+#endif // CASSIA_JSON_H
@@ -0,0 +1,289 @@
+#include "KernelAutotuner.h"
+
+#include "CommonWGSL.h"
+#include "EncodingContext.h"
+#include "ResourcePool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace cassia {
+
+    namespace {
+        // Bump when the kernels change enough for the old results to be meaningless.
+        constexpr uint32_t kCacheVersion = 3;
+
+        constexpr uint32_t kCalibrationSize = 1024;
+        constexpr uint32_t kCalibrationLayers = 48;
+        constexpr uint32_t kWarmupFrames = 2;
+        constexpr uint32_t kTimedFrames = 5;
+        // How long to wait for the timings of a frame before giving up on a config, in case the
+        // device hangs without reporting a loss.
+        constexpr std::chrono::seconds kFrameTimeout(5);
+
+        std::string GetCachePath() {
+            if (const char* path = std::getenv("CASSIA_AUTOTUNE_CACHE")) {
+                return path;
+            }
+#if defined(_WIN32)
+            if (const char* directory = std::getenv("LOCALAPPDATA")) {
+                return std::string(directory) + "\\cassia_autotune.txt";
+            }
+#else
+            if (const char* directory = std::getenv("HOME")) {
+                return std::string(directory) + "/.cassia_autotune";
+            }
+#endif
+            return "cassia_autotune.txt";
+        }
+
+        // A line of the cache is "v<version> <tileWidthShift> <tileHeightShift> <workgroupSize>
+        // <tileRangeWorkgroupSize> <minWorkgroupCarries> <adapter name>", the name last because it
+        // contains spaces. The kernels of each tile size are tuned separately since the library
+        // can be built with any of them.
+        bool ParseCacheLine(const std::string& line, std::string* adapterName, TileWorkgroupKernelConfig* config) {
+            std::istringstream stream(line);
+            char v;
+            uint32_t version;
+            if (!(stream >> v >> version) || v != 'v' || version != kCacheVersion) {
+                return false;
+            }
+            uint32_t tileWidthShift;
+            uint32_t tileHeightShift;
+            if (!(stream >> tileWidthShift >> tileHeightShift) || tileWidthShift != TILE_WIDTH_SHIFT ||
+                tileHeightShift != TILE_HEIGHT_SHIFT) {
+                return false;
+            }
+            if (!(stream >> config->workgroupSize >> config->tileRangeWorkgroupSize >> config->minWorkgroupCarries)) {
+                return false;
+            }
+            stream >> std::ws;
+            std::getline(stream, *adapterName);
+
+            // Only the values the kernels are tuned for are accepted, a zero tile range workgroup
+            // size would divide by zero when dispatching.
+            bool validWorkgroupSize = config->workgroupSize == 32 || config->workgroupSize == 64;
+            bool validTileRangeWorkgroupSize =
+                    config->tileRangeWorkgroupSize == 128 || config->tileRangeWorkgroupSize == 256;
+            bool validMinWorkgroupCarries = config->minWorkgroupCarries == 10 ||
+                                            config->minWorkgroupCarries == 32 ||
+                                            config->minWorkgroupCarries == 64;
+            return validWorkgroupSize && validTileRangeWorkgroupSize && validMinWorkgroupCarries;
+        }
+
+        uint64_t MakePSegment(uint32_t tileX, uint32_t tileY, uint32_t layer, uint32_t localX, uint32_t localY,
+                              int32_t cover, int32_t area) {
+            return (uint64_t(cover) & 0x3F) | ((uint64_t(area) & 0x3FF) << 6) |
+                   (uint64_t(localX) << 16) | (uint64_t(localY) << (16 + TILE_WIDTH_SHIFT)) |
+                   (uint64_t(layer) << PSEGMENT_LAYER_OFFSET) |
+                   (uint64_t(tileX + TILE_X_OFFSET) << PSEGMENT_TILE_X_OFFSET) |
+                   (uint64_t(tileY) << PSEGMENT_TILE_Y_OFFSET);
+        }
+
+        // Overlapping horizontal bands of each layer in every row of tiles, so that the rows have
+        // both edge tiles and many carries like typical vector content.
+        std::vector<uint64_t> MakeCalibrationSegments() {
+            std::mt19937 random(42);
+            std::uniform_int_distribution<uint32_t> pixelX(0, kCalibrationSize - 1);
+
+            std::vector<uint64_t> segments;
+            for (uint32_t tileY = 0; tileY < HeightInTiles(kCalibrationSize); tileY++) {
+                for (uint32_t layer = 0; layer < kCalibrationLayers; layer++) {
+                    uint32_t x0 = pixelX(random);
+                    uint32_t x1 = pixelX(random);
+                    if (x0 > x1) {
+                        std::swap(x0, x1);
+                    }
+
+                    for (uint32_t localY = 0; localY < (1u << TILE_HEIGHT_SHIFT); localY++) {
+                        segments.push_back(MakePSegment(x0 >> TILE_WIDTH_SHIFT, tileY, layer,
+                                x0 & ((1u << TILE_WIDTH_SHIFT) - 1), localY, 16, 128));
+                        segments.push_back(MakePSegment(x1 >> TILE_WIDTH_SHIFT, tileY, layer,
+                                x1 & ((1u << TILE_WIDTH_SHIFT) - 1), localY, -16, -128));
+                    }
+                }
+            }
+
+            // Sorting the whole psegments orders them by tile_y, tile_x then layer.
+            std::sort(segments.begin(), segments.end());
+            return segments;
+        }
+
+        std::vector<CassiaStyling> MakeCalibrationStylings() {
+            std::mt19937 random(7);
+            std::uniform_real_distribution<float> channel(0.0f, 1.0f);
+
+            std::vector<CassiaStyling> stylings(kCalibrationLayers);
+            for (CassiaStyling& styling : stylings) {
+                styling = {};
+                styling.fill[0] = channel(random);
+                styling.fill[1] = channel(random);
+                styling.fill[2] = channel(random);
+                styling.fill[3] = 0.5f + 0.5f * channel(random);
+            }
+            return stylings;
+        }
+
+        wgpu::Buffer CreateStorageBuffer(const wgpu::Device& device, const void* data, uint64_t size) {
+            wgpu::BufferDescriptor desc;
+            desc.size = size;
+            desc.usage = wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst;
+            wgpu::Buffer buffer = device.CreateBuffer(&desc);
+            device.GetQueue().WriteBuffer(buffer, 0, data, size);
+            return buffer;
+        }
+    }
+
+    KernelAutotuner::KernelAutotuner(wgpu::Device device, std::string adapterName)
+        : mDevice(std::move(device)), mAdapterName(std::move(adapterName)) {
+    }
+
+    bool KernelAutotuner::LoadCachedConfig(TileWorkgroupKernelConfig* config) const {
+        std::ifstream file(GetCachePath());
+        std::string line;
+        while (std::getline(file, line)) {
+            std::string adapterName;
+            TileWorkgroupKernelConfig candidate;
+            if (ParseCacheLine(line, &adapterName, &candidate) && adapterName == mAdapterName) {
+                *config = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void KernelAutotuner::StoreConfig(const TileWorkgroupKernelConfig& kernelConfig) const {
+        std::string path = GetCachePath();
+
+        // Keep the results of the other adapters and tile sizes.
+        std::vector<std::string> lines;
+        {
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line)) {
+                std::string adapterName;
+                TileWorkgroupKernelConfig config;
+                if (!ParseCacheLine(line, &adapterName, &config) || adapterName != mAdapterName) {
+                    lines.push_back(line);
+                }
+            }
+        }
+
+        std::ostringstream line;
+        line << "v" << kCacheVersion << " " << TILE_WIDTH_SHIFT << " " << TILE_HEIGHT_SHIFT << " "
+             << kernelConfig.workgroupSize << " "
+             << kernelConfig.tileRangeWorkgroupSize << " " << kernelConfig.minWorkgroupCarries << " "
+             << mAdapterName;
+        lines.push_back(line.str());
+
+        std::ofstream file(path, std::ios::trunc);
+        for (const std::string& l : lines) {
+            file << l << "\n";
+        }
+        if (!file) {
+            std::cerr << "KernelAutotuner: couldn't write the cache at " << path << std::endl;
+        }
+    }
+
+    double KernelAutotuner::TimeConfig(const TileWorkgroupKernelConfig& kernelConfig,
+                                       const Rasterizer::Inputs& inputs, const Rasterizer::Config& config) {
+        // Declared before the context, whose destruction reports the frames still in flight.
+        bool received = false;
+        bool failed = false;
+        double frameTimeMs = 0.0;
+
+        ResourcePool pool(mDevice);
+        EncodingContext context(mDevice, true);
+        TileWorkgroupRasterizer rasterizer(mDevice, &pool, kernelConfig);
+        // All the variants are created so that the first frames don't fall back to smaller ones.
+        if (!rasterizer.Precompile()) {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        context.SetTimingsCallback([&](const FrameTimings& timings) {
+            failed = timings.failed;
+            frameTimeMs = 0.0;
+            for (const PassTiming& timing : timings.passes) {
+                if (timing.hasGPU) {
+                    frameTimeMs += timing.gpuTimeMs;
+                }
+            }
+            received = true;
+        });
+
+        std::vector<double> frameTimesMs;
+        wgpu::Queue queue = mDevice.GetQueue();
+        for (uint32_t frame = 0; frame < kWarmupFrames + kTimedFrames; frame++) {
+            rasterizer.Rasterize(&context, inputs, config);
+            context.SubmitOn(queue);
+            rasterizer.OnSubmitted();
+
+            received = false;
+            auto deadline = std::chrono::steady_clock::now() + kFrameTimeout;
+            while (!received && std::chrono::steady_clock::now() < deadline) {
+                mDevice.Tick();
+            }
+            if (!received || failed) {
+                std::cerr << "KernelAutotuner: couldn't time workgroupSize=" << kernelConfig.workgroupSize
+                          << " tileRangeWorkgroupSize=" << kernelConfig.tileRangeWorkgroupSize << std::endl;
+                return std::numeric_limits<double>::infinity();
+            }
+            if (frame >= kWarmupFrames) {
+                frameTimesMs.push_back(frameTimeMs);
+            }
+        }
+
+        std::sort(frameTimesMs.begin(), frameTimesMs.end());
+        return frameTimesMs[frameTimesMs.size() / 2];
+    }
+
+    TileWorkgroupKernelConfig KernelAutotuner::Tune() {
+        std::vector<uint64_t> segments = MakeCalibrationSegments();
+        std::vector<CassiaStyling> stylings = MakeCalibrationStylings();
+
+        Rasterizer::Inputs inputs;
+        inputs.sortedPsegments = CreateStorageBuffer(mDevice, segments.data(), segments.size() * sizeof(uint64_t));
+        inputs.stylings = CreateStorageBuffer(mDevice, stylings.data(), stylings.size() * sizeof(CassiaStyling));
+
+        Rasterizer::Config config;
+        config.width = kCalibrationSize;
+        config.height = kCalibrationSize;
+        config.segmentCount = static_cast<uint32_t>(segments.size());
+        config.stylingCount = static_cast<uint32_t>(stylings.size());
+
+        // Smaller tile range workgroups would run into the dispatch limits of large scenes. The
+        // calibration scene has more carries per row than any of the minWorkgroupCarries, so it
+        // always runs the largest raster variant and can't tell them apart: the default is kept.
+        TileWorkgroupKernelConfig best;
+        double bestTimeMs = TimeConfig(best, inputs, config);
+        for (uint32_t workgroupSize : {32u, 64u}) {
+            for (uint32_t tileRangeWorkgroupSize : {128u, 256u}) {
+                TileWorkgroupKernelConfig candidate;
+                candidate.workgroupSize = workgroupSize;
+                candidate.tileRangeWorkgroupSize = tileRangeWorkgroupSize;
+
+                double timeMs = TimeConfig(candidate, inputs, config);
+                if (timeMs < bestTimeMs) {
+                    best = candidate;
+                    bestTimeMs = timeMs;
+                }
+            }
+        }
+
+        // Nothing could be timed, don't cache the defaults so that the next run tries again.
+        if (std::isinf(bestTimeMs)) {
+            return {};
+        }
+        StoreConfig(best);
+        return best;
+    }
+
+} // namespace cassia
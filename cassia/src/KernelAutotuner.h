@@ -0,0 +1,41 @@
+#ifndef CASSIA_KERNELAUTOTUNER_H
+#define CASSIA_KERNELAUTOTUNER_H
+
+#include "Rasterizer.h"
+#include "TileWorkgroupRasterizer.h"
+
+#include "webgpu/webgpu_cpp.h"
+
+#include <string>
+
+namespace cassia {
+
+    // Finds the fastest TileWorkgroupKernelConfig of an adapter by timing the candidates on a
+    // calibration scene. The results are kept per adapter name and tile size in a file so that
+    // they are only computed once, at $CASSIA_AUTOTUNE_CACHE or in the home directory by default.
+    class KernelAutotuner {
+      public:
+        KernelAutotuner(wgpu::Device device, std::string adapterName);
+
+        // Loads the config tuned earlier for the adapter, returns false if there is none.
+        bool LoadCachedConfig(TileWorkgroupKernelConfig* config) const;
+
+        // Times the candidate configs, stores the fastest in the cache and returns it. The device
+        // must have timestamp queries. Returns the default config without caching it when none
+        // of them could be timed.
+        TileWorkgroupKernelConfig Tune();
+
+      private:
+        // The median GPU time of the rasterizer's passes over a few frames, in milliseconds, or
+        // infinity when the timings of a frame fail or don't arrive in time.
+        double TimeConfig(const TileWorkgroupKernelConfig& kernelConfig, const Rasterizer::Inputs& inputs,
+                          const Rasterizer::Config& config);
+        void StoreConfig(const TileWorkgroupKernelConfig& kernelConfig) const;
+
+        wgpu::Device mDevice;
+        std::string mAdapterName;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_KERNELAUTOTUNER_H
@@ -9,8 +9,8 @@
 
 namespace cassia {
 
-    NaiveComputeRasterizer::NaiveComputeRasterizer(wgpu::Device device)
-        : mDevice(std::move(device)) {
+    NaiveComputeRasterizer::NaiveComputeRasterizer(wgpu::Device device, ResourcePool* pool)
+        : mDevice(std::move(device)), mPool(pool) {
 
         // The config struct can be used directly to lay out a uniform buffer.
         static_assert(sizeof(Config) == 16, "");
@@ -84,41 +84,50 @@ namespace cassia {
         pDesc.label = "naive rasterizer";
         pDesc.compute.module = module;
         pDesc.compute.entryPoint = "main";
-        mPipeline = mDevice.CreateComputePipeline(&pDesc);
+        mPipeline.Create(mDevice, pDesc);
     }
 
-    wgpu::Texture NaiveComputeRasterizer::Rasterize(EncodingContext* context,
-            wgpu::Buffer sortedPsegments, wgpu::Buffer stylingsBuffer, const Config& config) {
-        wgpu::Buffer uniforms = utils::CreateBufferFromData(
-                mDevice, &config, sizeof(Config), wgpu::BufferUsage::Uniform);
+    bool NaiveComputeRasterizer::IsReady() const {
+        return mPipeline.IsReady();
+    }
+
+    bool NaiveComputeRasterizer::Precompile() {
+        return mPipeline.Wait(mDevice);
+    }
 
-        wgpu::TextureDescriptor texDesc;
-        texDesc.label = "rasterized paths";
-        texDesc.size = {config.width, config.height};
-        texDesc.usage = wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::TextureBinding;
-        texDesc.format = wgpu::TextureFormat::RGBA16Float;
-        wgpu::Texture outTexture = mDevice.CreateTexture(&texDesc);
+    wgpu::Texture NaiveComputeRasterizer::Rasterize(EncodingContext* context, const Inputs& inputs,
+            const Config& config) {
+        wgpu::Buffer uniforms = mPool->GetBuffer("NaiveComputeRasterizer::Uniforms", sizeof(Config),
+                wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst);
+        mDevice.GetQueue().WriteBuffer(uniforms, 0, &config, sizeof(Config));
+
+        wgpu::Texture outTexture = mPool->GetTexture("NaiveComputeRasterizer::Output",
+                config.width, config.height, wgpu::TextureFormat::RGBA16Float,
+                wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::TextureBinding);
 
         {
-            wgpu::BindGroup bg = utils::MakeBindGroup(mDevice, mPipeline.GetBindGroupLayout(0), {
-                {0, uniforms},
-                {1, sortedPsegments},
-                {2, stylingsBuffer},
-                {3, outTexture.CreateView()}
-            });
+            if (mBindGroup.IsStale({uniforms.Get(), inputs.sortedPsegments.Get(), inputs.stylings.Get(), outTexture.Get()})) {
+                mBindGroup.Set(utils::MakeBindGroup(mDevice, mPipeline.Get().GetBindGroupLayout(0), {
+                    {0, uniforms},
+                    {1, inputs.sortedPsegments},
+                    {2, inputs.stylings},
+                    {3, outTexture.CreateView()}
+                }));
+            }
+            const wgpu::BindGroup& bg = mBindGroup.Get();
 
             {
                 ScopedComputePass pass(context, "NaiveComputeRasterizer::FakePassToFactorOutLazyClearCost");
 
                 pass->SetBindGroup(0, bg);
-                pass->SetPipeline(mPipeline);
+                pass->SetPipeline(mPipeline.Get());
                 pass->Dispatch(0);
             }
 
             ScopedComputePass pass(context, "NaiveComputeRasterizer");
 
             pass->SetBindGroup(0, bg);
-            pass->SetPipeline(mPipeline);
+            pass->SetPipeline(mPipeline.Get());
             pass->Dispatch((config.width + 7) / 8, (config.height + 7) / 8);
         }
 
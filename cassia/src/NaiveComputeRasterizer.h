@@ -1,22 +1,27 @@
 #ifndef CASSIA_NAIVECOMPUTERASTERIZER_H
 #define CASSIA_NAIVECOMPUTERASTERIZER_H
 
+#include "AsyncComputePipeline.h"
 #include "Rasterizer.h"
+#include "ResourcePool.h"
 
 namespace cassia {
 
     class NaiveComputeRasterizer final : public Rasterizer {
       public:
-        NaiveComputeRasterizer(wgpu::Device device);
+        NaiveComputeRasterizer(wgpu::Device device, ResourcePool* pool);
         ~NaiveComputeRasterizer() override = default;
 
-        wgpu::Texture Rasterize(EncodingContext* context,
-            wgpu::Buffer sortedPsegments, wgpu::Buffer stylingsBuffer,
+        wgpu::Texture Rasterize(EncodingContext* context, const Inputs& inputs,
             const Config& config) override;
+        bool IsReady() const override;
+        bool Precompile() override;
 
       private:
         wgpu::Device mDevice;
-        wgpu::ComputePipeline mPipeline;
+        ResourcePool* mPool;
+        AsyncComputePipeline mPipeline;
+        CachedBindGroup mBindGroup;
     };
 
 } // namespace cassia
@@ -0,0 +1,149 @@
+#include "PipelineCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(_WIN32)
+#    include <direct.h>
+#    include <process.h>
+#else
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace cassia {
+
+    namespace {
+        // FNV-1a, only used to name the files since their content is checked on load.
+        uint64_t Hash(const void* data, size_t size) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            uint64_t hash = 0xCBF29CE484222325ull;
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+            }
+            return hash;
+        }
+
+        std::string ToHex(uint64_t value) {
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(value));
+            return hex;
+        }
+
+        void MakeDirectory(const std::string& path) {
+#if defined(_WIN32)
+            _mkdir(path.c_str());
+#else
+            mkdir(path.c_str(), 0755);
+#endif
+        }
+
+        uint64_t GetProcessId() {
+#if defined(_WIN32)
+            return uint64_t(_getpid());
+#else
+            return uint64_t(getpid());
+#endif
+        }
+    }
+
+    // The blobs of an adapter and driver, in a subdirectory named after the hash of their
+    // fingerprint. Each file starts with the key of the blob so that hash collisions are misses.
+    class PipelineCache::FingerprintCache final : public dawn_platform::CachingInterface {
+      public:
+        FingerprintCache(std::string fingerprint, std::string directory)
+            : mFingerprint(std::move(fingerprint)), mDirectory(std::move(directory)) {
+            MakeDirectory(mDirectory);
+        }
+
+        const std::string& GetFingerprint() const {
+            return mFingerprint;
+        }
+
+        size_t LoadData(const WGPUDevice, const void* key, size_t keySize, void* valueOut,
+                        size_t valueSize) override {
+            std::ifstream file(GetPath(key, keySize), std::ios::binary);
+            if (!file) {
+                return 0;
+            }
+
+            uint64_t storedKeySize = 0;
+            file.read(reinterpret_cast<char*>(&storedKeySize), sizeof(storedKeySize));
+            if (!file || storedKeySize != keySize) {
+                return 0;
+            }
+            std::vector<char> storedKey(keySize);
+            file.read(storedKey.data(), keySize);
+            if (!file || memcmp(storedKey.data(), key, keySize) != 0) {
+                return 0;
+            }
+
+            std::streamoff valueStart = file.tellg();
+            file.seekg(0, std::ios::end);
+            size_t storedValueSize = static_cast<size_t>(file.tellg() - valueStart);
+            if (valueOut == nullptr) {
+                return storedValueSize;
+            }
+            if (valueSize < storedValueSize) {
+                return 0;
+            }
+
+            file.seekg(valueStart);
+            file.read(static_cast<char*>(valueOut), storedValueSize);
+            return file ? storedValueSize : 0;
+        }
+
+        void StoreData(const WGPUDevice, const void* key, size_t keySize, const void* value,
+                       size_t valueSize) override {
+            // Other processes can use the cache concurrently so the file is written under another
+            // name and then renamed, which replaces it at once on POSIX.
+            std::string path = GetPath(key, keySize);
+            std::string temporaryPath = path + ".tmp" + ToHex(GetProcessId());
+            {
+                std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+                uint64_t storedKeySize = keySize;
+                file.write(reinterpret_cast<const char*>(&storedKeySize), sizeof(storedKeySize));
+                file.write(static_cast<const char*>(key), keySize);
+                file.write(static_cast<const char*>(value), valueSize);
+                if (!file) {
+                    std::cerr << "PipelineCache: couldn't write " << temporaryPath << std::endl;
+                    return;
+                }
+            }
+            if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+                std::remove(temporaryPath.c_str());
+            }
+        }
+
+      private:
+        std::string GetPath(const void* key, size_t keySize) const {
+            return mDirectory + "/" + ToHex(Hash(key, keySize)) + ".blob";
+        }
+
+        std::string mFingerprint;
+        std::string mDirectory;
+    };
+
+    PipelineCache::PipelineCache(std::string directory) : mDirectory(std::move(directory)) {
+        MakeDirectory(mDirectory);
+    }
+
+    PipelineCache::~PipelineCache() = default;
+
+    dawn_platform::CachingInterface* PipelineCache::GetCachingInterface(const void* fingerprint,
+                                                                        size_t fingerprintSize) {
+        std::string fingerprintBytes(static_cast<const char*>(fingerprint), fingerprintSize);
+        for (const std::unique_ptr<FingerprintCache>& cache : mCaches) {
+            if (cache->GetFingerprint() == fingerprintBytes) {
+                return cache.get();
+            }
+        }
+
+        std::string directory = mDirectory + "/" + ToHex(Hash(fingerprint, fingerprintSize));
+        mCaches.push_back(std::make_unique<FingerprintCache>(std::move(fingerprintBytes), std::move(directory)));
+        return mCaches.back().get();
+    }
+
+} // namespace cassia
@@ -0,0 +1,31 @@
+#ifndef CASSIA_PIPELINECACHE_H
+#define CASSIA_PIPELINECACHE_H
+
+#include <dawn_platform/DawnPlatform.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cassia {
+
+    // Persists the blobs that Dawn caches, like the compiled shaders, as files in a directory so
+    // that the next processes using the same adapter and driver don't compile them again.
+    class PipelineCache final : public dawn_platform::Platform {
+      public:
+        explicit PipelineCache(std::string directory);
+        ~PipelineCache() override;
+
+        dawn_platform::CachingInterface* GetCachingInterface(const void* fingerprint,
+                                                             size_t fingerprintSize) override;
+
+      private:
+        class FingerprintCache;
+
+        std::string mDirectory;
+        std::vector<std::unique_ptr<FingerprintCache>> mCaches;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_PIPELINECACHE_H
@@ -0,0 +1,317 @@
+#include "RadixSorter.h"
+
+#include "EncodingContext.h"
+
+#include "utils/WGPUHelpers.h"
+
+#include <string>
+
+namespace cassia {
+
+    namespace {
+        constexpr uint32_t kRadixBits = 8;
+        constexpr uint32_t kBlockSize = 4096;
+        // Each pass uses its own slice of the uniform buffer, aligned for the offset of the binding.
+        constexpr uint64_t kUniformSliceSize = 256;
+        constexpr uint32_t kMaxPasses = 64 / kRadixBits;
+
+        struct ConfigUniforms {
+            uint32_t count;
+            uint32_t blockCount;
+            uint32_t shift;
+            uint32_t padding;
+        };
+        static_assert(sizeof(ConfigUniforms) == 16, "");
+    }
+
+    RadixSorter::RadixSorter(wgpu::Device device, ResourcePool* pool, std::string name)
+        : mDevice(std::move(device)), mPool(pool), mName(std::move(name)), mPassBindGroups(kMaxPasses) {
+        std::string code = R"(
+            struct Key {
+                lo: u32;
+                hi: u32;
+            };
+
+            [[block]] struct Config {
+                count: u32;
+                blockCount: u32;
+                shift: u32;
+            };
+            [[group(0), binding(0)]] var<uniform> config : Config;
+
+            [[block]] struct KeyCount {
+                value: u32;
+            };
+            [[group(0), binding(4)]] var<storage> keyCount : KeyCount;
+
+            fn key_count() -> u32 {
+                return min(config.count, keyCount.value);
+            }
+
+            [[block]] struct Keys {
+                data: array<Key>;
+            };
+            [[group(0), binding(1)]] var<storage> src : Keys;
+            [[group(0), binding(2)]] var<storage, read_write> dst : Keys;
+
+            // Count of each digit in each block, laid out digit-major so that an exclusive scan of
+            // the table gives the output offset of each digit in each block.
+            [[block]] struct Table {
+                data: array<u32>;
+            };
+            [[group(0), binding(3)]] var<storage, read_write> table : Table;
+
+            let WORKGROUP_SIZE = 256u;
+            let ITEMS_PER_THREAD = 16u;
+            let BLOCK_SIZE = 4096u; // WORKGROUP_SIZE * ITEMS_PER_THREAD
+            let RADIX = 256u;
+            let RADIX_MASK = 255u;
+
+            fn key_digit(key: Key) -> u32 {
+                var shift = config.shift;
+                if (shift >= 32u) {
+                    return (key.hi >> (shift - 32u)) & RADIX_MASK;
+                }
+
+                var digit = key.lo >> shift;
+                if (shift > 24u) {
+                    digit = digit | (key.hi << (32u - shift));
+                }
+                return digit & RADIX_MASK;
+            }
+
+            ///////////////////////////////////////////////////////////////////
+            //  Per-block digit histograms
+            ///////////////////////////////////////////////////////////////////
+
+            var<workgroup> histogram : array<atomic<u32>, RADIX>;
+
+            [[stage(compute), workgroup_size(WORKGROUP_SIZE)]]
+            fn computeHistograms([[builtin(workgroup_id)]] WorkgroupId : vec3<u32>,
+                                 [[builtin(local_invocation_id)]] LocalId : vec3<u32>) {
+                atomicStore(&histogram[LocalId.x], 0u);
+                workgroupBarrier();
+
+                var count = key_count();
+                var blockStart = WorkgroupId.x * BLOCK_SIZE;
+                for (var i = 0u; i < ITEMS_PER_THREAD; i = i + 1u) {
+                    var index = blockStart + i * WORKGROUP_SIZE + LocalId.x;
+                    if (index < count) {
+                        ignore(atomicAdd(&histogram[key_digit(src.data[index])], 1u));
+                    }
+                }
+
+                workgroupBarrier();
+                table.data[LocalId.x * config.blockCount + WorkgroupId.x] = atomicLoad(&histogram[LocalId.x]);
+            }
+
+            ///////////////////////////////////////////////////////////////////
+            //  Exclusive scan of the histogram table
+            ///////////////////////////////////////////////////////////////////
+
+            // The table is small compared to the keys (RADIX entries per BLOCK_SIZE keys) so a
+            // single workgroup scans it, each invocation handling a contiguous chunk.
+            var<workgroup> partials : array<u32, WORKGROUP_SIZE>;
+
+            [[stage(compute), workgroup_size(WORKGROUP_SIZE)]]
+            fn scanHistograms([[builtin(local_invocation_id)]] LocalId : vec3<u32>) {
+                var tableSize = RADIX * config.blockCount;
+                var chunkSize = (tableSize + WORKGROUP_SIZE - 1u) / WORKGROUP_SIZE;
+                var chunkStart = min(LocalId.x * chunkSize, tableSize);
+                var chunkEnd = min(chunkStart + chunkSize, tableSize);
+
+                var sum = 0u;
+                for (var i = chunkStart; i < chunkEnd; i = i + 1u) {
+                    sum = sum + table.data[i];
+                }
+                partials[LocalId.x] = sum;
+                workgroupBarrier();
+
+                for (var offset = 1u; offset < WORKGROUP_SIZE; offset = offset * 2u) {
+                    var value = partials[LocalId.x];
+                    if (LocalId.x >= offset) {
+                        value = value + partials[LocalId.x - offset];
+                    }
+                    workgroupBarrier();
+                    partials[LocalId.x] = value;
+                    workgroupBarrier();
+                }
+
+                var running = partials[LocalId.x] - sum;
+                for (var i = chunkStart; i < chunkEnd; i = i + 1u) {
+                    var count = table.data[i];
+                    table.data[i] = running;
+                    running = running + count;
+                }
+            }
+
+            ///////////////////////////////////////////////////////////////////
+            //  Stable scatter
+            ///////////////////////////////////////////////////////////////////
+
+            // The keys of a block are processed in rounds of WORKGROUP_SIZE. In each round every
+            // invocation sets its bit in the mask of its digit, and its rank among the keys of
+            // the same digit is the number of bits set before it.
+            var<workgroup> digitOffsets : array<u32, RADIX>;
+            var<workgroup> digitMasks : array<array<atomic<u32>, 8>, RADIX>; // WORKGROUP_SIZE / 32
+
+            [[stage(compute), workgroup_size(WORKGROUP_SIZE)]]
+            fn scatter([[builtin(workgroup_id)]] WorkgroupId : vec3<u32>,
+                       [[builtin(local_invocation_id)]] LocalId : vec3<u32>) {
+                var threadIdx = LocalId.x;
+                digitOffsets[threadIdx] = table.data[threadIdx * config.blockCount + WorkgroupId.x];
+                for (var w = 0u; w < 8u; w = w + 1u) {
+                    atomicStore(&digitMasks[threadIdx][w], 0u);
+                }
+                workgroupBarrier();
+
+                var word = threadIdx / 32u;
+                var bit = 1u << (threadIdx % 32u);
+                var count = key_count();
+                var blockStart = WorkgroupId.x * BLOCK_SIZE;
+                for (var i = 0u; i < ITEMS_PER_THREAD; i = i + 1u) {
+                    var index = blockStart + i * WORKGROUP_SIZE + threadIdx;
+                    var valid = index < count;
+
+                    var key : Key;
+                    var digit = 0u;
+                    if (valid) {
+                        key = src.data[index];
+                        digit = key_digit(key);
+                        ignore(atomicOr(&digitMasks[digit][word], bit));
+                    }
+                    workgroupBarrier();
+
+                    if (valid) {
+                        var rank = countOneBits(atomicLoad(&digitMasks[digit][word]) & (bit - 1u));
+                        for (var w = 0u; w < word; w = w + 1u) {
+                            rank = rank + countOneBits(atomicLoad(&digitMasks[digit][w]));
+                        }
+                        dst.data[digitOffsets[digit] + rank] = key;
+                    }
+                    workgroupBarrier();
+
+                    // Each invocation advances the offset of the digit with its index.
+                    var roundCount = 0u;
+                    for (var w = 0u; w < 8u; w = w + 1u) {
+                        roundCount = roundCount + countOneBits(atomicExchange(&digitMasks[threadIdx][w], 0u));
+                    }
+                    digitOffsets[threadIdx] = digitOffsets[threadIdx] + roundCount;
+                    workgroupBarrier();
+                }
+            }
+        )";
+
+        wgpu::ShaderModule module = utils::CreateShaderModule(mDevice, code.c_str());
+
+        wgpu::ComputePipelineDescriptor pDesc;
+        pDesc.label = "RadixSorter::mHistogramPipeline";
+        pDesc.compute.module = module;
+        pDesc.compute.entryPoint = "computeHistograms";
+        mHistogramPipeline = mDevice.CreateComputePipeline(&pDesc);
+
+        pDesc.label = "RadixSorter::mScanPipeline";
+        pDesc.compute.entryPoint = "scanHistograms";
+        mScanPipeline = mDevice.CreateComputePipeline(&pDesc);
+
+        pDesc.label = "RadixSorter::mScatterPipeline";
+        pDesc.compute.entryPoint = "scatter";
+        mScatterPipeline = mDevice.CreateComputePipeline(&pDesc);
+
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "RadixSorter::mNoCountLimit";
+        bufferDesc.size = sizeof(uint32_t);
+        bufferDesc.usage = wgpu::BufferUsage::Storage;
+        bufferDesc.mappedAtCreation = true;
+        mNoCountLimit = mDevice.CreateBuffer(&bufferDesc);
+        *static_cast<uint32_t*>(mNoCountLimit.GetMappedRange()) = 0xFFFFFFFFu;
+        mNoCountLimit.Unmap();
+    }
+
+    wgpu::Buffer RadixSorter::Sort(EncodingContext* context, wgpu::Buffer keys, uint32_t count, uint64_t sortedBits,
+                                   wgpu::Buffer countBuffer) {
+        // Choose the digits greedily, starting each one at the lowest sorted bit it has to cover.
+        std::vector<uint32_t> shifts;
+        for (uint32_t bit = 0; bit < 64; bit++) {
+            if (sortedBits & (uint64_t(1) << bit)) {
+                shifts.push_back(bit);
+                bit += kRadixBits - 1;
+            }
+        }
+        if (shifts.empty() || count <= 1) {
+            return keys;
+        }
+
+        if (countBuffer == nullptr) {
+            countBuffer = mNoCountLimit;
+        }
+        uint32_t blockCount = (count + kBlockSize - 1) / kBlockSize;
+
+        wgpu::Buffer uniforms = mPool->GetBuffer(mName + "::Uniforms", kUniformSliceSize * kMaxPasses,
+                wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst);
+        for (size_t pass = 0; pass < shifts.size(); pass++) {
+            ConfigUniforms uniformData = {count, blockCount, shifts[pass], 0};
+            mDevice.GetQueue().WriteBuffer(uniforms, pass * kUniformSliceSize, &uniformData, sizeof(uniformData));
+        }
+
+        wgpu::Buffer scratch = mPool->GetBuffer(mName + "::Scratch", uint64_t(count) * sizeof(uint64_t),
+                wgpu::BufferUsage::Storage);
+        wgpu::Buffer table = mPool->GetBuffer(mName + "::Table",
+                uint64_t(blockCount) * (1 << kRadixBits) * sizeof(uint32_t), wgpu::BufferUsage::Storage);
+
+        wgpu::Buffer src = keys;
+        wgpu::Buffer dst = scratch;
+        for (size_t pass = 0; pass < shifts.size(); pass++) {
+            PassBindGroups& bindGroups = mPassBindGroups[pass];
+            uint64_t uniformOffset = pass * kUniformSliceSize;
+
+            if (bindGroups.histogram.IsStale({uniforms.Get(), src.Get(), table.Get(), countBuffer.Get()})) {
+                bindGroups.histogram.Set(utils::MakeBindGroup(mDevice, mHistogramPipeline.GetBindGroupLayout(0), {
+                    {0, uniforms, uniformOffset, sizeof(ConfigUniforms)},
+                    {1, src},
+                    {3, table},
+                    {4, countBuffer, 0, sizeof(uint32_t)},
+                }));
+            }
+            if (bindGroups.scan.IsStale({uniforms.Get(), table.Get()})) {
+                bindGroups.scan.Set(utils::MakeBindGroup(mDevice, mScanPipeline.GetBindGroupLayout(0), {
+                    {0, uniforms, uniformOffset, sizeof(ConfigUniforms)},
+                    {3, table},
+                }));
+            }
+            if (bindGroups.scatter.IsStale({uniforms.Get(), src.Get(), dst.Get(), table.Get(), countBuffer.Get()})) {
+                bindGroups.scatter.Set(utils::MakeBindGroup(mDevice, mScatterPipeline.GetBindGroupLayout(0), {
+                    {0, uniforms, uniformOffset, sizeof(ConfigUniforms)},
+                    {1, src},
+                    {2, dst},
+                    {3, table},
+                    {4, countBuffer, 0, sizeof(uint32_t)},
+                }));
+            }
+
+            {
+                ScopedComputePass pass(context, "RadixSorter::Histograms");
+                pass->SetBindGroup(0, bindGroups.histogram.Get());
+                pass->SetPipeline(mHistogramPipeline);
+                pass->Dispatch(blockCount);
+            }
+            {
+                ScopedComputePass pass(context, "RadixSorter::Scan");
+                pass->SetBindGroup(0, bindGroups.scan.Get());
+                pass->SetPipeline(mScanPipeline);
+                pass->Dispatch(1);
+            }
+            {
+                ScopedComputePass pass(context, "RadixSorter::Scatter");
+                pass->SetBindGroup(0, bindGroups.scatter.Get());
+                pass->SetPipeline(mScatterPipeline);
+                pass->Dispatch(blockCount);
+            }
+
+            std::swap(src, dst);
+        }
+
+        return src;
+    }
+
+} // namespace cassia
@@ -0,0 +1,50 @@
+#ifndef CASSIA_RADIXSORTER_H
+#define CASSIA_RADIXSORTER_H
+
+#include "ResourcePool.h"
+
+#include "webgpu/webgpu_cpp.h"
+
+#include <string>
+#include <vector>
+
+namespace cassia {
+
+    class EncodingContext;
+
+    // Stable LSD radix sort of 64-bit keys on the GPU, 8 bits per pass.
+    class RadixSorter {
+      public:
+        // The name prefixes the pooled resources so that each sorter has its own.
+        RadixSorter(wgpu::Device device, ResourcePool* pool, std::string name);
+
+        // Sorts the `count` keys in `keys` by the bits set in `sortedBits`. The other bits are
+        // either constant or don't matter to the caller, which lets the sort skip the passes
+        // for digits without any sorted bits. Returns the buffer holding the sorted keys which
+        // is either `keys` or a pooled scratch buffer.
+        // When the number of keys is only known on the GPU, `countBuffer` holds it in its first
+        // u32 and `count` is an upper bound of it.
+        wgpu::Buffer Sort(EncodingContext* context, wgpu::Buffer keys, uint32_t count, uint64_t sortedBits,
+                          wgpu::Buffer countBuffer = nullptr);
+
+      private:
+        struct PassBindGroups {
+            CachedBindGroup histogram;
+            CachedBindGroup scan;
+            CachedBindGroup scatter;
+        };
+
+        wgpu::Device mDevice;
+        ResourcePool* mPool;
+        std::string mName;
+        // Holds 0xFFFFFFFF so that the count in the uniforms is used when there is no count buffer.
+        wgpu::Buffer mNoCountLimit;
+        wgpu::ComputePipeline mHistogramPipeline;
+        wgpu::ComputePipeline mScanPipeline;
+        wgpu::ComputePipeline mScatterPipeline;
+        std::vector<PassBindGroups> mPassBindGroups;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_RADIXSORTER_H
@@ -1,6 +1,9 @@
 #ifndef CASSIA_RASTERIZER_H
 #define CASSIA_RASTERIZER_H
 
+#include "Cassia.h"
+#include "CommonWGSL.h"
+
 #include "webgpu/webgpu_cpp.h"
 
 namespace cassia {
@@ -16,11 +19,68 @@ namespace cassia {
             uint32_t stylingCount;
         };
 
+        struct Inputs {
+            wgpu::Buffer sortedPsegments;
+            wgpu::Buffer stylings;
+            // Optional, the TileRange of each tile when they were computed while sorting on the host.
+            wgpu::Buffer tileRanges;
+
+            // Host copies of the inputs, only used by rasterizers running on the CPU. They are
+            // null when the psegments only exist on the GPU.
+            const uint64_t* hostSortedPsegments = nullptr;
+            const CassiaStyling* hostStylings = nullptr;
+            // Optional, like tileRanges.
+            const TileRange* hostTileRanges = nullptr;
+
+            // Whether the rows of tiles whose psegments and stylings didn't change since the
+            // previous call can keep their pixels in the returned texture. Rasterizers that don't
+            // keep their output between calls ignore it.
+            bool reusePreviousPicture = false;
+            // The layers below it are composited in a picture kept between calls, which only
+            // changes where their psegments or stylings do, and the other layers are rasterized
+            // over it. Rasterizers that don't keep their output between calls ignore it.
+            uint32_t layerCacheBoundary = 0;
+            // Whether to use builds of the kernels that count their work, see GetCounters.
+            // Rasterizers without counters ignore it.
+            bool gatherCounters = false;
+        };
+
         virtual ~Rasterizer() = default;
 
-        virtual wgpu::Texture Rasterize(EncodingContext* context,
-            wgpu::Buffer sortedPsegments, wgpu::Buffer stylingsBuffer,
+        // Whether the rasterizer uses the host copies of the inputs.
+        virtual bool NeedsHostInputs() const {
+            return false;
+        }
+
+        virtual wgpu::Texture Rasterize(EncodingContext* context, const Inputs& inputs,
             const Config& config) = 0;
+
+        // Whether the pipelines needed by Rasterize finished their asynchronous creation.
+        virtual bool IsReady() const {
+            return true;
+        }
+
+        // Creates the pipelines that are otherwise only created when they are first needed and
+        // waits for them. Returns false if one of them failed to be created.
+        virtual bool Precompile() {
+            return true;
+        }
+
+        // Called after the commands encoded by Rasterize are submitted.
+        virtual void OnSubmitted() {
+        }
+
+        // The counters of the last frame rasterized with gatherCounters whose readback finished.
+        // Returns false if there is none.
+        virtual bool GetCounters(CassiaRasterCounters* counters) const {
+            return false;
+        }
+
+        // The carries dropped for lack of room since the rasterizer was created, in the frames
+        // whose stats were read back.
+        virtual uint64_t GetDroppedCarries() const {
+            return 0;
+        }
     };
 
 } // namespace cassia
@@ -0,0 +1,82 @@
+#include "RenderThread.h"
+
+#include <algorithm>
+
+namespace cassia {
+
+    RenderThread::RenderThread(size_t queueDepth, RenderFunction render)
+        : mRender(std::move(render)), mFrames(std::max(queueDepth, size_t(1))) {
+        mThread = std::thread([this]() {
+            ThreadMain();
+        });
+    }
+
+    RenderThread::~RenderThread() {
+        mExiting.store(true);
+        Notify();
+        mThread.join();
+    }
+
+    void RenderThread::Push(const uint64_t* psegments, size_t psegmentCount,
+                            const CassiaStyling* stylings, size_t stylingCount) {
+        uint64_t tail = mTail.load(std::memory_order_relaxed);
+        auto HasRoom = [&]() {
+            return tail - mHead.load(std::memory_order_acquire) < mFrames.size();
+        };
+        if (!HasRoom()) {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mChanged.wait(lock, HasRoom);
+        }
+
+        // The vectors keep their capacity so the copies don't allocate once the scene is stable.
+        Frame& frame = mFrames[tail % mFrames.size()];
+        frame.psegments.assign(psegments, psegments + psegmentCount);
+        frame.stylings.assign(stylings, stylings + stylingCount);
+
+        mTail.store(tail + 1, std::memory_order_release);
+        Notify();
+    }
+
+    void RenderThread::Finish() {
+        uint64_t tail = mTail.load(std::memory_order_relaxed);
+        auto IsDone = [&]() {
+            return mHead.load(std::memory_order_acquire) == tail;
+        };
+        if (!IsDone()) {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mChanged.wait(lock, IsDone);
+        }
+    }
+
+    void RenderThread::Notify() {
+        // Taking the lock orders the ring update before the predicate check of a thread that is
+        // about to wait, so the notification can't be missed.
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+        }
+        mChanged.notify_all();
+    }
+
+    void RenderThread::ThreadMain() {
+        while (true) {
+            uint64_t head = mHead.load(std::memory_order_relaxed);
+            auto HasWork = [&]() {
+                return mTail.load(std::memory_order_acquire) != head || mExiting.load();
+            };
+            if (!HasWork()) {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mChanged.wait(lock, HasWork);
+            }
+            if (mTail.load(std::memory_order_acquire) == head) {
+                return;
+            }
+
+            const Frame& frame = mFrames[head % mFrames.size()];
+            mRender(frame.psegments.data(), frame.psegments.size(), frame.stylings.data(), frame.stylings.size());
+
+            mHead.store(head + 1, std::memory_order_release);
+            Notify();
+        }
+    }
+
+} // namespace cassia
@@ -0,0 +1,62 @@
+#ifndef CASSIA_RENDERTHREAD_H
+#define CASSIA_RENDERTHREAD_H
+
+#include "Cassia.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cassia {
+
+    // Renders the frames pushed by one producer thread on a thread of its own. The frames are
+    // copied in a single-producer single-consumer ring so that the producer can prepare the next
+    // frame while the previous ones are rendered.
+    class RenderThread {
+      public:
+        using RenderFunction = std::function<void(const uint64_t* psegments, size_t psegmentCount,
+                                                  const CassiaStyling* stylings, size_t stylingCount)>;
+
+        RenderThread(size_t queueDepth, RenderFunction render);
+        // Renders the frames still in the queue before returning.
+        ~RenderThread();
+
+        // Copies the frame in the queue, waits for room when queueDepth frames are already queued.
+        void Push(const uint64_t* psegments, size_t psegmentCount,
+                  const CassiaStyling* stylings, size_t stylingCount);
+        // Returns once all the pushed frames are rendered. The producer can use the device until
+        // the next Push.
+        void Finish();
+
+      private:
+        struct Frame {
+            std::vector<uint64_t> psegments;
+            std::vector<CassiaStyling> stylings;
+        };
+
+        void ThreadMain();
+        // Wakes the other thread if it waits on the ring.
+        void Notify();
+
+        RenderFunction mRender;
+        std::vector<Frame> mFrames;
+
+        // The ring itself is lock-free: only the producer writes mTail and only the render thread
+        // writes mHead, the frames between them belong to the render thread.
+        std::atomic<uint64_t> mHead{0};
+        std::atomic<uint64_t> mTail{0};
+        std::atomic<bool> mExiting{false};
+
+        // Only used to sleep while the ring is full or empty.
+        std::mutex mMutex;
+        std::condition_variable mChanged;
+
+        std::thread mThread;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_RENDERTHREAD_H
@@ -0,0 +1,124 @@
+#include "ResourcePool.h"
+
+#include "EncodingContext.h"
+
+#include <algorithm>
+
+namespace cassia {
+
+    namespace {
+        // Storage bindings can't be empty so we never create buffers smaller than this.
+        constexpr uint64_t kMinBufferSize = 256;
+    }
+
+    // ResourcePool
+
+    ResourcePool::ResourcePool(wgpu::Device device) : mDevice(std::move(device)) {
+    }
+
+    wgpu::Buffer ResourcePool::GetBuffer(const std::string& name, uint64_t size, wgpu::BufferUsage usage) {
+        PooledBuffer& pooled = mBuffers[name];
+        if (pooled.buffer != nullptr && pooled.size >= size) {
+            return pooled.buffer;
+        }
+
+        // Grow geometrically so that slowly growing scenes don't reallocate every frame.
+        uint64_t newSize = std::max(std::max(size, pooled.size * 2), kMinBufferSize);
+        newSize = (newSize + 3) & ~uint64_t(3);
+
+        wgpu::BufferDescriptor desc;
+        desc.label = name.c_str();
+        desc.size = newSize;
+        desc.usage = usage;
+        pooled.buffer = mDevice.CreateBuffer(&desc);
+        pooled.size = newSize;
+        return pooled.buffer;
+    }
+
+    wgpu::Texture ResourcePool::GetTexture(const std::string& name, uint32_t width, uint32_t height,
+                                           wgpu::TextureFormat format, wgpu::TextureUsage usage) {
+        PooledTexture& pooled = mTextures[name];
+        if (pooled.texture != nullptr && pooled.width == width && pooled.height == height &&
+            pooled.format == format) {
+            return pooled.texture;
+        }
+
+        wgpu::TextureDescriptor desc;
+        desc.label = name.c_str();
+        desc.size = {width, height};
+        desc.usage = usage;
+        desc.format = format;
+        pooled.texture = mDevice.CreateTexture(&desc);
+        pooled.width = width;
+        pooled.height = height;
+        pooled.format = format;
+        return pooled.texture;
+    }
+
+    // CachedBindGroup
+
+    bool CachedBindGroup::IsStale(std::initializer_list<const void*> resources) {
+        if (mBindGroup != nullptr && std::equal(resources.begin(), resources.end(),
+                                                mResources.begin(), mResources.end())) {
+            return false;
+        }
+        mResources.assign(resources.begin(), resources.end());
+        return true;
+    }
+
+    void CachedBindGroup::Set(wgpu::BindGroup bindGroup) {
+        mBindGroup = std::move(bindGroup);
+    }
+
+    const wgpu::BindGroup& CachedBindGroup::Get() const {
+        return mBindGroup;
+    }
+
+    // StatsReadback
+
+    StatsReadback::StatsReadback(const wgpu::Device& device, const char* label, uint64_t size, Callback callback)
+        : mSize(size), mCallback(std::move(callback)) {
+        wgpu::BufferDescriptor desc;
+        desc.label = label;
+        desc.size = size;
+        desc.usage = wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst;
+        mBuffer = device.CreateBuffer(&desc);
+    }
+
+    StatsReadback::~StatsReadback() {
+        mBuffer.Destroy();
+    }
+
+    // static
+    uint64_t StatsReadback::WithHeadroom(uint64_t measured) {
+        return measured + measured / 4 + 1;
+    }
+
+    bool StatsReadback::IsIdle() const {
+        return mState == State::Idle;
+    }
+
+    void StatsReadback::Copy(EncodingContext* context, const wgpu::Buffer& source, uint64_t offset, uint64_t size) {
+        context->GetEncoder().CopyBufferToBuffer(source, 0, mBuffer, offset, size);
+        mState = State::Copied;
+    }
+
+    void StatsReadback::OnSubmitted() {
+        if (mState != State::Copied) {
+            return;
+        }
+
+        mState = State::Mapping;
+        mBuffer.MapAsync(wgpu::MapMode::Read, 0, mSize, [](WGPUBufferMapAsyncStatus status, void* userdata) {
+            StatsReadback* self = static_cast<StatsReadback*>(userdata);
+            self->mState = State::Idle;
+            if (status != WGPUBufferMapAsyncStatus_Success) {
+                return;
+            }
+
+            self->mCallback(self->mBuffer.GetConstMappedRange(0, self->mSize));
+            self->mBuffer.Unmap();
+        }, this);
+    }
+
+} // namespace cassia
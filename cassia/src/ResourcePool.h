@@ -0,0 +1,100 @@
+#ifndef CASSIA_RESOURCEPOOL_H
+#define CASSIA_RESOURCEPOOL_H
+
+#include "webgpu/webgpu_cpp.h"
+
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cassia {
+
+    class EncodingContext;
+
+    // The default maxStorageBufferBindingSize, which the storage buffers sized from the scene are
+    // kept under.
+    constexpr uint64_t kMaxStorageBufferBindingSize = uint64_t(128) << 20;
+
+    // Keeps GPU resources alive across frames so that they are only reallocated when the scene
+    // outgrows them. Buffers grow geometrically, textures are recreated when their size changes.
+    class ResourcePool {
+      public:
+        ResourcePool(wgpu::Device device);
+
+        // Returns a buffer of at least `size` bytes. The contents are undefined after a
+        // reallocation so callers must rewrite what they read.
+        wgpu::Buffer GetBuffer(const std::string& name, uint64_t size, wgpu::BufferUsage usage);
+        wgpu::Texture GetTexture(const std::string& name, uint32_t width, uint32_t height,
+                                 wgpu::TextureFormat format, wgpu::TextureUsage usage);
+
+      private:
+        struct PooledBuffer {
+            wgpu::Buffer buffer;
+            uint64_t size;
+        };
+        struct PooledTexture {
+            wgpu::Texture texture;
+            uint32_t width;
+            uint32_t height;
+            wgpu::TextureFormat format;
+        };
+
+        wgpu::Device mDevice;
+        std::unordered_map<std::string, PooledBuffer> mBuffers;
+        std::unordered_map<std::string, PooledTexture> mTextures;
+    };
+
+    // A bind group that is only recreated when one of the resources it references changed.
+    class CachedBindGroup {
+      public:
+        // Returns true if the bind group must be recreated for these resources.
+        bool IsStale(std::initializer_list<const void*> resources);
+        void Set(wgpu::BindGroup bindGroup);
+        const wgpu::BindGroup& Get() const;
+
+      private:
+        wgpu::BindGroup mBindGroup;
+        std::vector<const void*> mResources;
+    };
+
+    // Reads a few bytes written by the GPU in a frame back to the host without ever stalling the
+    // frames. Only one readback is in flight, the frames encoded meanwhile aren't copied.
+    class StatsReadback {
+      public:
+        // Called with the copied bytes when a readback succeeds, they are only valid during the call.
+        using Callback = std::function<void(const void* data)>;
+
+        StatsReadback(const wgpu::Device& device, const char* label, uint64_t size, Callback callback);
+        // Resolves a pending map now, while the callback can still use its owner.
+        ~StatsReadback();
+
+        // The capacity to allocate for a count measured by a readback, with some room for the
+        // scene to change until the next measurement.
+        static uint64_t WithHeadroom(uint64_t measured);
+
+        // Whether the frame being encoded can copy to the readback.
+        bool IsIdle() const;
+        // Records the copy of the start of `source` at `offset` in the readback. Only valid while
+        // idle, the copies of a frame are read back together.
+        void Copy(EncodingContext* context, const wgpu::Buffer& source, uint64_t offset, uint64_t size);
+        // Starts reading the copies back once the frame that recorded them is submitted.
+        void OnSubmitted();
+
+      private:
+        enum class State {
+            Idle,
+            Copied,
+            Mapping,
+        };
+
+        wgpu::Buffer mBuffer;
+        uint64_t mSize;
+        Callback mCallback;
+        State mState = State::Idle;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_RESOURCEPOOL_H
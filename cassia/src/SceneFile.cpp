@@ -0,0 +1,255 @@
+#include "SceneFile.h"
+
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace cassia {
+
+    namespace {
+        constexpr uint64_t kChecksumSeed = 0xCBF29CE484222325ull;
+
+        // Mixes 64-bit words, which is fast enough to verify multi-GB files at memory bandwidth.
+        // The psegments, stylings and frame table are all multiples of 8 bytes.
+        uint64_t UpdateChecksum(uint64_t checksum, const void* data, uint64_t size) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            for (uint64_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+                uint64_t word;
+                memcpy(&word, bytes + i, sizeof(uint64_t));
+                checksum ^= word;
+                checksum = ((checksum << 31) | (checksum >> 33)) * 0x9E3779B97F4A7C15ull;
+            }
+            return checksum;
+        }
+
+        // The header is hashed after the sections since its offsets and size are only known
+        // once they are written.
+        uint64_t FinishChecksum(uint64_t checksum, SceneFileHeader header) {
+            header.checksum = 0;
+            return UpdateChecksum(checksum, &header, sizeof(header));
+        }
+
+        // Whether count elements of elementSize bytes at offset are in a file of fileSize bytes.
+        bool SectionFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize) {
+            return offset % sizeof(uint64_t) == 0 && offset <= fileSize &&
+                   count <= (fileSize - offset) / elementSize;
+        }
+    }
+
+    // SceneFile
+
+    // static
+    std::unique_ptr<SceneFile> SceneFile::Open(const std::string& path) {
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            std::cerr << "SceneFile: couldn't open " << path << std::endl;
+            return nullptr;
+        }
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        const void* data = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart >= LONGLONG(sizeof(SceneFileHeader))) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        if (mapping != nullptr) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (data == nullptr) {
+            if (mapping != nullptr) {
+                CloseHandle(mapping);
+            }
+            CloseHandle(file);
+            std::cerr << "SceneFile: couldn't map " << path << std::endl;
+            return nullptr;
+        }
+
+        std::unique_ptr<SceneFile> sceneFile(
+                new SceneFile(path, static_cast<const uint8_t*>(data), uint64_t(size.QuadPart)));
+        sceneFile->mFile = file;
+        sceneFile->mMapping = mapping;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "SceneFile: couldn't open " << path << std::endl;
+            return nullptr;
+        }
+        struct stat fileStat;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &fileStat) == 0 && uint64_t(fileStat.st_size) >= sizeof(SceneFileHeader)) {
+            data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        // The mapping keeps its own reference to the file.
+        close(fd);
+        if (data == MAP_FAILED) {
+            std::cerr << "SceneFile: couldn't map " << path << std::endl;
+            return nullptr;
+        }
+
+        std::unique_ptr<SceneFile> sceneFile(
+                new SceneFile(path, static_cast<const uint8_t*>(data), uint64_t(fileStat.st_size)));
+#endif
+
+        if (!sceneFile->Validate()) {
+            return nullptr;
+        }
+        return sceneFile;
+    }
+
+    SceneFile::SceneFile(const std::string& path, const uint8_t* data, uint64_t size)
+        : mPath(path), mData(data), mSize(size) {
+    }
+
+    SceneFile::~SceneFile() {
+#if defined(_WIN32)
+        UnmapViewOfFile(mData);
+        CloseHandle(mMapping);
+        CloseHandle(mFile);
+#else
+        munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
+    }
+
+    const SceneFileHeader& SceneFile::GetHeader() const {
+        return *reinterpret_cast<const SceneFileHeader*>(mData);
+    }
+
+    bool SceneFile::Validate() const {
+        const SceneFileHeader& header = GetHeader();
+        if (memcmp(header.magic, kSceneFileMagic, sizeof(kSceneFileMagic)) != 0) {
+            std::cerr << "SceneFile: " << mPath << " isn't a scene file." << std::endl;
+            return false;
+        }
+        if (header.version != kSceneFileVersion || header.headerSize != sizeof(SceneFileHeader)) {
+            std::cerr << "SceneFile: " << mPath << " has version " << header.version << " instead of "
+                      << kSceneFileVersion << "." << std::endl;
+            return false;
+        }
+        if (header.fileSize != mSize ||
+            !SectionFits(header.frameTableOffset, header.frameCount, sizeof(SceneFileFrame), mSize)) {
+            std::cerr << "SceneFile: " << mPath << " is truncated." << std::endl;
+            return false;
+        }
+
+        for (size_t i = 0; i < GetFrameCount(); i++) {
+            const SceneFileFrame& frame =
+                    reinterpret_cast<const SceneFileFrame*>(mData + header.frameTableOffset)[i];
+            if (!SectionFits(frame.psegmentOffset, frame.psegmentCount, sizeof(uint64_t), mSize) ||
+                !SectionFits(frame.stylingOffset, frame.stylingCount, sizeof(CassiaStyling), mSize)) {
+                std::cerr << "SceneFile: frame " << i << " of " << mPath << " is out of the file." << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t SceneFile::GetWidth() const {
+        return GetHeader().width;
+    }
+
+    uint32_t SceneFile::GetHeight() const {
+        return GetHeader().height;
+    }
+
+    uint32_t SceneFile::GetTileWidthShift() const {
+        return GetHeader().tileWidthShift;
+    }
+
+    uint32_t SceneFile::GetTileHeightShift() const {
+        return GetHeader().tileHeightShift;
+    }
+
+    size_t SceneFile::GetFrameCount() const {
+        return static_cast<size_t>(GetHeader().frameCount);
+    }
+
+    SceneFrame SceneFile::GetFrame(size_t index) const {
+        const SceneFileFrame& frame =
+                reinterpret_cast<const SceneFileFrame*>(mData + GetHeader().frameTableOffset)[index];
+        return {
+            reinterpret_cast<const uint64_t*>(mData + frame.psegmentOffset),
+            static_cast<size_t>(frame.psegmentCount),
+            reinterpret_cast<const CassiaStyling*>(mData + frame.stylingOffset),
+            static_cast<size_t>(frame.stylingCount),
+        };
+    }
+
+    bool SceneFile::VerifyChecksum() const {
+        uint64_t checksum = UpdateChecksum(kChecksumSeed, mData + sizeof(SceneFileHeader),
+                                           mSize - sizeof(SceneFileHeader));
+        return FinishChecksum(checksum, GetHeader()) == GetHeader().checksum;
+    }
+
+    // SceneFileWriter
+
+    // static
+    std::unique_ptr<SceneFileWriter> SceneFileWriter::Create(const std::string& path, uint32_t width,
+            uint32_t height, uint32_t tileWidthShift, uint32_t tileHeightShift) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "SceneFileWriter: couldn't create " << path << std::endl;
+            return nullptr;
+        }
+
+        SceneFileHeader header = {};
+        memcpy(header.magic, kSceneFileMagic, sizeof(kSceneFileMagic));
+        header.version = kSceneFileVersion;
+        header.headerSize = sizeof(SceneFileHeader);
+        header.width = width;
+        header.height = height;
+        header.tileWidthShift = tileWidthShift;
+        header.tileHeightShift = tileHeightShift;
+        return std::unique_ptr<SceneFileWriter>(new SceneFileWriter(std::move(file), header));
+    }
+
+    SceneFileWriter::SceneFileWriter(std::ofstream file, const SceneFileHeader& header)
+        : mFile(std::move(file)), mHeader(header), mOffset(sizeof(SceneFileHeader)), mChecksum(kChecksumSeed) {
+        // The header is written again with the offsets and the checksum at the end.
+        mFile.write(reinterpret_cast<const char*>(&mHeader), sizeof(mHeader));
+    }
+
+    void SceneFileWriter::Write(const void* data, uint64_t size) {
+        mFile.write(static_cast<const char*>(data), size);
+        mChecksum = UpdateChecksum(mChecksum, data, size);
+        mOffset += size;
+    }
+
+    bool SceneFileWriter::AddFrame(const uint64_t* psegments, size_t psegmentCount,
+                                   const CassiaStyling* stylings, size_t stylingCount) {
+        static_assert(sizeof(CassiaStyling) % sizeof(uint64_t) == 0, "The sections must stay 8-byte aligned.");
+
+        SceneFileFrame frame;
+        frame.psegmentOffset = mOffset;
+        frame.psegmentCount = psegmentCount;
+        Write(psegments, psegmentCount * sizeof(uint64_t));
+        frame.stylingOffset = mOffset;
+        frame.stylingCount = stylingCount;
+        Write(stylings, stylingCount * sizeof(CassiaStyling));
+
+        mFrames.push_back(frame);
+        return !mFile.fail();
+    }
+
+    bool SceneFileWriter::Finish() {
+        mHeader.frameCount = mFrames.size();
+        mHeader.frameTableOffset = mOffset;
+        Write(mFrames.data(), mFrames.size() * sizeof(SceneFileFrame));
+        mHeader.fileSize = mOffset;
+        mHeader.checksum = FinishChecksum(mChecksum, mHeader);
+
+        mFile.seekp(0);
+        mFile.write(reinterpret_cast<const char*>(&mHeader), sizeof(mHeader));
+        mFile.flush();
+        return !mFile.fail();
+    }
+
+} // namespace cassia
@@ -0,0 +1,119 @@
+#ifndef CASSIA_SCENEFILE_H
+#define CASSIA_SCENEFILE_H
+
+#include "Cassia.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cassia {
+
+    // A scene file holds the psegments and stylings of one or more frames, encoded for a canvas
+    // size and a tile size, so that they can be passed to cassia_render straight from a mapping
+    // of the file. All the values are little-endian. The file is:
+    //  - a SceneFileHeader,
+    //  - the psegments and stylings of each frame, each section starting at a multiple of 8 bytes,
+    //  - the SceneFileFrame of each frame, at frameTableOffset.
+    constexpr char kSceneFileMagic[8] = {'C', 'A', 'S', 'S', 'C', 'E', 'N', 'E'};
+    constexpr uint32_t kSceneFileVersion = 2;
+
+    struct SceneFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint32_t width;
+        uint32_t height;
+        uint32_t tileWidthShift;
+        uint32_t tileHeightShift;
+        uint64_t frameCount;
+        uint64_t frameTableOffset;
+        uint64_t fileSize;
+        // Of the bytes after the header then of the header with a zero checksum, see
+        // SceneFile::VerifyChecksum.
+        uint64_t checksum;
+    };
+    static_assert(sizeof(SceneFileHeader) == 64, "");
+
+    // The offsets are from the start of the file.
+    struct SceneFileFrame {
+        uint64_t psegmentOffset;
+        uint64_t psegmentCount;
+        uint64_t stylingOffset;
+        uint64_t stylingCount;
+    };
+    static_assert(sizeof(SceneFileFrame) == 32, "");
+
+    struct SceneFrame {
+        const uint64_t* psegments;
+        size_t psegmentCount;
+        const CassiaStyling* stylings;
+        size_t stylingCount;
+    };
+
+    // A read-only mapping of a scene file. The pages are only read when the frames are used, so
+    // opening even a large file costs the validation of its header and frame table.
+    class SceneFile {
+      public:
+        // Returns null if the file can't be mapped or isn't a valid scene file.
+        static std::unique_ptr<SceneFile> Open(const std::string& path);
+        ~SceneFile();
+
+        uint32_t GetWidth() const;
+        uint32_t GetHeight() const;
+        uint32_t GetTileWidthShift() const;
+        uint32_t GetTileHeightShift() const;
+        size_t GetFrameCount() const;
+        // Points in the mapping, valid for the lifetime of the SceneFile.
+        SceneFrame GetFrame(size_t index) const;
+
+        // Reads the whole file to compare it with the checksum of the header. Open doesn't do it
+        // since it would read every page of large files.
+        bool VerifyChecksum() const;
+
+      private:
+        SceneFile(const std::string& path, const uint8_t* data, uint64_t size);
+
+        const SceneFileHeader& GetHeader() const;
+        bool Validate() const;
+
+        std::string mPath;
+        const uint8_t* mData;
+        uint64_t mSize;
+#if defined(_WIN32)
+        void* mFile = nullptr;
+        void* mMapping = nullptr;
+#endif
+    };
+
+    // Writes the frames one after the other, then the frame table and the header in Finish.
+    class SceneFileWriter {
+      public:
+        // Returns null if the file can't be created.
+        static std::unique_ptr<SceneFileWriter> Create(const std::string& path, uint32_t width, uint32_t height,
+                                                       uint32_t tileWidthShift, uint32_t tileHeightShift);
+
+        bool AddFrame(const uint64_t* psegments, size_t psegmentCount,
+                      const CassiaStyling* stylings, size_t stylingCount);
+        // Returns false if writing any part of the file failed.
+        bool Finish();
+
+      private:
+        SceneFileWriter(std::ofstream file, const SceneFileHeader& header);
+
+        // Writes a multiple of 8 bytes and adds them to the checksum.
+        void Write(const void* data, uint64_t size);
+
+        std::ofstream mFile;
+        SceneFileHeader mHeader;
+        uint64_t mOffset;
+        uint64_t mChecksum;
+        std::vector<SceneFileFrame> mFrames;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_SCENEFILE_H
@@ -0,0 +1,334 @@
+#include "SceneGenerator.h"
+
+#include "CommonWGSL.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cassia {
+
+    namespace {
+        // The cover of an edge crossing a whole row of pixels and the area of a covered pixel.
+        constexpr int32_t kPixelSize = 16;
+        // The layer field has 16 bits and 0xFFFF is the rasterizers' INVALID_LAYER.
+        constexpr uint32_t kMaxLayers = 0xFFFF;
+
+        struct KindName {
+            SceneKind kind;
+            const char* name;
+        };
+        constexpr KindName kKindNames[] = {
+            {SceneKind::Circles, "circles"},
+            {SceneKind::Glyphs, "glyphs"},
+            {SceneKind::Layers, "layers"},
+            {SceneKind::Wide, "wide"},
+            {SceneKind::OffscreenLeft, "offscreen_left"},
+            {SceneKind::CarrySpills, "carry_spills"},
+        };
+
+        uint64_t MakePSegment(const SceneParams& params, int32_t tileX, int32_t tileY, uint32_t layer,
+                              uint32_t localX, uint32_t localY, int32_t cover, int32_t area) {
+            uint32_t layerOffset = 16 + params.tileWidthShift + params.tileHeightShift;
+            uint32_t tileXOffset = layerOffset + 16;
+            uint32_t tileYOffset = tileXOffset + (16 - params.tileWidthShift);
+            return (uint64_t(cover) & 0x3F) | ((uint64_t(area) & 0x3FF) << 6) |
+                   (uint64_t(localX) << 16) | (uint64_t(localY) << (16 + params.tileWidthShift)) |
+                   (uint64_t(layer) << layerOffset) |
+                   (uint64_t(tileX + int32_t(TILE_X_OFFSET)) << tileXOffset) |
+                   (uint64_t(tileY) << tileYOffset);
+        }
+    }
+
+    // static
+    bool SceneGenerator::Generate(const SceneParams& params, GeneratedScene* scene) {
+        uint32_t widthShift = params.tileWidthShift;
+        uint32_t heightShift = params.tileHeightShift;
+        if (widthShift < 2 || widthShift > 4 || heightShift < 2 || heightShift > 4 || widthShift + heightShift > 8) {
+            return false;
+        }
+
+        // tile_x is stored with TILE_X_OFFSET added in a signed field, tile_y in a signed field.
+        uint64_t maxWidthInTiles = (uint64_t(1) << (15 - widthShift)) - TILE_X_OFFSET;
+        uint64_t maxHeightInTiles = uint64_t(1) << (14 - heightShift);
+        uint64_t widthInTiles = (uint64_t(params.width) + (1u << widthShift) - 1) >> widthShift;
+        uint64_t heightInTiles = (uint64_t(params.height) + (1u << heightShift) - 1) >> heightShift;
+        if (params.width == 0 || params.height == 0 || widthInTiles > maxWidthInTiles ||
+            heightInTiles > maxHeightInTiles) {
+            return false;
+        }
+
+        scene->psegments.clear();
+        scene->stylings.clear();
+
+        SceneGenerator generator(params, scene);
+        switch (params.kind) {
+            case SceneKind::Circles:
+                generator.GenerateCircles();
+                break;
+            case SceneKind::Glyphs:
+                generator.GenerateGlyphs();
+                break;
+            case SceneKind::Layers:
+                generator.GenerateLayers();
+                break;
+            case SceneKind::Wide:
+                generator.GenerateWide();
+                break;
+            case SceneKind::OffscreenLeft:
+                generator.GenerateOffscreenLeft();
+                break;
+            case SceneKind::CarrySpills:
+                generator.GenerateCarrySpills();
+                break;
+        }
+        if (scene->stylings.size() > kMaxLayers) {
+            return false;
+        }
+
+        // Sorting the whole psegments orders them by tile_y, tile_x then layer.
+        std::sort(scene->psegments.begin(), scene->psegments.end());
+        return true;
+    }
+
+    // static
+    SceneParams SceneGenerator::GetDefaultParams(SceneKind kind) {
+        SceneParams params;
+        params.kind = kind;
+        switch (kind) {
+            case SceneKind::Circles:
+            case SceneKind::OffscreenLeft:
+                break;
+            case SceneKind::Glyphs:
+                params.count = 20000;
+                break;
+            case SceneKind::Layers:
+                params.count = 256;
+                break;
+            case SceneKind::Wide:
+                params.width = 16384;
+                params.height = 256;
+                break;
+            case SceneKind::CarrySpills:
+                params.count = 512;
+                break;
+        }
+        return params;
+    }
+
+    // static
+    bool SceneGenerator::ParseKind(const std::string& name, SceneKind* kind) {
+        for (const KindName& kindName : kKindNames) {
+            if (name == kindName.name) {
+                *kind = kindName.kind;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // static
+    const char* SceneGenerator::GetKindName(SceneKind kind) {
+        for (const KindName& kindName : kKindNames) {
+            if (kind == kindName.kind) {
+                return kindName.name;
+            }
+        }
+        return "unknown";
+    }
+
+    SceneGenerator::SceneGenerator(const SceneParams& params, GeneratedScene* scene)
+        : mParams(params), mScene(scene), mRandom(params.seed) {
+    }
+
+    uint32_t SceneGenerator::AddLayer(float minAlpha, float maxAlpha) {
+        std::uniform_real_distribution<float> channel(0.0f, 1.0f);
+        std::uniform_real_distribution<float> alpha(minAlpha, maxAlpha);
+
+        CassiaStyling styling = {};
+        styling.fill[0] = channel(mRandom);
+        styling.fill[1] = channel(mRandom);
+        styling.fill[2] = channel(mRandom);
+        styling.fill[3] = alpha(mRandom);
+        mScene->stylings.push_back(styling);
+        return static_cast<uint32_t>(mScene->stylings.size() - 1);
+    }
+
+    void SceneGenerator::AddEdge(uint32_t layer, int32_t y, float x, int32_t cover) {
+        if (cover == 0 || y < 0 || y >= int32_t(mParams.height) || x >= float(mParams.width)) {
+            return;
+        }
+
+        uint32_t localY = uint32_t(y) & ((1u << mParams.tileHeightShift) - 1);
+        int32_t tileY = y >> mParams.tileHeightShift;
+        if (x < 0.0f) {
+            // Left of the canvas the edges only add their cover to the carries of the row, so
+            // they all go in the tile_x == -1 column.
+            uint32_t localX = (1u << mParams.tileWidthShift) - 1;
+            mScene->psegments.push_back(MakePSegment(mParams, -1, tileY, layer, localX, localY, cover, 0));
+            return;
+        }
+
+        // The area is the part of the edge's pixel right of the edge.
+        int32_t pixelX = static_cast<int32_t>(x);
+        int32_t subpixelX = static_cast<int32_t>(std::lround((x - float(pixelX)) * kPixelSize));
+        if (subpixelX == kPixelSize) {
+            pixelX++;
+            subpixelX = 0;
+            if (pixelX >= int32_t(mParams.width)) {
+                return;
+            }
+        }
+        int32_t area = cover * (kPixelSize - subpixelX);
+
+        uint32_t localX = uint32_t(pixelX) & ((1u << mParams.tileWidthShift) - 1);
+        int32_t tileX = pixelX >> mParams.tileWidthShift;
+        mScene->psegments.push_back(MakePSegment(mParams, tileX, tileY, layer, localX, localY, cover, area));
+    }
+
+    void SceneGenerator::AddSpan(uint32_t layer, int32_t y, float x0, float x1, int32_t cover) {
+        // The edges of spans left of the canvas would cancel each other in the tile_x == -1 column.
+        if (x1 <= x0 || x1 < 0.0f) {
+            return;
+        }
+        AddEdge(layer, y, x0, cover);
+        AddEdge(layer, y, x1, -cover);
+    }
+
+    void SceneGenerator::AddRect(uint32_t layer, float x0, float y0, float x1, float y1, int32_t winding) {
+        int32_t firstRow = std::max(static_cast<int32_t>(std::floor(y0)), 0);
+        int32_t endRow = std::min(static_cast<int32_t>(std::ceil(y1)), int32_t(mParams.height));
+        for (int32_t y = firstRow; y < endRow; y++) {
+            // The rows partially covered get a partial cover.
+            float rowCoverage = std::min(y1, float(y + 1)) - std::max(y0, float(y));
+            int32_t cover = static_cast<int32_t>(std::lround(rowCoverage * kPixelSize));
+            AddSpan(layer, y, x0, x1, cover * winding);
+        }
+    }
+
+    void SceneGenerator::AddCircle(uint32_t layer, float centerX, float centerY, float radius, int32_t winding) {
+        int32_t firstRow = std::max(static_cast<int32_t>(std::floor(centerY - radius)), 0);
+        int32_t endRow = std::min(static_cast<int32_t>(std::ceil(centerY + radius)), int32_t(mParams.height));
+        for (int32_t y = firstRow; y < endRow; y++) {
+            // The span of the row is the chord through its center.
+            float dy = float(y) + 0.5f - centerY;
+            if (std::abs(dy) >= radius) {
+                continue;
+            }
+            float halfWidth = std::sqrt(radius * radius - dy * dy);
+            AddSpan(layer, y, centerX - halfWidth, centerX + halfWidth, kPixelSize * winding);
+        }
+    }
+
+    void SceneGenerator::GenerateCircles() {
+        float width = float(mParams.width);
+        float height = float(mParams.height);
+        std::uniform_real_distribution<float> centerX(0.0f, width);
+        std::uniform_real_distribution<float> centerY(0.0f, height);
+        std::uniform_real_distribution<float> radius(2.0f, std::max(std::min(width, height) / 8.0f, 2.0f));
+
+        for (uint32_t i = 0; i < mParams.count; i++) {
+            uint32_t layer = AddLayer(0.5f, 1.0f);
+            AddCircle(layer, centerX(mRandom), centerY(mRandom), radius(mRandom), 1);
+        }
+    }
+
+    void SceneGenerator::GenerateGlyphs() {
+        std::uniform_real_distribution<float> fontSize(8.0f, 14.0f);
+        std::uniform_int_distribution<uint32_t> glyphShape(0, 3);
+
+        // Lines of text wrap at the bottom of the canvas and go over the previous ones.
+        float size = fontSize(mRandom);
+        float penX = 0.0f;
+        float penY = 0.0f;
+        uint32_t layer = AddLayer(1.0f, 1.0f);
+
+        for (uint32_t i = 0; i < mParams.count; i++) {
+            float advance = 0.7f * size;
+            if (penX + advance > float(mParams.width)) {
+                penX = 0.0f;
+                penY += 1.4f * size;
+                size = fontSize(mRandom);
+                if (penY + size > float(mParams.height)) {
+                    penY = 0.0f;
+                }
+                layer = AddLayer(1.0f, 1.0f);
+                advance = 0.7f * size;
+            }
+
+            float stroke = std::max(1.0f, 0.12f * size);
+            float stemX = penX + 0.1f * size;
+            switch (glyphShape(mRandom)) {
+                // l
+                case 0:
+                    AddRect(layer, stemX, penY, stemX + stroke, penY + size, 1);
+                    break;
+                // t
+                case 1:
+                    AddRect(layer, stemX, penY + 0.1f * size, stemX + stroke, penY + size, 1);
+                    AddRect(layer, penX, penY + 0.35f * size, penX + 0.5f * size, penY + 0.35f * size + stroke, 1);
+                    break;
+                // o, with the inner circle winding the other way
+                case 2:
+                    AddCircle(layer, penX + 0.3f * size, penY + 0.65f * size, 0.3f * size, 1);
+                    AddCircle(layer, penX + 0.3f * size, penY + 0.65f * size, 0.3f * size - stroke, -1);
+                    break;
+                // b
+                case 3:
+                    AddRect(layer, stemX, penY, stemX + stroke, penY + size, 1);
+                    AddCircle(layer, stemX + 0.25f * size, penY + 0.7f * size, 0.25f * size, 1);
+                    AddCircle(layer, stemX + 0.25f * size, penY + 0.7f * size, 0.25f * size - stroke, -1);
+                    break;
+            }
+            penX += advance;
+        }
+    }
+
+    void SceneGenerator::GenerateLayers() {
+        // Starting left of the canvas, each layer only has psegments in the tile_x == -1 column.
+        // They are translucent so that none hides the others.
+        for (uint32_t i = 0; i < mParams.count; i++) {
+            uint32_t layer = AddLayer(0.02f, 0.1f);
+            AddRect(layer, -1.0f, 0.0f, float(mParams.width) + 1.0f, float(mParams.height), 1);
+        }
+    }
+
+    void SceneGenerator::GenerateWide() {
+        float width = float(mParams.width);
+        std::uniform_real_distribution<float> left(0.0f, width);
+        std::uniform_real_distribution<float> length(width / 8.0f, width);
+        std::uniform_real_distribution<float> top(0.0f, float(mParams.height));
+        std::uniform_real_distribution<float> thickness(2.0f, 24.0f);
+
+        for (uint32_t i = 0; i < mParams.count; i++) {
+            uint32_t layer = AddLayer(0.5f, 1.0f);
+            float x0 = left(mRandom);
+            float y0 = top(mRandom);
+            AddRect(layer, x0, y0, x0 + length(mRandom), y0 + thickness(mRandom), 1);
+        }
+    }
+
+    void SceneGenerator::GenerateOffscreenLeft() {
+        float width = float(mParams.width);
+        std::uniform_real_distribution<float> centerX(-width, 0.1f * width);
+        std::uniform_real_distribution<float> centerY(0.0f, float(mParams.height));
+        std::uniform_real_distribution<float> reach(0.05f * width, 0.5f * width);
+
+        for (uint32_t i = 0; i < mParams.count; i++) {
+            uint32_t layer = AddLayer(0.3f, 0.8f);
+            // The circles reach into the canvas from their center.
+            float x = centerX(mRandom);
+            AddCircle(layer, x, centerY(mRandom), std::max(-x, 0.0f) + reach(mRandom), 1);
+        }
+    }
+
+    void SceneGenerator::GenerateCarrySpills() {
+        // The layers start in the first four tiles of the rows so that all the following tiles
+        // receive a carry for each of them.
+        std::uniform_real_distribution<float> left(0.0f, float(4u << mParams.tileWidthShift));
+        for (uint32_t i = 0; i < mParams.count; i++) {
+            uint32_t layer = AddLayer(0.02f, 0.1f);
+            AddRect(layer, left(mRandom), 0.0f, float(mParams.width) + 1.0f, float(mParams.height), 1);
+        }
+    }
+
+} // namespace cassia
@@ -0,0 +1,89 @@
+#ifndef CASSIA_SCENEGENERATOR_H
+#define CASSIA_SCENEGENERATOR_H
+
+#include "Cassia.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace cassia {
+
+    enum class SceneKind {
+        // Random circles, each in its own layer.
+        Circles,
+        // Lines of small glyph-like shapes made of stems, bars and rings, a layer per line.
+        Glyphs,
+        // Layers that each cover the whole canvas, so that every tile only has carries.
+        Layers,
+        // Long horizontal bars on a canvas much wider than tall.
+        Wide,
+        // Large circles mostly left of the canvas, whose psegments are in the tile_x == -1 column.
+        OffscreenLeft,
+        // Layers that all start in the first tiles of every row and cover the rest of it, so that
+        // each row carries all the layers from tile to tile.
+        CarrySpills,
+    };
+
+    struct SceneParams {
+        SceneKind kind = SceneKind::Circles;
+        uint32_t width = 1000;
+        uint32_t height = 1000;
+        // The number of shapes, or of layers for Layers and CarrySpills.
+        uint32_t count = 1000;
+        uint32_t seed = 1;
+        // The tile size the psegments are encoded for, which must be the one of the cassia library
+        // that renders them, see cassia_get_tile_shifts.
+        uint32_t tileWidthShift = 3;
+        uint32_t tileHeightShift = 3;
+    };
+
+    struct GeneratedScene {
+        // Sorted by tile_y, tile_x then layer.
+        std::vector<uint64_t> psegments;
+        std::vector<CassiaStyling> stylings;
+    };
+
+    // Generates the psegments and stylings of synthetic scenes to measure how the rasterizers
+    // scale. The shapes are rasterized per row of pixels, with one edge at each end of the spans
+    // they cover, which gives the same psegments as outlines with vertical edges in each row.
+    class SceneGenerator {
+      public:
+        // Returns false if the canvas doesn't fit in the tile coordinates of the psegments or
+        // the scene has more layers than they can encode.
+        static bool Generate(const SceneParams& params, GeneratedScene* scene);
+
+        // The parameters that the kind is meant to be used with, like the wide canvas of Wide.
+        static SceneParams GetDefaultParams(SceneKind kind);
+        static bool ParseKind(const std::string& name, SceneKind* kind);
+        static const char* GetKindName(SceneKind kind);
+
+      private:
+        SceneGenerator(const SceneParams& params, GeneratedScene* scene);
+
+        uint32_t AddLayer(float minAlpha, float maxAlpha);
+        // Adds an edge that changes the winding of the pixels of row y right of x by cover, in
+        // 1/16th of a pixel.
+        void AddEdge(uint32_t layer, int32_t y, float x, int32_t cover);
+        // Covers [x0, x1) of row y. The cover is in 1/16th of the height of the row, and negative
+        // to cut holes in other shapes of the layer.
+        void AddSpan(uint32_t layer, int32_t y, float x0, float x1, int32_t cover);
+        void AddRect(uint32_t layer, float x0, float y0, float x1, float y1, int32_t winding);
+        void AddCircle(uint32_t layer, float centerX, float centerY, float radius, int32_t winding);
+
+        void GenerateCircles();
+        void GenerateGlyphs();
+        void GenerateLayers();
+        void GenerateWide();
+        void GenerateOffscreenLeft();
+        void GenerateCarrySpills();
+
+        const SceneParams& mParams;
+        GeneratedScene* mScene;
+        std::mt19937 mRandom;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_SCENEGENERATOR_H
@@ -0,0 +1,183 @@
+#include "SegmentCompactor.h"
+
+#include "CommonWGSL.h"
+#include "EncodingContext.h"
+
+#include "utils/WGPUHelpers.h"
+
+#include <string>
+
+namespace cassia {
+
+    namespace {
+        // The bits below the layer are stored for each psegment, the others once per run.
+        constexpr uint32_t kPayloadBits = PSEGMENT_LAYER_OFFSET;
+        constexpr uint64_t kPayloadMask = (uint64_t(1) << kPayloadBits) - 1;
+        static_assert(kPayloadBits < 32, "The payloads must fit in the low word of the psegments.");
+        static_assert(SegmentEncoding::kBlockSize <= kPayloadMask,
+                      "Run starts must be recoverable from their payload bits.");
+        static_assert(SegmentEncoding::kBlockSize == 4096 && SegmentEncoding::kRunWords == 2,
+                      "The expansion shader hardcodes the layout of the encoding.");
+
+        struct ConfigUniforms {
+            uint32_t count;
+            uint32_t runOffset;
+            uint32_t payloadOffset;
+            uint32_t padding;
+        };
+        static_assert(sizeof(ConfigUniforms) == 16, "");
+    }
+
+    SegmentCompactor::SegmentCompactor(wgpu::Device device, ResourcePool* pool)
+        : mDevice(std::move(device)), mQueue(mDevice.GetQueue()), mPool(pool), mEncoding(kPayloadBits) {
+        std::string code = "let PAYLOAD_BITS = " + std::to_string(kPayloadBits) + "u;\n" + R"(
+            struct PSegmentBits {
+                lo: u32;
+                hi: u32;
+            };
+
+            [[block]] struct Config {
+                count: u32;
+                runOffset: u32;
+                payloadOffset: u32;
+            };
+            [[group(0), binding(0)]] var<uniform> config : Config;
+
+            [[block]] struct Words {
+                data: array<u32>;
+            };
+            [[group(0), binding(1)]] var<storage> compact : Words;
+
+            [[block]] struct PSegments {
+                data: array<PSegmentBits>;
+            };
+            [[group(0), binding(2)]] var<storage, read_write> psegments : PSegments;
+
+            let WORKGROUP_SIZE = 256u;
+            let ITEMS_PER_THREAD = 16u;
+            let BLOCK_SIZE = 4096u; // WORKGROUP_SIZE * ITEMS_PER_THREAD
+            let RUN_WORDS = 2u;
+            let PAYLOAD_MASK = )" + std::to_string(kPayloadMask) + R"(u;
+
+            fn run_word(run: u32, word: u32) -> u32 {
+                return compact.data[config.runOffset + run * RUN_WORDS + word];
+            }
+
+            // The last run that starts at or before the psegment. The block table has the run of
+            // the first psegment of each block, the other runs up to the one of the next block
+            // start in (blockStart, blockStart + BLOCK_SIZE] so the low bits of their start are
+            // enough to recover it. SegmentEncoding::Decode mirrors this and load_payload.
+            fn find_run(index: u32, block: u32) -> u32 {
+                var blockStart = block * BLOCK_SIZE;
+                var low = compact.data[block];
+                var high = compact.data[block + 1u] + 1u;
+                loop {
+                    if (high - low <= 1u) {
+                        break;
+                    }
+                    var middle = (low + high) / 2u;
+                    var start = blockStart + ((run_word(middle, 0u) - blockStart) & PAYLOAD_MASK);
+                    if (start <= index) {
+                        low = middle;
+                    } else {
+                        high = middle;
+                    }
+                }
+                return low;
+            }
+
+            fn load_payload(index: u32) -> u32 {
+                // Each group of 32 payloads takes exactly PAYLOAD_BITS words, which avoids
+                // overflowing the bit offsets.
+                var bit = (index % 32u) * PAYLOAD_BITS;
+                var word = config.payloadOffset + (index / 32u) * PAYLOAD_BITS + bit / 32u;
+                var shift = bit % 32u;
+                var payload = compact.data[word] >> shift;
+                if (shift + PAYLOAD_BITS > 32u) {
+                    payload = payload | (compact.data[word + 1u] << (32u - shift));
+                }
+                return payload & PAYLOAD_MASK;
+            }
+
+            [[stage(compute), workgroup_size(WORKGROUP_SIZE)]]
+            fn expand([[builtin(workgroup_id)]] WorkgroupId : vec3<u32>,
+                      [[builtin(local_invocation_id)]] LocalId : vec3<u32>) {
+                var blockStart = WorkgroupId.x * BLOCK_SIZE;
+                for (var i = 0u; i < ITEMS_PER_THREAD; i = i + 1u) {
+                    var index = blockStart + i * WORKGROUP_SIZE + LocalId.x;
+                    if (index >= config.count) {
+                        return;
+                    }
+
+                    var run = find_run(index, WorkgroupId.x);
+                    var psegment : PSegmentBits;
+                    psegment.lo = (run_word(run, 0u) & ~PAYLOAD_MASK) | load_payload(index);
+                    psegment.hi = run_word(run, 1u);
+                    psegments.data[index] = psegment;
+                }
+            }
+        )";
+
+        wgpu::ComputePipelineDescriptor pDesc;
+        pDesc.label = "SegmentCompactor::mExpandPipeline";
+        pDesc.compute.module = utils::CreateShaderModule(mDevice, code.c_str());
+        pDesc.compute.entryPoint = "expand";
+        mExpandPipeline = mDevice.CreateComputePipeline(&pDesc);
+    }
+
+    bool SegmentCompactor::Upload(const uint64_t* psegments, size_t psegmentCount) {
+        mEncoding.Encode(psegments, psegmentCount);
+        if (psegmentCount == 0) {
+            return true;
+        }
+        if (mEncoding.GetSize() >= psegmentCount * sizeof(uint64_t)) {
+            return false;
+        }
+
+        const std::vector<uint32_t>& blockRuns = mEncoding.GetBlockRuns();
+        const std::vector<uint32_t>& runs = mEncoding.GetRuns();
+        const std::vector<uint32_t>& payloads = mEncoding.GetPayloads();
+        uint64_t blockRunsSize = blockRuns.size() * sizeof(uint32_t);
+        uint64_t runsSize = runs.size() * sizeof(uint32_t);
+        uint64_t payloadsSize = payloads.size() * sizeof(uint32_t);
+
+        mCompact = mPool->GetBuffer("SegmentCompactor::Compact", mEncoding.GetSize(),
+                wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst);
+        mQueue.WriteBuffer(mCompact, 0, blockRuns.data(), blockRunsSize);
+        mQueue.WriteBuffer(mCompact, blockRunsSize, runs.data(), runsSize);
+        mQueue.WriteBuffer(mCompact, blockRunsSize + runsSize, payloads.data(), payloadsSize);
+
+        mUniforms = mPool->GetBuffer("SegmentCompactor::Uniforms", sizeof(ConfigUniforms),
+                wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst);
+        ConfigUniforms uniformData = {
+            static_cast<uint32_t>(psegmentCount),
+            static_cast<uint32_t>(blockRuns.size()),
+            static_cast<uint32_t>(blockRuns.size() + runs.size()),
+            0,
+        };
+        mQueue.WriteBuffer(mUniforms, 0, &uniformData, sizeof(uniformData));
+        return true;
+    }
+
+    void SegmentCompactor::Expand(EncodingContext* context, const wgpu::Buffer& segments) {
+        size_t psegmentCount = mEncoding.GetPsegmentCount();
+        if (psegmentCount == 0) {
+            return;
+        }
+
+        if (mExpandBindGroup.IsStale({mUniforms.Get(), mCompact.Get(), segments.Get()})) {
+            mExpandBindGroup.Set(utils::MakeBindGroup(mDevice, mExpandPipeline.GetBindGroupLayout(0), {
+                {0, mUniforms, 0, sizeof(ConfigUniforms)},
+                {1, mCompact},
+                {2, segments},
+            }));
+        }
+
+        ScopedComputePass pass(context, "SegmentCompactor::Expand");
+        pass->SetBindGroup(0, mExpandBindGroup.Get());
+        pass->SetPipeline(mExpandPipeline);
+        pass->Dispatch(static_cast<uint32_t>(
+                (psegmentCount + SegmentEncoding::kBlockSize - 1) / SegmentEncoding::kBlockSize));
+    }
+
+} // namespace cassia
@@ -0,0 +1,49 @@
+#ifndef CASSIA_SEGMENTCOMPACTOR_H
+#define CASSIA_SEGMENTCOMPACTOR_H
+
+#include "ResourcePool.h"
+#include "SegmentEncoding.h"
+
+#include "webgpu/webgpu_cpp.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cassia {
+
+    class EncodingContext;
+
+    // Uploads psegments in a compact encoding and expands them back to PSegments on the GPU, to
+    // save upload bandwidth. Consecutive psegments usually share their tile and layer, so the
+    // bits from the layer up are stored once per run of psegments that have the same ones and the
+    // bits below it (local_x, local_y, area and cover) for each psegment, see SegmentEncoding.
+    // The expansion is lossless so the psegments don't need to be sorted, but unsorted ones have
+    // short runs and their encoding grows past the 8 bytes per psegment.
+    class SegmentCompactor {
+      public:
+        SegmentCompactor(wgpu::Device device, ResourcePool* pool);
+
+        // Encodes the psegments and writes them to a pooled buffer on the queue. Returns false
+        // without writing anything when the encoding isn't smaller than the psegments, which
+        // should then be uploaded as is.
+        bool Upload(const uint64_t* psegments, size_t psegmentCount);
+        // Records the expansion of the psegments of the last successful Upload to `segments`,
+        // which must have room for all of them.
+        void Expand(EncodingContext* context, const wgpu::Buffer& segments);
+
+      private:
+
+        wgpu::Device mDevice;
+        wgpu::Queue mQueue;
+        ResourcePool* mPool;
+        wgpu::ComputePipeline mExpandPipeline;
+        CachedBindGroup mExpandBindGroup;
+        wgpu::Buffer mCompact;
+        wgpu::Buffer mUniforms;
+        // The encoding of the last psegments, reused to avoid reallocations.
+        SegmentEncoding mEncoding;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_SEGMENTCOMPACTOR_H
@@ -0,0 +1,100 @@
+#include "SegmentEncoding.h"
+
+#include <cassert>
+
+namespace cassia {
+
+    constexpr uint32_t SegmentEncoding::kBlockSize;
+    constexpr uint32_t SegmentEncoding::kRunWords;
+
+    SegmentEncoding::SegmentEncoding(uint32_t payloadBits)
+        : mPayloadBits(payloadBits), mPayloadMask((uint64_t(1) << payloadBits) - 1) {
+        assert(payloadBits < 32 && kBlockSize <= mPayloadMask);
+    }
+
+    void SegmentEncoding::Encode(const uint64_t* psegments, size_t psegmentCount) {
+        mPsegmentCount = psegmentCount;
+        mBlockRuns.clear();
+        mRuns.clear();
+        mPayloads.assign((psegmentCount + 31) / 32 * mPayloadBits, 0);
+        if (psegmentCount == 0) {
+            return;
+        }
+
+        uint64_t runBits = 0;
+        for (size_t i = 0; i < psegmentCount; i++) {
+            uint64_t psegment = psegments[i];
+            uint64_t bits = psegment & ~mPayloadMask;
+            if (i == 0 || bits != runBits) {
+                runBits = bits;
+                mRuns.push_back(static_cast<uint32_t>(bits | (i & mPayloadMask)));
+                mRuns.push_back(static_cast<uint32_t>(bits >> 32));
+            }
+            if (i % kBlockSize == 0) {
+                mBlockRuns.push_back(static_cast<uint32_t>(mRuns.size() / kRunWords - 1));
+            }
+
+            uint32_t payload = static_cast<uint32_t>(psegment & mPayloadMask);
+            uint32_t bit = (i % 32) * mPayloadBits;
+            size_t word = (i / 32) * mPayloadBits + bit / 32;
+            uint32_t shift = bit % 32;
+            mPayloads[word] |= payload << shift;
+            if (shift + mPayloadBits > 32) {
+                mPayloads[word + 1] |= payload >> (32 - shift);
+            }
+        }
+        // The last block searches up to the last run.
+        mBlockRuns.push_back(static_cast<uint32_t>(mRuns.size() / kRunWords - 1));
+    }
+
+    uint64_t SegmentEncoding::Decode(size_t index) const {
+        // Mirrors find_run and load_payload, with the same u32 arithmetic.
+        uint32_t payloadMask = static_cast<uint32_t>(mPayloadMask);
+        uint32_t block = static_cast<uint32_t>(index / kBlockSize);
+        uint32_t blockStart = block * kBlockSize;
+        uint32_t low = mBlockRuns[block];
+        uint32_t high = mBlockRuns[block + 1] + 1;
+        while (high - low > 1) {
+            uint32_t middle = (low + high) / 2;
+            uint32_t start = blockStart + ((mRuns[middle * kRunWords] - blockStart) & payloadMask);
+            if (start <= index) {
+                low = middle;
+            } else {
+                high = middle;
+            }
+        }
+
+        uint32_t bit = (index % 32) * mPayloadBits;
+        size_t word = (index / 32) * mPayloadBits + bit / 32;
+        uint32_t shift = bit % 32;
+        uint32_t payload = mPayloads[word] >> shift;
+        if (shift + mPayloadBits > 32) {
+            payload |= mPayloads[word + 1] << (32 - shift);
+        }
+
+        uint32_t lo = (mRuns[low * kRunWords] & ~payloadMask) | (payload & payloadMask);
+        uint32_t hi = mRuns[low * kRunWords + 1];
+        return (uint64_t(hi) << 32) | lo;
+    }
+
+    size_t SegmentEncoding::GetPsegmentCount() const {
+        return mPsegmentCount;
+    }
+
+    uint64_t SegmentEncoding::GetSize() const {
+        return (mBlockRuns.size() + mRuns.size() + mPayloads.size()) * sizeof(uint32_t);
+    }
+
+    const std::vector<uint32_t>& SegmentEncoding::GetBlockRuns() const {
+        return mBlockRuns;
+    }
+
+    const std::vector<uint32_t>& SegmentEncoding::GetRuns() const {
+        return mRuns;
+    }
+
+    const std::vector<uint32_t>& SegmentEncoding::GetPayloads() const {
+        return mPayloads;
+    }
+
+} // namespace cassia
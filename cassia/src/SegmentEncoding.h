@@ -0,0 +1,53 @@
+#ifndef CASSIA_SEGMENTENCODING_H
+#define CASSIA_SEGMENTENCODING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cassia {
+
+    // The compact encoding of psegments that SegmentCompactor uploads and expands on the GPU. The
+    // low payloadBits of each psegment are stored for each of them, the other bits once per run of
+    // consecutive psegments that have the same ones:
+    //  - a u32 per block of kBlockSize psegments with the index of the run of its first psegment,
+    //    and one more with the index of the last run,
+    //  - two u32 per run, the low and high words of its psegments with the payload bits replaced
+    //    by the low bits of the index of its first psegment,
+    //  - the payload bits of each psegment packed back to back, so that each group of 32
+    //    psegments takes as many u32 as there are payload bits.
+    // It doesn't depend on the device or the tile size so that it can be checked on the host.
+    class SegmentEncoding {
+      public:
+        // The psegments expanded by a workgroup, which only searches the runs of its block.
+        static constexpr uint32_t kBlockSize = 4096;
+        static constexpr uint32_t kRunWords = 2;
+
+        // The payload bits must be less than 32 and leave room for kBlockSize in the run starts.
+        explicit SegmentEncoding(uint32_t payloadBits);
+
+        // Replaces the encoding with the one of the psegments, reusing its storage.
+        void Encode(const uint64_t* psegments, size_t psegmentCount);
+        // Decodes a psegment the same way as the expansion shader of SegmentCompactor.
+        uint64_t Decode(size_t index) const;
+
+        size_t GetPsegmentCount() const;
+        // The bytes of the three sections, which can be more than the psegments when they have
+        // short runs.
+        uint64_t GetSize() const;
+        const std::vector<uint32_t>& GetBlockRuns() const;
+        const std::vector<uint32_t>& GetRuns() const;
+        const std::vector<uint32_t>& GetPayloads() const;
+
+      private:
+        uint32_t mPayloadBits;
+        uint64_t mPayloadMask;
+        size_t mPsegmentCount = 0;
+        std::vector<uint32_t> mBlockRuns;
+        std::vector<uint32_t> mRuns;
+        std::vector<uint32_t> mPayloads;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_SEGMENTENCODING_H
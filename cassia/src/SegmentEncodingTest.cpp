@@ -0,0 +1,93 @@
+#include "SegmentEncoding.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Checks that decoding the compact upload encoding like the expansion shader gives back the
+// psegments, for the payload sizes of the tile sizes and across the block boundaries.
+namespace {
+
+    // Runs of psegments sharing their bits above the payload, with the given run lengths repeated
+    // until there are count psegments.
+    std::vector<uint64_t> MakePsegments(size_t count, uint32_t payloadBits, const std::vector<size_t>& runLengths,
+                                        uint32_t seed) {
+        std::mt19937_64 random(seed);
+        uint64_t payloadMask = (uint64_t(1) << payloadBits) - 1;
+
+        std::vector<uint64_t> psegments;
+        psegments.reserve(count);
+        for (size_t run = 0; psegments.size() < count; run++) {
+            uint64_t runBits = random() & ~payloadMask;
+            size_t length = runLengths[run % runLengths.size()];
+            for (size_t i = 0; i < length && psegments.size() < count; i++) {
+                psegments.push_back(runBits | (random() & payloadMask));
+            }
+        }
+        return psegments;
+    }
+
+    bool CheckRoundTrip(const std::string& name, const std::vector<uint64_t>& psegments, uint32_t payloadBits) {
+        cassia::SegmentEncoding encoding(payloadBits);
+        encoding.Encode(psegments.data(), psegments.size());
+        if (encoding.GetPsegmentCount() != psegments.size()) {
+            std::cerr << name << ": encoded " << encoding.GetPsegmentCount() << " psegments instead of "
+                      << psegments.size() << std::endl;
+            return false;
+        }
+
+        for (size_t i = 0; i < psegments.size(); i++) {
+            uint64_t decoded = encoding.Decode(i);
+            if (decoded != psegments[i]) {
+                std::cerr << name << ": psegment " << i << " decoded as 0x" << std::hex << decoded
+                          << " instead of 0x" << psegments[i] << std::dec << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // anonymous namespace
+
+int main() {
+    constexpr size_t kBlockSize = cassia::SegmentEncoding::kBlockSize;
+
+    bool success = true;
+    // The payload bits of the 8x8 and 16x4 tiles, then of the 16x16 tiles.
+    for (uint32_t payloadBits : {22u, 24u}) {
+        std::string bits = std::to_string(payloadBits) + " bits";
+
+        success = CheckRoundTrip("single psegment, " + bits, MakePsegments(1, payloadBits, {1}, 1), payloadBits) &&
+                  success;
+        for (size_t count : {size_t(31), size_t(32), size_t(33), kBlockSize - 1, kBlockSize, kBlockSize + 1}) {
+            success = CheckRoundTrip(std::to_string(count) + " psegments, " + bits,
+                                     MakePsegments(count, payloadBits, {1, 7, 3}, 2), payloadBits) &&
+                      success;
+        }
+
+        // Runs that end right before, at and after the block boundaries, and runs spanning
+        // several blocks.
+        success = CheckRoundTrip("runs at block boundaries, " + bits,
+                                 MakePsegments(8 * kBlockSize, payloadBits, {kBlockSize - 1, 1, kBlockSize, 2}, 3),
+                                 payloadBits) &&
+                  success;
+        success = CheckRoundTrip("runs spanning blocks, " + bits,
+                                 MakePsegments(10 * kBlockSize + 5, payloadBits, {3 * kBlockSize + 1, 5}, 4),
+                                 payloadBits) &&
+                  success;
+
+        // Past 2^payloadBits psegments the run starts wrap around in their payload bits.
+        size_t manyCount = (size_t(1) << payloadBits) + 3 * kBlockSize + 17;
+        success = CheckRoundTrip("more than 2^" + std::to_string(payloadBits) + " psegments",
+                                 MakePsegments(manyCount, payloadBits, {1, 2, 40, 1000, kBlockSize + 3}, 5),
+                                 payloadBits) &&
+                  success;
+    }
+
+    if (!success) {
+        return 1;
+    }
+    std::cout << "The segment encoding round-trips." << std::endl;
+    return 0;
+}
@@ -0,0 +1,228 @@
+#ifndef CASSIA_SIMDF32X8_H
+#define CASSIA_SIMDF32X8_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Minimal 8-wide float and int vectors for the CpuRasterizer. The implementation is chosen based
+// on the instruction sets the including file is compiled for, and is put in a namespace specific
+// to that implementation so that files compiled for different instruction sets can be linked in
+// the same library.
+#if defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+#define CASSIA_SIMD_AVX2
+#define CASSIA_SIMD_NAMESPACE simd_avx2
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define CASSIA_SIMD_NEON
+#define CASSIA_SIMD_NAMESPACE simd_neon
+#include <arm_neon.h>
+#else
+#define CASSIA_SIMD_SCALAR
+#define CASSIA_SIMD_NAMESPACE simd_scalar
+#endif
+
+namespace cassia {
+namespace CASSIA_SIMD_NAMESPACE {
+
+#if defined(CASSIA_SIMD_AVX2)
+
+    struct Mask8 {
+        __m256 v;
+    };
+    struct F32x8 {
+        __m256 v;
+    };
+    struct I32x8 {
+        __m256i v;
+    };
+
+    inline F32x8 Splat(float f) { return {_mm256_set1_ps(f)}; }
+    inline F32x8 operator+(F32x8 a, F32x8 b) { return {_mm256_add_ps(a.v, b.v)}; }
+    inline F32x8 operator-(F32x8 a, F32x8 b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    inline F32x8 operator*(F32x8 a, F32x8 b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    inline F32x8 operator/(F32x8 a, F32x8 b) { return {_mm256_div_ps(a.v, b.v)}; }
+    // a * b + c with a single rounding.
+    inline F32x8 Fma(F32x8 a, F32x8 b, F32x8 c) { return {_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+    inline F32x8 Min(F32x8 a, F32x8 b) { return {_mm256_min_ps(a.v, b.v)}; }
+    inline F32x8 Max(F32x8 a, F32x8 b) { return {_mm256_max_ps(a.v, b.v)}; }
+    inline F32x8 Abs(F32x8 a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+    inline F32x8 Sqrt(F32x8 a) { return {_mm256_sqrt_ps(a.v)}; }
+    inline Mask8 operator<=(F32x8 a, F32x8 b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+    inline Mask8 operator==(F32x8 a, F32x8 b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)}; }
+    // Lanes of ifTrue where mask is set, of ifFalse otherwise.
+    inline F32x8 Select(Mask8 mask, F32x8 ifTrue, F32x8 ifFalse) {
+        return {_mm256_blendv_ps(ifFalse.v, ifTrue.v, mask.v)};
+    }
+    // Stores the 8 values as half floats, rounded to nearest even.
+    inline void StoreHalf(F32x8 a, uint16_t* out) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_cvtps_ph(a.v, _MM_FROUND_TO_NEAREST_INT));
+    }
+
+    inline I32x8 SplatI(int32_t i) { return {_mm256_set1_epi32(i)}; }
+    inline I32x8 LoadI(const int32_t* p) { return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))}; }
+    inline void StoreI(I32x8 a, int32_t* p) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v); }
+    inline I32x8 operator+(I32x8 a, I32x8 b) { return {_mm256_add_epi32(a.v, b.v)}; }
+    inline I32x8 operator&(I32x8 a, I32x8 b) { return {_mm256_and_si256(a.v, b.v)}; }
+    template <int N> inline I32x8 ShiftLeft(I32x8 a) { return {_mm256_slli_epi32(a.v, N)}; }
+    template <int N> inline I32x8 ShiftRightArithmetic(I32x8 a) { return {_mm256_srai_epi32(a.v, N)}; }
+    inline Mask8 operator==(I32x8 a, I32x8 b) { return {_mm256_castsi256_ps(_mm256_cmpeq_epi32(a.v, b.v))}; }
+    inline F32x8 ToFloat(I32x8 a) { return {_mm256_cvtepi32_ps(a.v)}; }
+    inline bool AnyNonZero(I32x8 a) { return !_mm256_testz_si256(a.v, a.v); }
+
+#elif defined(CASSIA_SIMD_NEON)
+
+    struct Mask8 {
+        uint32x4_t lo, hi;
+    };
+    struct F32x8 {
+        float32x4_t lo, hi;
+    };
+    struct I32x8 {
+        int32x4_t lo, hi;
+    };
+
+    inline F32x8 Splat(float f) { return {vdupq_n_f32(f), vdupq_n_f32(f)}; }
+    inline F32x8 operator+(F32x8 a, F32x8 b) { return {vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi)}; }
+    inline F32x8 operator-(F32x8 a, F32x8 b) { return {vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi)}; }
+    inline F32x8 operator*(F32x8 a, F32x8 b) { return {vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi)}; }
+    inline F32x8 operator/(F32x8 a, F32x8 b) { return {vdivq_f32(a.lo, b.lo), vdivq_f32(a.hi, b.hi)}; }
+    // a * b + c with a single rounding.
+    inline F32x8 Fma(F32x8 a, F32x8 b, F32x8 c) {
+        return {vfmaq_f32(c.lo, a.lo, b.lo), vfmaq_f32(c.hi, a.hi, b.hi)};
+    }
+    inline F32x8 Min(F32x8 a, F32x8 b) { return {vminq_f32(a.lo, b.lo), vminq_f32(a.hi, b.hi)}; }
+    inline F32x8 Max(F32x8 a, F32x8 b) { return {vmaxq_f32(a.lo, b.lo), vmaxq_f32(a.hi, b.hi)}; }
+    inline F32x8 Abs(F32x8 a) { return {vabsq_f32(a.lo), vabsq_f32(a.hi)}; }
+    inline F32x8 Sqrt(F32x8 a) { return {vsqrtq_f32(a.lo), vsqrtq_f32(a.hi)}; }
+    inline Mask8 operator<=(F32x8 a, F32x8 b) { return {vcleq_f32(a.lo, b.lo), vcleq_f32(a.hi, b.hi)}; }
+    inline Mask8 operator==(F32x8 a, F32x8 b) { return {vceqq_f32(a.lo, b.lo), vceqq_f32(a.hi, b.hi)}; }
+    // Lanes of ifTrue where mask is set, of ifFalse otherwise.
+    inline F32x8 Select(Mask8 mask, F32x8 ifTrue, F32x8 ifFalse) {
+        return {vbslq_f32(mask.lo, ifTrue.lo, ifFalse.lo), vbslq_f32(mask.hi, ifTrue.hi, ifFalse.hi)};
+    }
+    // Stores the 8 values as half floats, rounded to nearest even.
+    inline void StoreHalf(F32x8 a, uint16_t* out) {
+        vst1_u16(out, vreinterpret_u16_f16(vcvt_f16_f32(a.lo)));
+        vst1_u16(out + 4, vreinterpret_u16_f16(vcvt_f16_f32(a.hi)));
+    }
+
+    inline I32x8 SplatI(int32_t i) { return {vdupq_n_s32(i), vdupq_n_s32(i)}; }
+    inline I32x8 LoadI(const int32_t* p) { return {vld1q_s32(p), vld1q_s32(p + 4)}; }
+    inline void StoreI(I32x8 a, int32_t* p) {
+        vst1q_s32(p, a.lo);
+        vst1q_s32(p + 4, a.hi);
+    }
+    inline I32x8 operator+(I32x8 a, I32x8 b) { return {vaddq_s32(a.lo, b.lo), vaddq_s32(a.hi, b.hi)}; }
+    inline I32x8 operator&(I32x8 a, I32x8 b) { return {vandq_s32(a.lo, b.lo), vandq_s32(a.hi, b.hi)}; }
+    template <int N> inline I32x8 ShiftLeft(I32x8 a) { return {vshlq_n_s32(a.lo, N), vshlq_n_s32(a.hi, N)}; }
+    template <int N> inline I32x8 ShiftRightArithmetic(I32x8 a) {
+        return {vshrq_n_s32(a.lo, N), vshrq_n_s32(a.hi, N)};
+    }
+    inline Mask8 operator==(I32x8 a, I32x8 b) { return {vceqq_s32(a.lo, b.lo), vceqq_s32(a.hi, b.hi)}; }
+    inline F32x8 ToFloat(I32x8 a) { return {vcvtq_f32_s32(a.lo), vcvtq_f32_s32(a.hi)}; }
+    inline bool AnyNonZero(I32x8 a) {
+        return vmaxvq_u32(vreinterpretq_u32_s32(vorrq_s32(a.lo, a.hi))) != 0;
+    }
+
+#else // defined(CASSIA_SIMD_SCALAR)
+
+    struct Mask8 {
+        bool v[8];
+    };
+    struct F32x8 {
+        float v[8];
+    };
+    struct I32x8 {
+        int32_t v[8];
+    };
+
+#define CASSIA_SIMD_LANES(result, expression) \
+    for (int i = 0; i < 8; i++) {             \
+        result.v[i] = expression;             \
+    }
+
+    inline F32x8 Splat(float f) { F32x8 r; CASSIA_SIMD_LANES(r, f); return r; }
+    inline F32x8 operator+(F32x8 a, F32x8 b) { F32x8 r; CASSIA_SIMD_LANES(r, a.v[i] + b.v[i]); return r; }
+    inline F32x8 operator-(F32x8 a, F32x8 b) { F32x8 r; CASSIA_SIMD_LANES(r, a.v[i] - b.v[i]); return r; }
+    inline F32x8 operator*(F32x8 a, F32x8 b) { F32x8 r; CASSIA_SIMD_LANES(r, a.v[i] * b.v[i]); return r; }
+    inline F32x8 operator/(F32x8 a, F32x8 b) { F32x8 r; CASSIA_SIMD_LANES(r, a.v[i] / b.v[i]); return r; }
+    // a * b + c with a single rounding.
+    inline F32x8 Fma(F32x8 a, F32x8 b, F32x8 c) { F32x8 r; CASSIA_SIMD_LANES(r, std::fma(a.v[i], b.v[i], c.v[i])); return r; }
+    inline F32x8 Min(F32x8 a, F32x8 b) { F32x8 r; CASSIA_SIMD_LANES(r, a.v[i] < b.v[i] ? a.v[i] : b.v[i]); return r; }
+    inline F32x8 Max(F32x8 a, F32x8 b) { F32x8 r; CASSIA_SIMD_LANES(r, a.v[i] > b.v[i] ? a.v[i] : b.v[i]); return r; }
+    inline F32x8 Abs(F32x8 a) { F32x8 r; CASSIA_SIMD_LANES(r, std::fabs(a.v[i])); return r; }
+    inline F32x8 Sqrt(F32x8 a) { F32x8 r; CASSIA_SIMD_LANES(r, std::sqrt(a.v[i])); return r; }
+    inline Mask8 operator<=(F32x8 a, F32x8 b) { Mask8 r; CASSIA_SIMD_LANES(r, a.v[i] <= b.v[i]); return r; }
+    inline Mask8 operator==(F32x8 a, F32x8 b) { Mask8 r; CASSIA_SIMD_LANES(r, a.v[i] == b.v[i]); return r; }
+    // Lanes of ifTrue where mask is set, of ifFalse otherwise.
+    inline F32x8 Select(Mask8 mask, F32x8 ifTrue, F32x8 ifFalse) {
+        F32x8 r;
+        CASSIA_SIMD_LANES(r, mask.v[i] ? ifTrue.v[i] : ifFalse.v[i]);
+        return r;
+    }
+
+    // Rounds to nearest even, like the hardware conversions.
+    inline uint16_t FloatToHalf(float f) {
+        constexpr uint32_t kF32Infinity = 255u << 23;
+        constexpr uint32_t kF16Max = (127u + 16u) << 23;
+        constexpr uint32_t kDenormMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+        constexpr uint32_t kMinNormal = 113u << 23;
+
+        uint32_t x;
+        memcpy(&x, &f, sizeof(x));
+        uint32_t sign = x & 0x80000000u;
+        x ^= sign;
+
+        uint16_t half;
+        if (x >= kF16Max) {
+            half = x > kF32Infinity ? 0x7E00 : 0x7C00;
+        } else if (x < kMinNormal) {
+            // Let the float addition do the rounding of denormals.
+            float magic;
+            memcpy(&magic, &kDenormMagic, sizeof(magic));
+            float shifted;
+            memcpy(&shifted, &x, sizeof(shifted));
+            shifted += magic;
+            uint32_t bits;
+            memcpy(&bits, &shifted, sizeof(bits));
+            half = uint16_t(bits - kDenormMagic);
+        } else {
+            uint32_t mantissaOdd = (x >> 13) & 1;
+            x += ((15u - 127u) << 23) + 0xFFFu + mantissaOdd;
+            half = uint16_t(x >> 13);
+        }
+        return half | uint16_t(sign >> 16);
+    }
+    // Stores the 8 values as half floats, rounded to nearest even.
+    inline void StoreHalf(F32x8 a, uint16_t* out) {
+        for (int i = 0; i < 8; i++) {
+            out[i] = FloatToHalf(a.v[i]);
+        }
+    }
+
+    inline I32x8 SplatI(int32_t s) { I32x8 r; CASSIA_SIMD_LANES(r, s); return r; }
+    inline I32x8 LoadI(const int32_t* p) { I32x8 r; CASSIA_SIMD_LANES(r, p[i]); return r; }
+    inline void StoreI(I32x8 a, int32_t* p) { memcpy(p, a.v, sizeof(a.v)); }
+    inline I32x8 operator+(I32x8 a, I32x8 b) { I32x8 r; CASSIA_SIMD_LANES(r, a.v[i] + b.v[i]); return r; }
+    inline I32x8 operator&(I32x8 a, I32x8 b) { I32x8 r; CASSIA_SIMD_LANES(r, a.v[i] & b.v[i]); return r; }
+    template <int N> inline I32x8 ShiftLeft(I32x8 a) { I32x8 r; CASSIA_SIMD_LANES(r, int32_t(uint32_t(a.v[i]) << N)); return r; }
+    template <int N> inline I32x8 ShiftRightArithmetic(I32x8 a) { I32x8 r; CASSIA_SIMD_LANES(r, a.v[i] >> N); return r; }
+    inline Mask8 operator==(I32x8 a, I32x8 b) { Mask8 r; CASSIA_SIMD_LANES(r, a.v[i] == b.v[i]); return r; }
+    inline F32x8 ToFloat(I32x8 a) { F32x8 r; CASSIA_SIMD_LANES(r, float(a.v[i])); return r; }
+    inline bool AnyNonZero(I32x8 a) {
+        int32_t any = 0;
+        for (int i = 0; i < 8; i++) {
+            any |= a.v[i];
+        }
+        return any != 0;
+    }
+
+#undef CASSIA_SIMD_LANES
+
+#endif
+
+} // namespace CASSIA_SIMD_NAMESPACE
+} // namespace cassia
+
+#endif // CASSIA_SIMDF32X8_H
@@ -0,0 +1,131 @@
+#include "StagingRing.h"
+
+#include "EncodingContext.h"
+
+#include <algorithm>
+
+namespace cassia {
+
+    namespace {
+        // Enough to have a buffer being written by the CPU while the previous ones are in flight.
+        constexpr size_t kMaxStagingBuffers = 3;
+    }
+
+    StagingRing::StagingRing(wgpu::Device device) : mDevice(std::move(device)) {
+    }
+
+    StagingRing::~StagingRing() {
+        // Destroying the buffers calls the pending map callbacks while the entries are alive.
+        for (auto& entry : mEntries) {
+            entry->buffer.Destroy();
+        }
+    }
+
+    void* StagingRing::Acquire(uint64_t size) {
+        if (mAcquired != nullptr) {
+            return nullptr;
+        }
+        size = std::max((size + 3) & ~uint64_t(3), uint64_t(4));
+
+        Entry* entry = FindMapped(size);
+        while (entry == nullptr && HasMapping(size)) {
+            // A large enough buffer will be available as soon as the GPU is done with it.
+            mDevice.Tick();
+            entry = FindMapped(size);
+        }
+
+        if (entry == nullptr && mEntries.size() < kMaxStagingBuffers) {
+            entry = CreateEntry(nullptr, size);
+        }
+
+        // All the buffers are too small, replace one of them with a larger one.
+        while (entry == nullptr) {
+            for (auto& candidate : mEntries) {
+                if (candidate->state == State::Mapped || candidate->state == State::Lost) {
+                    entry = CreateEntry(candidate.get(), size);
+                    break;
+                }
+            }
+            if (entry == nullptr) {
+                mDevice.Tick();
+            }
+        }
+
+        entry->state = State::Acquired;
+        mAcquired = entry;
+        return entry->buffer.GetMappedRange(0, entry->size);
+    }
+
+    bool StagingRing::Commit(EncodingContext* context, uint64_t size, const wgpu::Buffer& destination) {
+        if (mAcquired == nullptr || size > mAcquired->size) {
+            return false;
+        }
+
+        mAcquired->buffer.Unmap();
+        mAcquired->state = State::InFlight;
+        if (size != 0) {
+            context->GetEncoder().CopyBufferToBuffer(mAcquired->buffer, 0, destination, 0, size);
+        }
+
+        mCommitted = mAcquired;
+        mAcquired = nullptr;
+        return true;
+    }
+
+    void StagingRing::OnSubmitted() {
+        if (mCommitted == nullptr) {
+            return;
+        }
+
+        mCommitted->state = State::Mapping;
+        mCommitted->buffer.MapAsync(wgpu::MapMode::Write, 0, mCommitted->size, [](WGPUBufferMapAsyncStatus status, void* userdata) {
+            Entry* entry = static_cast<Entry*>(userdata);
+            entry->state = status == WGPUBufferMapAsyncStatus_Success ? State::Mapped : State::Lost;
+        }, mCommitted);
+        mCommitted = nullptr;
+    }
+
+    StagingRing::Entry* StagingRing::FindMapped(uint64_t size) {
+        // Prefer the smallest buffer that fits to keep the large ones for large frames.
+        Entry* best = nullptr;
+        for (auto& entry : mEntries) {
+            if (entry->state == State::Mapped && entry->size >= size &&
+                (best == nullptr || entry->size < best->size)) {
+                best = entry.get();
+            }
+        }
+        return best;
+    }
+
+    bool StagingRing::HasMapping(uint64_t size) const {
+        for (const auto& entry : mEntries) {
+            if (entry->state == State::Mapping && entry->size >= size) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    StagingRing::Entry* StagingRing::CreateEntry(Entry* replaced, uint64_t size) {
+        Entry* entry = replaced;
+        if (entry == nullptr) {
+            mEntries.push_back(std::make_unique<Entry>());
+            entry = mEntries.back().get();
+        } else {
+            // Grow geometrically so that slowly growing scenes don't recreate buffers every frame.
+            size = std::max(size, entry->size * 2);
+            entry->buffer.Destroy();
+        }
+
+        wgpu::BufferDescriptor desc;
+        desc.label = "StagingRing buffer";
+        desc.size = size;
+        desc.usage = wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc;
+        desc.mappedAtCreation = true;
+        entry->buffer = mDevice.CreateBuffer(&desc);
+        entry->size = size;
+        entry->state = State::Mapped;
+        return entry;
+    }
+
+} // namespace cassia
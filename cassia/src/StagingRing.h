@@ -0,0 +1,57 @@
+#ifndef CASSIA_STAGINGRING_H
+#define CASSIA_STAGINGRING_H
+
+#include "webgpu/webgpu_cpp.h"
+
+#include <memory>
+#include <vector>
+
+namespace cassia {
+
+    class EncodingContext;
+
+    // A small ring of MapWrite staging buffers that are handed out mapped so that producers can
+    // write their data directly in GPU-visible memory. Buffers are remapped asynchronously once
+    // the copy out of them has been submitted.
+    class StagingRing {
+      public:
+        StagingRing(wgpu::Device device);
+        ~StagingRing();
+
+        // Returns a pointer to at least `size` bytes of mapped memory. Only one span can be
+        // acquired at a time and it stays valid until Commit.
+        void* Acquire(uint64_t size);
+        // Unmaps the acquired span and records a copy of its first `size` bytes to `destination`.
+        // Returns false if nothing was acquired or if `size` is larger than the acquired span.
+        bool Commit(EncodingContext* context, uint64_t size, const wgpu::Buffer& destination);
+        // Starts mapping the committed buffer again, must be called after the copy is submitted.
+        void OnSubmitted();
+
+      private:
+        enum class State {
+            Mapped,
+            Acquired,
+            InFlight,
+            Mapping,
+            // The remapping failed, the buffer can only be replaced.
+            Lost,
+        };
+        struct Entry {
+            wgpu::Buffer buffer;
+            uint64_t size;
+            State state;
+        };
+
+        Entry* FindMapped(uint64_t size);
+        bool HasMapping(uint64_t size) const;
+        Entry* CreateEntry(Entry* replaced, uint64_t size);
+
+        wgpu::Device mDevice;
+        std::vector<std::unique_ptr<Entry>> mEntries;
+        Entry* mAcquired = nullptr;
+        Entry* mCommitted = nullptr;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_STAGINGRING_H
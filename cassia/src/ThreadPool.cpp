@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace cassia {
+
+    ThreadPool::ThreadPool(size_t threadCount) {
+        if (threadCount == 0) {
+            threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        // The calling thread is one of the threads doing the work.
+        for (size_t i = 1; i < threadCount; i++) {
+            mWorkers.emplace_back([this]() { WorkerMain(); });
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mExiting = true;
+        }
+        mWorkAvailable.notify_all();
+        for (std::thread& worker : mWorkers) {
+            worker.join();
+        }
+    }
+
+    size_t ThreadPool::GetThreadCount() const {
+        return mWorkers.size() + 1;
+    }
+
+    void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& body) {
+        if (count == 0) {
+            return;
+        }
+        if (count == 1 || mWorkers.empty()) {
+            for (size_t i = 0; i < count; i++) {
+                body(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mBody = &body;
+            mCount = count;
+            mNextIndex = 0;
+            mBusyWorkers = mWorkers.size();
+            mGeneration++;
+        }
+        mWorkAvailable.notify_all();
+
+        RunIterations();
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWorkDone.wait(lock, [this]() { return mBusyWorkers == 0; });
+        mBody = nullptr;
+    }
+
+    void ThreadPool::WorkerMain() {
+        uint64_t seenGeneration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWorkAvailable.wait(lock, [&]() { return mExiting || mGeneration != seenGeneration; });
+                if (mExiting) {
+                    return;
+                }
+                seenGeneration = mGeneration;
+            }
+
+            RunIterations();
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mBusyWorkers--;
+            }
+            mWorkDone.notify_one();
+        }
+    }
+
+    void ThreadPool::RunIterations() {
+        while (true) {
+            size_t index = mNextIndex.fetch_add(1, std::memory_order_relaxed);
+            if (index >= mCount) {
+                return;
+            }
+            (*mBody)(index);
+        }
+    }
+
+} // namespace cassia
@@ -0,0 +1,47 @@
+#ifndef CASSIA_THREADPOOL_H
+#define CASSIA_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cassia {
+
+    // A fixed set of worker threads running parallel loops. Iterations are handed out one at a
+    // time from a shared counter so that threads that finish early take over the remaining work.
+    class ThreadPool {
+      public:
+        // A threadCount of 0 uses one thread per hardware thread, including the caller's.
+        ThreadPool(size_t threadCount = 0);
+        ~ThreadPool();
+
+        size_t GetThreadCount() const;
+
+        // Calls body(i) for every i in [0, count) and returns once all of them are done. The
+        // calling thread takes part in the work. Not reentrant.
+        void ParallelFor(size_t count, const std::function<void(size_t)>& body);
+
+      private:
+        void WorkerMain();
+        void RunIterations();
+
+        std::vector<std::thread> mWorkers;
+
+        std::mutex mMutex;
+        std::condition_variable mWorkAvailable;
+        std::condition_variable mWorkDone;
+        bool mExiting = false;
+        uint64_t mGeneration = 0;
+        size_t mBusyWorkers = 0;
+
+        const std::function<void(size_t)>* mBody = nullptr;
+        size_t mCount = 0;
+        std::atomic<size_t> mNextIndex{0};
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_THREADPOOL_H
@@ -0,0 +1,797 @@
+#include "TileParallelRasterizer.h"
+
+#include "CommonWGSL.h"
+#include "EncodingContext.h"
+
+#include "utils/WGPUHelpers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace cassia {
+
+    namespace {
+        struct ConfigUniforms {
+            uint32_t width;
+            uint32_t height;
+            uint32_t widthInTiles;
+            uint32_t heightInTiles;
+            uint32_t segmentCount;
+            uint32_t stylingCount;
+            uint32_t runCapacity;
+            uint32_t slotMask;
+            uint32_t tileXShift;
+            uint32_t layerShift;
+            uint32_t tileYShift;
+            uint32_t tileRunCapacity;
+            uint32_t tileRunLayerShift;
+            uint32_t tileRunTileXShift;
+            uint32_t tileRunTileYShift;
+            uint32_t padding;
+        };
+        static_assert(sizeof(ConfigUniforms) == 64, "");
+
+        constexpr uint64_t kSizeofRun = 5 * sizeof(uint32_t);
+        constexpr uint64_t kSizeofRunCovers = TILE_HEIGHT * sizeof(int32_t);
+        // The run covers and the tile run keys are the largest buffers of their passes.
+        constexpr uint64_t kMaxRunCapacity = kMaxStorageBufferBindingSize / kSizeofRunCovers;
+        constexpr uint64_t kMaxTileRunCapacity = kMaxStorageBufferBindingSize / sizeof(uint64_t);
+
+        // The number of bits needed to store the values in [0, valueCount).
+        uint32_t BitsFor(uint64_t valueCount) {
+            uint32_t bits = 0;
+            while (bits < 64 && (uint64_t(1) << bits) < valueCount) {
+                bits++;
+            }
+            return bits;
+        }
+    }
+
+    TileParallelRasterizer::TileParallelRasterizer(wgpu::Device device, ResourcePool* pool)
+        : mDevice(std::move(device)),
+          mPool(pool),
+          mRunSorter(mDevice, pool, "TileParallelRasterizer::RunSorter"),
+          mTileRunSorter(mDevice, pool, "TileParallelRasterizer::TileRunSorter"),
+          mStatsReadback(mDevice, "TileParallelRasterizer::mStatsReadback", 2 * sizeof(uint32_t),
+                         [this](const void* data) { OnStatsRead(data); }) {
+        std::string code = std::string(kPSegmentWGSL) + std::string(kStylingWGSL) + R"(
+            [[block]] struct Config {
+                width: u32;
+                height: u32;
+                widthInTiles: u32;
+                heightInTiles: u32;
+                segmentCount: u32;
+                stylingCount: u32;
+                runCapacity: u32;
+                slotMask: u32;
+                tileXShift: u32;
+                layerShift: u32;
+                tileYShift: u32;
+                tileRunCapacity: u32;
+                tileRunLayerShift: u32;
+                tileRunTileXShift: u32;
+                tileRunTileYShift: u32;
+            };
+            [[group(0), binding(0)]] var<uniform> config : Config;
+
+            [[block]] struct PSegments {
+                data: array<PSegment>;
+            };
+            [[group(0), binding(1)]] var<storage> segments : PSegments;
+
+            type CarryCovers = array<i32, TILE_HEIGHT>;
+
+            ///////////////////////////////////////////////////////////////////
+            //  Runs
+            ///////////////////////////////////////////////////////////////////
+
+            // A run is the psegments of a tile that have the same layer. Runs are sorted by tile_y,
+            // layer then tile_x so that the runs of a layer in a row of tiles are contiguous.
+            struct Run {
+                start: u32;
+                end: u32; // Exclusive
+                tile: u32; // (tile_x + 1) | (tile_y << 16)
+                layer: u32;
+                // The tile_x of the next run of the same row and layer, or widthInTiles.
+                nextTileX: i32;
+            };
+            [[block]] struct Runs {
+                data: array<Run>;
+            };
+            [[group(0), binding(3)]] var<storage, read_write> runs : Runs;
+
+            // The covers of each row of the run, replaced by their inclusive prefix sum along the
+            // row of tiles, which is the carry out of the run's tile.
+            [[block]] struct RunCovers {
+                data: array<CarryCovers>;
+            };
+            [[group(0), binding(4)]] var<storage, read_write> runCovers : RunCovers;
+
+            [[block]] struct Counters {
+                runCount: atomic<u32>;
+            };
+            [[group(0), binding(2)]] var<storage, read_write> counters : Counters;
+
+            // The run's slot in the low bits and the tile_y, layer and tile_x + 1 above it.
+            struct RunKey {
+                lo: u32;
+                hi: u32;
+            };
+            [[block]] struct RunKeys {
+                data: array<RunKey>;
+            };
+            [[group(0), binding(5)]] var<storage, read_write> runKeys : RunKeys;
+            [[group(0), binding(6)]] var<storage> sortedRunKeys : RunKeys;
+
+            // A tile run is the sorted position of a run that contributes to a tile, either
+            // because it is in the tile or because it carries a cover to it. The position is in the
+            // low bits of the key and the layer, tile_x and tile_y above it.
+            [[block]] struct TileRunCounter {
+                count: atomic<u32>;
+            };
+            [[group(0), binding(10)]] var<storage, read_write> tileRunCounter : TileRunCounter;
+            [[group(0), binding(11)]] var<storage, read_write> tileRunKeys : RunKeys;
+            [[group(0), binding(12)]] var<storage> sortedTileRunKeys : RunKeys;
+
+            struct Range {
+                start: u32;
+                end: u32; // Exclusive
+            };
+            // The range of sorted tile runs of each tile, at tile_x + tile_y * widthInTiles.
+            [[block]] struct TileRanges {
+                data: array<Range>;
+            };
+            [[group(0), binding(7)]] var<storage, read_write> tileRanges : TileRanges;
+
+            fn run_tile_x(run: Run) -> i32 {
+                return i32(run.tile & 0xFFFFu) - 1;
+            }
+            fn run_tile_y(run: Run) -> u32 {
+                return run.tile >> 16u;
+            }
+            fn run_count() -> u32 {
+                return min(atomicLoad(&counters.runCount), config.runCapacity);
+            }
+            fn tile_run_count() -> u32 {
+                return min(atomicLoad(&tileRunCounter.count), config.tileRunCapacity);
+            }
+            fn key_slot(key: RunKey) -> u32 {
+                return key.lo & config.slotMask;
+            }
+            fn key_get_field(key: RunKey, shift: u32, width: u32) -> u32 {
+                var value = 0u;
+                if (shift >= 32u) {
+                    value = key.hi >> (shift - 32u);
+                } else {
+                    value = key.lo >> shift;
+                    if (shift > 0u) {
+                        value = value | (key.hi << (32u - shift));
+                    }
+                }
+                return value & ((1u << width) - 1u);
+            }
+            fn key_add_field(key: ptr<function, RunKey, read_write>, value: u32, shift: u32) {
+                if (shift >= 32u) {
+                    (*key).hi = (*key).hi | (value << (shift - 32u));
+                    return;
+                }
+                (*key).lo = (*key).lo | (value << shift);
+                if (shift > 0u) {
+                    (*key).hi = (*key).hi | (value >> (32u - shift));
+                }
+            }
+
+            // The counters and the tile ranges are reused across frames so they need to be reset.
+            [[stage(compute), workgroup_size(256)]]
+            fn clearRuns([[builtin(global_invocation_id)]] GlobalId : vec3<u32>) {
+                if (GlobalId.x == 0u) {
+                    atomicStore(&counters.runCount, 0u);
+                    atomicStore(&tileRunCounter.count, 0u);
+                }
+                if (GlobalId.x < config.widthInTiles * config.heightInTiles) {
+                    tileRanges.data[GlobalId.x] = Range(0u, 0u);
+                }
+            }
+
+            fn run_segment_is_valid(segment: PSegment) -> bool {
+                var tileX = psegment_tile_x(segment);
+                var tileY = psegment_tile_y(segment);
+                // Note that tileX is always >= -1
+                return !psegment_is_none(segment) &&
+                       tileX < i32(config.widthInTiles) && tileY >= 0 && tileY < i32(config.heightInTiles) &&
+                       psegment_layer(segment) < config.stylingCount;
+            }
+
+            fn same_run(a: PSegment, b: PSegment) -> bool {
+                // The tile and the layer are all the bits above the local coordinates.
+                var layerOffset = 16u + TILE_WIDTH_SHIFT + TILE_HEIGHT_SHIFT;
+                return a.hi == b.hi && (a.lo >> layerOffset) == (b.lo >> layerOffset);
+            }
+
+            // The first psegment of each run gathers the run's covers and appends it.
+            [[stage(compute), workgroup_size(256)]]
+            fn findRuns([[builtin(global_invocation_id)]] GlobalId : vec3<u32>) {
+                var start = GlobalId.x;
+                if (start >= config.segmentCount) {
+                    return;
+                }
+                var segment = segments.data[start];
+                if (!run_segment_is_valid(segment)) {
+                    return;
+                }
+                if (start > 0u && same_run(segments.data[start - 1u], segment)) {
+                    return;
+                }
+
+                var rowCovers : CarryCovers;
+                var end = start;
+                loop {
+                    if (end >= config.segmentCount) {
+                        break;
+                    }
+                    var s = segments.data[end];
+                    if (!same_run(s, segment)) {
+                        break;
+                    }
+                    var localY = psegment_local_y(s);
+                    rowCovers[localY] = rowCovers[localY] + psegment_cover(s);
+                    end = end + 1u;
+                }
+
+                var slot = atomicAdd(&counters.runCount, 1u);
+                if (slot >= config.runCapacity) {
+                    return;
+                }
+
+                var tileX = psegment_tile_x(segment);
+                var tileY = u32(psegment_tile_y(segment));
+                var layer = psegment_layer(segment);
+                runs.data[slot] = Run(start, end, u32(tileX + 1) | (tileY << 16u), layer, 0);
+                runCovers.data[slot] = rowCovers;
+
+                var key = RunKey(slot, 0u);
+                key_add_field(&key, u32(tileX + 1), config.tileXShift);
+                key_add_field(&key, layer, config.layerShift);
+                key_add_field(&key, tileY, config.tileYShift);
+                runKeys.data[slot] = key;
+            }
+
+            ///////////////////////////////////////////////////////////////////
+            //  Segmented prefix scan of the covers
+            ///////////////////////////////////////////////////////////////////
+
+            // The runs of a layer in a row of tiles form a segment of the sorted runs. The first
+            // run of each segment walks it to compute the carries, which is short since a row has
+            // at most widthInTiles + 1 runs per layer.
+            [[stage(compute), workgroup_size(256)]]
+            fn scanRuns([[builtin(global_invocation_id)]] GlobalId : vec3<u32>) {
+                var runCount = run_count();
+                var position = GlobalId.x;
+                if (position >= runCount) {
+                    return;
+                }
+
+                var slot = key_slot(sortedRunKeys.data[position]);
+                var run = runs.data[slot];
+                var tileY = run_tile_y(run);
+
+                var startsSegment = true;
+                if (position > 0u) {
+                    var previous = runs.data[key_slot(sortedRunKeys.data[position - 1u])];
+                    startsSegment = run_tile_y(previous) != tileY || previous.layer != run.layer;
+                }
+
+                if (!startsSegment) {
+                    return;
+                }
+
+                var carry : CarryCovers;
+                loop {
+                    var rowCovers = runCovers.data[slot];
+                    for (var y = 0u; y < TILE_HEIGHT; y = y + 1u) {
+                        carry[y] = carry[y] + rowCovers[y];
+                    }
+                    runCovers.data[slot] = carry;
+
+                    var nextTileX = i32(config.widthInTiles);
+                    var nextSlot = slot;
+                    position = position + 1u;
+                    if (position < runCount) {
+                        nextSlot = key_slot(sortedRunKeys.data[position]);
+                        var next = runs.data[nextSlot];
+                        if (run_tile_y(next) == tileY && next.layer == run.layer) {
+                            nextTileX = run_tile_x(next);
+                        }
+                    }
+                    // Only the field is written since other invocations read the rest of the run.
+                    runs.data[slot].nextTileX = nextTileX;
+
+                    if (nextTileX == i32(config.widthInTiles)) {
+                        break;
+                    }
+                    slot = nextSlot;
+                }
+            }
+
+            ///////////////////////////////////////////////////////////////////
+            //  Tile runs
+            ///////////////////////////////////////////////////////////////////
+
+            fn run_has_carry(slot: u32) -> bool {
+                var carry = runCovers.data[slot];
+                for (var y = 0u; y < TILE_HEIGHT; y = y + 1u) {
+                    if (carry[y] != 0) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // Lists each run in its tile and, when it carries a cover, in the tiles up to the next
+            // run of its layer, so that the work of a tile is proportional to the layers that reach
+            // it. Each tile has at most one tile run per layer. The tile runs past the capacity are
+            // dropped but still counted, which tells the host how much room they need.
+            [[stage(compute), workgroup_size(256)]]
+            fn emitTileRuns([[builtin(global_invocation_id)]] GlobalId : vec3<u32>) {
+                var position = GlobalId.x;
+                if (position >= run_count()) {
+                    return;
+                }
+
+                var slot = key_slot(sortedRunKeys.data[position]);
+                var run = runs.data[slot];
+                var tileX = run_tile_x(run);
+                // The tile_x == -1 runs are only listed in the tiles they carry to.
+                var firstTileX = max(tileX, 0);
+                var endTileX = tileX + 1;
+                if (run_has_carry(slot)) {
+                    endTileX = run.nextTileX;
+                }
+                if (endTileX <= firstTileX) {
+                    return;
+                }
+
+                var count = u32(endTileX - firstTileX);
+                var base = atomicAdd(&tileRunCounter.count, count);
+                var tileY = run_tile_y(run);
+                for (var i = 0u; i < count; i = i + 1u) {
+                    if (base + i >= config.tileRunCapacity) {
+                        break;
+                    }
+                    var key = RunKey(position, 0u);
+                    key_add_field(&key, run.layer, config.tileRunLayerShift);
+                    key_add_field(&key, u32(firstTileX) + i, config.tileRunTileXShift);
+                    key_add_field(&key, tileY, config.tileRunTileYShift);
+                    tileRunKeys.data[base + i] = key;
+                }
+            }
+
+            fn tile_run_tile(key: RunKey) -> u32 {
+                var tileX = key_get_field(key, config.tileRunTileXShift,
+                                          config.tileRunTileYShift - config.tileRunTileXShift);
+                var tileY = key_get_field(key, config.tileRunTileYShift, 16u);
+                return tileX + tileY * config.widthInTiles;
+            }
+
+            [[stage(compute), workgroup_size(256)]]
+            fn computeTileRanges([[builtin(global_invocation_id)]] GlobalId : vec3<u32>) {
+                var count = tile_run_count();
+                var position = GlobalId.x;
+                if (position >= count) {
+                    return;
+                }
+
+                var tile = tile_run_tile(sortedTileRunKeys.data[position]);
+                var startsTile = true;
+                if (position > 0u) {
+                    startsTile = tile_run_tile(sortedTileRunKeys.data[position - 1u]) != tile;
+                }
+                if (startsTile) {
+                    tileRanges.data[tile].start = position;
+                }
+                var endsTile = true;
+                if (position + 1u < count) {
+                    endsTile = tile_run_tile(sortedTileRunKeys.data[position + 1u]) != tile;
+                }
+                if (endsTile) {
+                    tileRanges.data[tile].end = position + 1u;
+                }
+            }
+
+            ///////////////////////////////////////////////////////////////////
+            //  Tile rasterization
+            ///////////////////////////////////////////////////////////////////
+
+            [[block]] struct Stylings {
+                data: array<Styling>;
+            };
+            [[group(0), binding(8)]] var<storage> stylings : Stylings;
+            [[group(0), binding(9)]] var out : texture_storage_2d<rgba16float, write>;
+
+)" + "            let WORKGROUP_SIZE = " + std::to_string(TILE_WIDTH * TILE_HEIGHT) + "u;\n" + R"(
+
+            var<workgroup> areas : array<array<atomic<i32>, TILE_HEIGHT>, TILE_WIDTH>;
+            var<workgroup> covers : array<array<atomic<i32>, TILE_HEIGHT>, TILE_WIDTH_PLUS_ONE>;
+
+            fn accumulate_run(position: u32, tileX: i32, tileY: u32, threadIdx: u32,
+                              accumulator: vec4<f32>) -> vec4<f32> {
+                var slot = key_slot(sortedRunKeys.data[position]);
+                var run = runs.data[slot];
+                var inTile = run_tile_x(run) == tileX;
+
+                // The carry into the tile is the carry out of the run for runs left of the tile,
+                // and the carry out of the previous run of the layer for runs in the tile.
+                if (threadIdx < TILE_HEIGHT) {
+                    var carry = 0;
+                    if (!inTile) {
+                        carry = runCovers.data[slot][threadIdx];
+                    }
+                    if (inTile && position > 0u) {
+                        var previousSlot = key_slot(sortedRunKeys.data[position - 1u]);
+                        var previous = runs.data[previousSlot];
+                        if (run_tile_y(previous) == tileY && previous.layer == run.layer) {
+                            carry = runCovers.data[previousSlot][threadIdx];
+                        }
+                    }
+                    atomicStore(&covers[0][threadIdx], carry);
+                }
+
+                if (inTile) {
+                    for (var i = run.start + threadIdx; i < run.end; i = i + WORKGROUP_SIZE) {
+                        var segment = segments.data[i];
+                        var segmentLocalX = psegment_local_x(segment);
+                        var segmentLocalY = psegment_local_y(segment);
+                        ignore(atomicAdd(&covers[segmentLocalX + 1u][segmentLocalY], psegment_cover(segment)));
+                        ignore(atomicAdd(&areas[segmentLocalX][segmentLocalY], psegment_area(segment)));
+                    }
+                }
+                workgroupBarrier();
+
+                if (threadIdx < TILE_HEIGHT) {
+                    var cover = 0;
+                    for (var x = 0u; x < TILE_WIDTH; x = x + 1u) {
+                        cover = cover + atomicLoad(&covers[x][threadIdx]);
+                        atomicStore(&covers[x][threadIdx], cover);
+                    }
+                }
+                workgroupBarrier();
+
+                var tx = threadIdx & (TILE_WIDTH - 1u);
+                var ty = threadIdx >> TILE_WIDTH_SHIFT;
+                var pixelArea = atomicExchange(&areas[tx][ty], 0);
+                var pixelCover = atomicExchange(&covers[tx][ty], 0);
+                if (tx == TILE_WIDTH - 1u) {
+                    atomicStore(&covers[TILE_WIDTH][ty], 0);
+                }
+                var pixelCoverage = pixelArea + pixelCover * PIXEL_SIZE;
+                var result = styling_accumulate_layer(accumulator, pixelCoverage, stylings.data[run.layer]);
+                workgroupBarrier();
+                return result;
+            }
+
+            [[stage(compute), workgroup_size(WORKGROUP_SIZE)]]
+            fn rasterizeTile([[builtin(workgroup_id)]] WorkgroupId : vec3<u32>,
+                             [[builtin(local_invocation_id)]] LocalId : vec3<u32>) {
+                var tileX = i32(WorkgroupId.x);
+                var tileY = WorkgroupId.y;
+                var threadIdx = LocalId.x;
+                var tileRange = tileRanges.data[u32(tileX) + tileY * config.widthInTiles];
+                var accumulator = vec4<f32>(0.0);
+
+                // The tile runs of a tile are sorted by layer.
+                for (var i = tileRange.start; i < tileRange.end; i = i + 1u) {
+                    var position = key_slot(sortedTileRunKeys.data[i]);
+                    accumulator = accumulate_run(position, tileX, tileY, threadIdx, accumulator);
+                }
+
+                var pixel = vec2<u32>(u32(tileX) * TILE_WIDTH + (threadIdx & (TILE_WIDTH - 1u)),
+                                      tileY * TILE_HEIGHT + (threadIdx >> TILE_WIDTH_SHIFT));
+                if (pixel.x < config.width && pixel.y < config.height) {
+                    textureStore(out, vec2<i32>(pixel), accumulator);
+                }
+            }
+        )";
+
+        wgpu::ShaderModule module = utils::CreateShaderModule(mDevice, code.c_str());
+
+        wgpu::ComputePipelineDescriptor pDesc;
+        pDesc.label = "TileParallelRasterizer::mClearPipeline";
+        pDesc.compute.module = module;
+        pDesc.compute.entryPoint = "clearRuns";
+        mClearPipeline.Create(mDevice, pDesc);
+
+        pDesc.label = "TileParallelRasterizer::mFindRunsPipeline";
+        pDesc.compute.entryPoint = "findRuns";
+        mFindRunsPipeline.Create(mDevice, pDesc);
+
+        pDesc.label = "TileParallelRasterizer::mScanPipeline";
+        pDesc.compute.entryPoint = "scanRuns";
+        mScanPipeline.Create(mDevice, pDesc);
+
+        pDesc.label = "TileParallelRasterizer::mEmitTileRunsPipeline";
+        pDesc.compute.entryPoint = "emitTileRuns";
+        mEmitTileRunsPipeline.Create(mDevice, pDesc);
+
+        pDesc.label = "TileParallelRasterizer::mTileRangePipeline";
+        pDesc.compute.entryPoint = "computeTileRanges";
+        mTileRangePipeline.Create(mDevice, pDesc);
+
+        pDesc.label = "TileParallelRasterizer::mRasterPipeline";
+        pDesc.compute.entryPoint = "rasterizeTile";
+        mRasterPipeline.Create(mDevice, pDesc);
+    }
+
+    bool TileParallelRasterizer::IsReady() const {
+        return mClearPipeline.IsReady() && mFindRunsPipeline.IsReady() && mScanPipeline.IsReady() &&
+               mEmitTileRunsPipeline.IsReady() && mTileRangePipeline.IsReady() && mRasterPipeline.IsReady();
+    }
+
+    bool TileParallelRasterizer::Precompile() {
+        bool success = mClearPipeline.Wait(mDevice);
+        success = mFindRunsPipeline.Wait(mDevice) && success;
+        success = mScanPipeline.Wait(mDevice) && success;
+        success = mEmitTileRunsPipeline.Wait(mDevice) && success;
+        success = mTileRangePipeline.Wait(mDevice) && success;
+        success = mRasterPipeline.Wait(mDevice) && success;
+        return success;
+    }
+
+    uint32_t TileParallelRasterizer::ComputeTileRunCapacity(uint64_t maxTileRuns) const {
+        uint64_t capacity = maxTileRuns;
+        if (mHasTileRunMeasurement) {
+            capacity = std::min(capacity, StatsReadback::WithHeadroom(mMeasuredTileRuns));
+        }
+        return static_cast<uint32_t>(std::min(capacity, kMaxTileRunCapacity));
+    }
+
+    void TileParallelRasterizer::OnSubmitted() {
+        mStatsReadback.OnSubmitted();
+    }
+
+    void TileParallelRasterizer::OnStatsRead(const void* data) {
+        // The counters keep counting past the capacities.
+        uint32_t counts[2];
+        memcpy(counts, data, sizeof(counts));
+        uint32_t droppedRuns = counts[0] - std::min(counts[0], mRunCapacityInFlight);
+        uint32_t droppedTileRuns = counts[1] - std::min(counts[1], mTileRunCapacityInFlight);
+
+        if (mCountersInFlight) {
+            mCounters = mPendingCounters;
+            mCounters.carriesDropped = droppedRuns + droppedTileRuns;
+            mHasCounters = true;
+        }
+
+        // The tile run storage grows to the measured count, the runs past the largest binding
+        // stay dropped.
+        mDroppedCarries += droppedRuns + droppedTileRuns;
+        mHasTileRunMeasurement = true;
+        mMeasuredTileRuns = counts[1];
+    }
+
+    uint64_t TileParallelRasterizer::GetDroppedCarries() const {
+        return mDroppedCarries;
+    }
+
+    bool TileParallelRasterizer::GetCounters(CassiaRasterCounters* counters) const {
+        if (!mHasCounters) {
+            return false;
+        }
+        *counters = mCounters;
+        return true;
+    }
+
+    wgpu::Texture TileParallelRasterizer::Rasterize(EncodingContext* context, const Inputs& inputs,
+        const Config& config) {
+        const wgpu::Buffer& sortedPsegments = inputs.sortedPsegments;
+        uint32_t widthInTiles = WidthInTiles(config.width);
+        uint32_t heightInTiles = HeightInTiles(config.height);
+
+        wgpu::Texture outTexture = mPool->GetTexture("TileParallelRasterizer::Output",
+                config.width, config.height, wgpu::TextureFormat::RGBA16Float,
+                wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::TextureBinding);
+
+        // There is at most one run per psegment and one per tile and layer. Runs past the capacity
+        // are dropped and reported by OnSubmitted.
+        uint64_t tileRangeCount = uint64_t(widthInTiles + 1) * heightInTiles;
+        uint32_t runCapacity = static_cast<uint32_t>(std::min({uint64_t(config.segmentCount),
+                tileRangeCount * config.stylingCount, kMaxRunCapacity}));
+
+        uint32_t slotBits = BitsFor(runCapacity);
+        uint32_t tileXShift = slotBits;
+        uint32_t layerShift = tileXShift + BitsFor(uint64_t(widthInTiles) + 1);
+        uint32_t tileYShift = layerShift + BitsFor(config.stylingCount);
+        uint32_t keyBits = tileYShift + BitsFor(heightInTiles);
+        if (keyBits > 64) {
+            std::cerr << "TileParallelRasterizer: the run keys need " << keyBits << " bits." << std::endl;
+            return outTexture;
+        }
+
+        // A tile has at most one tile run per layer. Their keys have the run's position in the
+        // sorted runs instead of its slot, and don't need more bits than the run keys.
+        uint64_t tileCount = uint64_t(widthInTiles) * heightInTiles;
+        uint32_t tileRunCapacity = ComputeTileRunCapacity(tileCount * config.stylingCount);
+        uint32_t tileRunLayerShift = slotBits;
+        uint32_t tileRunTileXShift = tileRunLayerShift + BitsFor(config.stylingCount);
+        uint32_t tileRunTileYShift = tileRunTileXShift + BitsFor(widthInTiles);
+        uint32_t tileRunKeyBits = tileRunTileYShift + BitsFor(heightInTiles);
+
+        ConfigUniforms uniformData = {
+            config.width,
+            config.height,
+            widthInTiles,
+            heightInTiles,
+            config.segmentCount,
+            config.stylingCount,
+            runCapacity,
+            static_cast<uint32_t>((uint64_t(1) << slotBits) - 1),
+            tileXShift,
+            layerShift,
+            tileYShift,
+            tileRunCapacity,
+            tileRunLayerShift,
+            tileRunTileXShift,
+            tileRunTileYShift,
+            0,
+        };
+        wgpu::Buffer uniforms = mPool->GetBuffer("TileParallelRasterizer::Uniforms", sizeof(uniformData),
+                wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst);
+        mDevice.GetQueue().WriteBuffer(uniforms, 0, &uniformData, sizeof(uniformData));
+
+        uint64_t bufferRuns = std::max(runCapacity, 1u);
+        wgpu::Buffer counters = mPool->GetBuffer("TileParallelRasterizer::Counters", sizeof(uint32_t),
+                wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc);
+        wgpu::Buffer tileRunCounter = mPool->GetBuffer("TileParallelRasterizer::TileRunCounter", sizeof(uint32_t),
+                wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc);
+        wgpu::Buffer runs = mPool->GetBuffer("TileParallelRasterizer::Runs",
+                bufferRuns * kSizeofRun, wgpu::BufferUsage::Storage);
+        wgpu::Buffer runCovers = mPool->GetBuffer("TileParallelRasterizer::RunCovers",
+                bufferRuns * kSizeofRunCovers, wgpu::BufferUsage::Storage);
+        wgpu::Buffer runKeys = mPool->GetBuffer("TileParallelRasterizer::RunKeys",
+                bufferRuns * sizeof(uint64_t), wgpu::BufferUsage::Storage);
+        wgpu::Buffer tileRunKeys = mPool->GetBuffer("TileParallelRasterizer::TileRunKeys",
+                std::max(tileRunCapacity, 1u) * sizeof(uint64_t), wgpu::BufferUsage::Storage);
+        wgpu::Buffer tileRanges = mPool->GetBuffer("TileParallelRasterizer::TileRanges",
+                std::max(tileCount, uint64_t(1)) * sizeof(TileRange), wgpu::BufferUsage::Storage);
+
+        {
+            if (mClearBindGroup.IsStale({uniforms.Get(), counters.Get(), tileRanges.Get(), tileRunCounter.Get()})) {
+                mClearBindGroup.Set(utils::MakeBindGroup(mDevice, mClearPipeline.Get().GetBindGroupLayout(0), {
+                    {0, uniforms},
+                    {2, counters},
+                    {7, tileRanges},
+                    {10, tileRunCounter},
+                }));
+            }
+
+            ScopedComputePass pass(context, "TileParallelRasterizer::Clear");
+            pass->SetBindGroup(0, mClearBindGroup.Get());
+            pass->SetPipeline(mClearPipeline.Get());
+            pass->Dispatch(static_cast<uint32_t>(std::max((tileCount + 255) / 256, uint64_t(1))));
+        }
+
+        {
+            if (mFindRunsBindGroup.IsStale({uniforms.Get(), sortedPsegments.Get(), counters.Get(), runs.Get(),
+                                            runCovers.Get(), runKeys.Get()})) {
+                mFindRunsBindGroup.Set(utils::MakeBindGroup(mDevice, mFindRunsPipeline.Get().GetBindGroupLayout(0), {
+                    {0, uniforms},
+                    {1, sortedPsegments},
+                    {2, counters},
+                    {3, runs},
+                    {4, runCovers},
+                    {5, runKeys},
+                }));
+            }
+
+            ScopedComputePass pass(context, "TileParallelRasterizer::FindRuns");
+            pass->SetBindGroup(0, mFindRunsBindGroup.Get());
+            pass->SetPipeline(mFindRunsPipeline.Get());
+            pass->Dispatch((config.segmentCount + 255) / 256);
+        }
+
+        // Only the tile and layer are sorted, the slots make the keys unique.
+        uint64_t sortedBits = (keyBits == 64 ? ~uint64_t(0) : (uint64_t(1) << keyBits) - 1) &
+                              ~((uint64_t(1) << slotBits) - 1);
+        wgpu::Buffer sortedRunKeys = mRunSorter.Sort(context, runKeys, runCapacity, sortedBits, counters);
+
+        {
+            if (mScanBindGroup.IsStale({uniforms.Get(), counters.Get(), runs.Get(), runCovers.Get(),
+                                        sortedRunKeys.Get()})) {
+                mScanBindGroup.Set(utils::MakeBindGroup(mDevice, mScanPipeline.Get().GetBindGroupLayout(0), {
+                    {0, uniforms},
+                    {2, counters},
+                    {3, runs},
+                    {4, runCovers},
+                    {6, sortedRunKeys},
+                }));
+            }
+
+            ScopedComputePass pass(context, "TileParallelRasterizer::ScanRuns");
+            pass->SetBindGroup(0, mScanBindGroup.Get());
+            pass->SetPipeline(mScanPipeline.Get());
+            pass->Dispatch((runCapacity + 255) / 256);
+        }
+
+        {
+            if (mEmitTileRunsBindGroup.IsStale({uniforms.Get(), counters.Get(), runs.Get(), runCovers.Get(),
+                                                sortedRunKeys.Get(), tileRunCounter.Get(), tileRunKeys.Get()})) {
+                mEmitTileRunsBindGroup.Set(utils::MakeBindGroup(mDevice, mEmitTileRunsPipeline.Get().GetBindGroupLayout(0), {
+                    {0, uniforms},
+                    {2, counters},
+                    {3, runs},
+                    {4, runCovers},
+                    {6, sortedRunKeys},
+                    {10, tileRunCounter},
+                    {11, tileRunKeys},
+                }));
+            }
+
+            ScopedComputePass pass(context, "TileParallelRasterizer::EmitTileRuns");
+            pass->SetBindGroup(0, mEmitTileRunsBindGroup.Get());
+            pass->SetPipeline(mEmitTileRunsPipeline.Get());
+            pass->Dispatch((runCapacity + 255) / 256);
+        }
+
+        // The tile runs are sorted by tile then layer, the positions make the keys unique.
+        uint64_t tileRunSortedBits = (tileRunKeyBits == 64 ? ~uint64_t(0) : (uint64_t(1) << tileRunKeyBits) - 1) &
+                                     ~((uint64_t(1) << slotBits) - 1);
+        wgpu::Buffer sortedTileRunKeys = mTileRunSorter.Sort(context, tileRunKeys, tileRunCapacity,
+                                                             tileRunSortedBits, tileRunCounter);
+
+        {
+            if (mTileRangeBindGroup.IsStale({uniforms.Get(), tileRanges.Get(), tileRunCounter.Get(),
+                                             sortedTileRunKeys.Get()})) {
+                mTileRangeBindGroup.Set(utils::MakeBindGroup(mDevice, mTileRangePipeline.Get().GetBindGroupLayout(0), {
+                    {0, uniforms},
+                    {7, tileRanges},
+                    {10, tileRunCounter},
+                    {12, sortedTileRunKeys},
+                }));
+            }
+
+            ScopedComputePass pass(context, "TileParallelRasterizer::TileRanges");
+            pass->SetBindGroup(0, mTileRangeBindGroup.Get());
+            pass->SetPipeline(mTileRangePipeline.Get());
+            pass->Dispatch((tileRunCapacity + 255) / 256);
+        }
+
+        {
+            if (mRasterBindGroup.IsStale({uniforms.Get(), sortedPsegments.Get(), runs.Get(), runCovers.Get(),
+                                          sortedRunKeys.Get(), tileRanges.Get(), sortedTileRunKeys.Get(),
+                                          inputs.stylings.Get(), outTexture.Get()})) {
+                mRasterBindGroup.Set(utils::MakeBindGroup(mDevice, mRasterPipeline.Get().GetBindGroupLayout(0), {
+                    {0, uniforms},
+                    {1, sortedPsegments},
+                    {3, runs},
+                    {4, runCovers},
+                    {6, sortedRunKeys},
+                    {7, tileRanges},
+                    {8, inputs.stylings},
+                    {9, outTexture.CreateView()},
+                    {12, sortedTileRunKeys},
+                }));
+            }
+
+            ScopedComputePass pass(context, "TileParallelRasterizer::Raster");
+            pass->SetBindGroup(0, mRasterBindGroup.Get());
+            pass->SetPipeline(mRasterPipeline.Get());
+            pass->Dispatch(widthInTiles, heightInTiles);
+        }
+
+        if (mStatsReadback.IsIdle()) {
+            mStatsReadback.Copy(context, counters, 0, sizeof(uint32_t));
+            mStatsReadback.Copy(context, tileRunCounter, sizeof(uint32_t), sizeof(uint32_t));
+            mRunCapacityInFlight = runCapacity;
+            mTileRunCapacityInFlight = tileRunCapacity;
+            mCountersInFlight = inputs.gatherCounters;
+            mPendingCounters = {};
+            mPendingCounters.rows = heightInTiles;
+            mPendingCounters.tiles = static_cast<uint32_t>(tileCount);
+            mPendingCounters.psegments = config.segmentCount;
+        }
+
+        return outTexture;
+    }
+
+} // namespace cassia
@@ -0,0 +1,71 @@
+#ifndef CASSIA_TILEPARALLELRASTERIZER_H
+#define CASSIA_TILEPARALLELRASTERIZER_H
+
+#include "AsyncComputePipeline.h"
+#include "RadixSorter.h"
+#include "Rasterizer.h"
+#include "ResourcePool.h"
+
+namespace cassia {
+
+    // Rasterizes each tile in its own workgroup. The carries of the rows are computed before the
+    // rasterization by a segmented prefix scan over the covers of the runs of psegments that share
+    // a tile and a layer, instead of being passed from tile to tile like TileWorkgroupRasterizer.
+    // The runs are then listed in the tiles they reach and sorted by tile, so that each workgroup
+    // only reads the runs of its tile and the carries into it.
+    class TileParallelRasterizer final : public Rasterizer {
+      public:
+        TileParallelRasterizer(wgpu::Device device, ResourcePool* pool);
+        ~TileParallelRasterizer() override = default;
+
+        wgpu::Texture Rasterize(EncodingContext* context, const Inputs& inputs,
+            const Config& config) override;
+        void OnSubmitted() override;
+        bool IsReady() const override;
+        bool Precompile() override;
+        // Only the rows, tiles, psegments and dropped carries are counted.
+        bool GetCounters(CassiaRasterCounters* counters) const override;
+        // The dropped runs and tile runs.
+        uint64_t GetDroppedCarries() const override;
+
+      private:
+        // The room for the tile runs, from the count measured on the GPU when there is one, or
+        // their upper bound otherwise.
+        uint32_t ComputeTileRunCapacity(uint64_t maxTileRuns) const;
+        void OnStatsRead(const void* data);
+
+        wgpu::Device mDevice;
+        ResourcePool* mPool;
+        RadixSorter mRunSorter;
+        RadixSorter mTileRunSorter;
+        AsyncComputePipeline mClearPipeline;
+        AsyncComputePipeline mFindRunsPipeline;
+        AsyncComputePipeline mScanPipeline;
+        AsyncComputePipeline mEmitTileRunsPipeline;
+        AsyncComputePipeline mTileRangePipeline;
+        AsyncComputePipeline mRasterPipeline;
+
+        CachedBindGroup mClearBindGroup;
+        CachedBindGroup mFindRunsBindGroup;
+        CachedBindGroup mScanBindGroup;
+        CachedBindGroup mEmitTileRunsBindGroup;
+        CachedBindGroup mTileRangeBindGroup;
+        CachedBindGroup mRasterBindGroup;
+
+        // The counts of runs and tile runs of a frame, larger than their capacities when some
+        // were dropped.
+        StatsReadback mStatsReadback;
+        uint32_t mRunCapacityInFlight = 0;
+        uint32_t mTileRunCapacityInFlight = 0;
+        bool mCountersInFlight = false;
+        CassiaRasterCounters mPendingCounters = {};
+        bool mHasTileRunMeasurement = false;
+        uint32_t mMeasuredTileRuns = 0;
+        uint64_t mDroppedCarries = 0;
+        bool mHasCounters = false;
+        CassiaRasterCounters mCounters = {};
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_TILEPARALLELRASTERIZER_H
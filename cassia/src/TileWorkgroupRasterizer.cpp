@@ -5,9 +5,11 @@
 
 #include "utils/WGPUHelpers.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <string>
 
-#include <iostream>
 
 namespace cassia {
 
@@ -19,17 +21,101 @@ namespace cassia {
         uint32_t segmentCount;
         uint32_t tileRangeCount;
         uint32_t carrySpillsPerRow;
+        uint32_t damagedRowsOnly;
+        uint32_t damageAllRows;
+        uint32_t layerBegin;
+        uint32_t layerEnd;
+        uint32_t seedFromBaseLayers;
     };
-    static_assert(sizeof(ConfigUniforms) == 28, "");
+    static_assert(sizeof(ConfigUniforms) == 48, "");
 
-    struct TileRange {
-        uint32_t start;
-        uint32_t end;
+    struct CarryStats {
+        uint32_t peakCarriesPerRow;
+        uint32_t droppedCarries;
     };
 
-    TileWorkgroupRasterizer::TileWorkgroupRasterizer(wgpu::Device device)
-        : mDevice(std::move(device)) {
-        std::string code = std::string(kPSegmentWGSL) + std::string(kStylingWGSL) + R"(
+    // The Counters of the stats builds of the shader.
+    struct KernelCounters {
+        uint32_t peakRowPsegments;
+        // Indexed by the COUNTER_* constants.
+        uint32_t psegments;
+        uint32_t layersVisited;
+        uint32_t carriesEnqueued;
+        uint32_t carriesSpilled;
+        uint32_t barrierIterations;
+        uint32_t tiles;
+        uint32_t emptyTiles;
+        uint32_t rows;
+    };
+    static_assert(sizeof(KernelCounters) == 36, "");
+
+    namespace {
+        constexpr uint64_t kSizeofCarry = sizeof(uint32_t) + TILE_HEIGHT * sizeof(int32_t);
+
+        uint64_t MaxCarrySpillsPerRow(uint32_t heightInTiles) {
+            return kMaxStorageBufferBindingSize / (2 * kSizeofCarry * std::max(heightInTiles, 1u));
+        }
+
+        // The carry queue in workgroup memory holds WORKGROUP_CARRIES carries, a raster pipeline is
+        // compiled for each of these sizes that isn't below the kernel's minWorkgroupCarries.
+        constexpr uint32_t kWorkgroupCarries[] = {10, 32, 64};
+
+        // The initial indirect dispatch of rasterizeTileRow, findDamagedRows adds the rows to it.
+        constexpr uint32_t kDamagedRowsDispatch[] = {0, 1, 1};
+
+        // Past the largest layer of the psegments.
+        constexpr uint32_t kNoLayerEnd = 1u << 16;
+
+        constexpr char kCounterIndicesWGSL[] = R"(
+            let COUNTER_PSEGMENTS = 0u;
+            let COUNTER_LAYERS_VISITED = 1u;
+            let COUNTER_CARRIES_ENQUEUED = 2u;
+            let COUNTER_CARRIES_SPILLED = 3u;
+            let COUNTER_BARRIER_ITERATIONS = 4u;
+            let COUNTER_TILES = 5u;
+            let COUNTER_EMPTY_TILES = 6u;
+            let COUNTER_ROWS = 7u;
+            let COUNTER_COUNT = 8u;
+        )";
+
+        // The first invocation of the workgroup counts the work of its row and adds it to the
+        // totals at the end of the row. The counters are in their own bind group so that the
+        // other builds, which count nothing, keep the same bindings.
+        constexpr char kCountersWGSL[] = R"(
+            [[block]] struct Counters {
+                peakRowPsegments: atomic<u32>;
+                data: array<atomic<u32>, COUNTER_COUNT>;
+            };
+            [[group(1), binding(0)]] var<storage, read_write> counters : Counters;
+            var<private> rowCounters : array<u32, COUNTER_COUNT>;
+
+            fn add_counter(counter: u32, value: u32) {
+                rowCounters[counter] = rowCounters[counter] + value;
+            }
+
+            fn flush_row_counters() {
+                ignore(atomicMax(&counters.peakRowPsegments, rowCounters[COUNTER_PSEGMENTS]));
+                for (var i = 0u; i < COUNTER_COUNT; i = i + 1u) {
+                    ignore(atomicAdd(&counters.data[i], rowCounters[i]));
+                }
+            }
+        )";
+
+        constexpr char kNoCountersWGSL[] = R"(
+            fn add_counter(counter: u32, value: u32) {}
+            fn flush_row_counters() {}
+        )";
+
+        std::string GetShaderCode(const TileWorkgroupKernelConfig& kernelConfig, uint32_t workgroupCarries,
+                                  bool gatherCounters) {
+            std::string kernelConstants =
+                "let WORKGROUP_SIZE = " + std::to_string(kernelConfig.workgroupSize) + "u;\n" +
+                "let WORKGROUP_HEIGHT_IN_ROWS = " + std::to_string(kernelConfig.workgroupSize / TILE_WIDTH) + ";\n" +
+                "let WORKGROUP_CARRIES = " + std::to_string(workgroupCarries) + "u;\n" +
+                "let TILE_RANGE_WORKGROUP_SIZE = " + std::to_string(kernelConfig.tileRangeWorkgroupSize) + "u;\n";
+
+            return std::string(kPSegmentWGSL) + std::string(kStylingWGSL) + kernelConstants +
+                   kCounterIndicesWGSL + (gatherCounters ? kCountersWGSL : kNoCountersWGSL) + R"(
             [[block]] struct Config {
                 width: u32;
                 height: u32;
@@ -38,6 +124,12 @@ namespace cassia {
                 segmentCount: u32;
                 tileRangeCount: u32;
                 carrySpillsPerRow: u32;
+                damagedRowsOnly: u32;
+                damageAllRows: u32;
+                // The range of layers that is rasterized.
+                layerBegin: u32;
+                layerEnd: u32;
+                seedFromBaseLayers: u32;
             };
             [[group(0), binding(0)]] var<uniform> config : Config;
 
@@ -60,7 +152,12 @@ namespace cassia {
             [[group(0), binding(2)]] var<storage, read_write> tileRanges : TileRanges;
 
             fn tile_index(tileX: i32, tileY: i32) -> u32 {
-                return u32(tileX + tileY * (config.widthInTiles + 1));
+                // The extra column at the start of each row holds the tileX == -1 tiles.
+                return u32(tileX + 1 + tileY * (config.widthInTiles + 1));
+            }
+
+            fn tile_origin(tileId: vec2<i32>) -> vec2<i32> {
+                return tileId * vec2<i32>(i32(TILE_WIDTH), i32(TILE_HEIGHT));
             }
 
             fn tile_in_bounds(tileX: i32, tileY: i32) -> bool {
@@ -68,8 +165,16 @@ namespace cassia {
                 return tileX < config.widthInTiles && tileY >= 0 && tileY < config.heightInTiles;
             }
 
+            // The tile range buffer is reused across frames so it needs to be reset to empty ranges.
+            [[stage(compute), workgroup_size(TILE_RANGE_WORKGROUP_SIZE)]]
+            fn clearTileRanges([[builtin(global_invocation_id)]] GlobalId : vec3<u32>) {
+                if (GlobalId.x < config.tileRangeCount) {
+                    tileRanges.data[GlobalId.x] = Range(0u, 0u);
+                }
+            }
+
             // Large workgroup size to not run into the max dispatch limitation.
-            [[stage(compute), workgroup_size(256)]]
+            [[stage(compute), workgroup_size(TILE_RANGE_WORKGROUP_SIZE)]]
             fn computeTileRanges([[builtin(global_invocation_id)]] GlobalId : vec3<u32>) {
                 if (GlobalId.x >= config.segmentCount - 1u) {
                     // This is the last segment of the last referenced tile so we can mark the end of it.
@@ -112,6 +217,86 @@ namespace cassia {
                 }
             }
 
+            ///////////////////////////////////////////////////////////////////
+            //  Damaged rows
+            ///////////////////////////////////////////////////////////////////
+
+            // The fingerprint of the psegments of each row of tiles when it was last rasterized.
+            [[block]] struct RowFingerprints {
+                data: array<vec4<u32>>;
+            };
+            [[group(0), binding(7)]] var<storage, read_write> rowFingerprints : RowFingerprints;
+
+            // The indirect dispatch of rasterizeTileRow followed by the rows it rasterizes.
+            [[block]] struct DamagedRows {
+                dispatchX: atomic<u32>;
+                dispatchY: u32;
+                dispatchZ: u32;
+                rows: array<u32>;
+            };
+            [[group(0), binding(8)]] var<storage, read_write> damagedRows : DamagedRows;
+
+            var<workgroup> rowStart : atomic<u32>;
+            var<workgroup> rowEnd : atomic<u32>;
+            var<workgroup> rowHashes : array<atomic<u32>, 3>;
+
+            fn hash_u32(value: u32) -> u32 {
+                var h = value * 747796405u + 2891336453u;
+                h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+                return (h >> 22u) ^ h;
+            }
+
+            // Appends the rows whose psegments changed since they were last rasterized to the rows
+            // of the raster dispatch. The other rows keep their pixels from the previous picture.
+            [[stage(compute), workgroup_size(TILE_RANGE_WORKGROUP_SIZE)]]
+            fn findDamagedRows([[builtin(workgroup_id)]] WorkgroupId : vec3<u32>,
+                               [[builtin(local_invocation_id)]] LocalId : vec3<u32>) {
+                var tileY = i32(WorkgroupId.x);
+                var threadIdx = LocalId.x;
+                if (threadIdx == 0u) {
+                    atomicStore(&rowStart, 0xFFFFFFFFu);
+                    atomicStore(&rowEnd, 0u);
+                    atomicStore(&rowHashes[0], 0u);
+                    atomicStore(&rowHashes[1], 0u);
+                    atomicStore(&rowHashes[2], 0u);
+                }
+                workgroupBarrier();
+
+                // The psegments of the row are contiguous, from its first to its last non-empty tile.
+                for (var tileX = i32(threadIdx) - 1; tileX < config.widthInTiles;
+                     tileX = tileX + i32(TILE_RANGE_WORKGROUP_SIZE)) {
+                    var tileRange = tileRanges.data[tile_index(tileX, tileY)];
+                    if (tileRange.start != tileRange.end) {
+                        ignore(atomicMin(&rowStart, tileRange.start));
+                        ignore(atomicMax(&rowEnd, tileRange.end));
+                    }
+                }
+                workgroupBarrier();
+
+                var start = atomicLoad(&rowStart);
+                var end = atomicLoad(&rowEnd);
+                // The pixels only depend on the set of psegments, not on their order, so the hashes
+                // are sums. Only the layers up to the end of the rasterized range change the pixels.
+                for (var i = start + threadIdx; i < end; i = i + TILE_RANGE_WORKGROUP_SIZE) {
+                    var segment = segments.data[i];
+                    if (psegment_layer(segment) < config.layerEnd) {
+                        ignore(atomicAdd(&rowHashes[0], hash_u32(segment.lo ^ hash_u32(segment.hi))));
+                        ignore(atomicAdd(&rowHashes[1], hash_u32(segment.hi ^ hash_u32(segment.lo + 2654435769u))));
+                        ignore(atomicAdd(&rowHashes[2], 1u));
+                    }
+                }
+                workgroupBarrier();
+
+                if (threadIdx == 0u) {
+                    var fingerprint = vec4<u32>(atomicLoad(&rowHashes[0]), atomicLoad(&rowHashes[1]),
+                                                atomicLoad(&rowHashes[2]), 0u);
+                    if (config.damageAllRows != 0u || any(rowFingerprints.data[tileY] != fingerprint)) {
+                        rowFingerprints.data[tileY] = fingerprint;
+                        damagedRows.rows[atomicAdd(&damagedRows.dispatchX, 1u)] = u32(tileY);
+                    }
+                }
+            }
+
             ///////////////////////////////////////////////////////////////////
             //  Misc styling and output
             ///////////////////////////////////////////////////////////////////
@@ -122,6 +307,15 @@ namespace cassia {
 
             [[group(0), binding(4)]] var<storage> stylings : Stylings;
             [[group(0), binding(5)]] var out : texture_storage_2d<rgba16float, write>;
+            // The composited layers below layerBegin, kept between frames.
+            [[group(0), binding(9)]] var baseLayers : texture_2d<f32>;
+
+            fn base_layers_pixel(pixel: vec2<i32>) -> vec4<f32> {
+                if (config.seedFromBaseLayers == 0u) {
+                    return vec4<f32>(0.0);
+                }
+                return textureLoad(baseLayers, pixel, 0);
+            }
 
             fn accumulate(accumulator: ptr<function, vec4<f32>,read_write>, layer: u32, cover: i32, area: i32) {
                 var styling = stylings.data[layer];
@@ -129,25 +323,21 @@ namespace cassia {
                 *accumulator = styling_accumulate_layer(*accumulator, pixelCoverage, styling);
             }
 
+            // Whether a row of a layer with a constant cover hides the layers below it.
+            fn row_occludes(layer: u32, cover: i32) -> bool {
+                var styling = stylings.data[layer];
+                return styling.fill.w == 1.0 && styling.blendMode == 0u &&
+                       styling_coverage_to_alpha(cover * PIXEL_SIZE, styling.fillRule) == 1.0;
+            }
+
             ///////////////////////////////////////////////////////////////////
             // Carry queues
             ///////////////////////////////////////////////////////////////////
 
-            // We need constexprs....
-            let TILE_WIDTH = 8;
-            let TILE_WIDTH_PLUS_ONE = 9;
-            let TILE_HEIGHT = 8u;
             let INVALID_LAYER = 0xFFFFu;
-            
-            let WORKGROUP_SIZE = 32u;
-            let WORKGROUP_HEIGHT_IN_ROWS = 4; // (TILE_WIDTH * TILE_HEIGHT) / WORKGROUP_SIZE
-
-            //let WORKGROUP_SIZE = 64u;
-            //let WORKGROUP_HEIGHT_IN_ROWS = 8; // (TILE_WIDTH * TILE_HEIGHT) / WORKGROUP_SIZE
 
             type CarryCovers = array<i32, TILE_HEIGHT>;
 
-            let WORKGROUP_CARRIES = 10u;
             struct LayerCarry {
                 layer: u32;
                 rows: CarryCovers;
@@ -170,17 +360,29 @@ namespace cassia {
                 carries[storeCarryIndex].count = 0u;
                 readLayerIndex = 0u;
             }
+            // The carries past the workgroup queue go in the row's part of the spills.
             fn compute_carry_spill_index(out: ptr<function, u32, read_write>,
                                          carryFlip: u32, tileY: i32, index: u32) -> bool {
-                if (index> config.carrySpillsPerRow) {
+                if (index < WORKGROUP_CARRIES || index - WORKGROUP_CARRIES >= config.carrySpillsPerRow) {
                     return false;
                 }
-                *out = (index - config.carrySpillsPerRow) +
+                *out = (index - WORKGROUP_CARRIES) +
                        u32(tileY) * config.carrySpillsPerRow +
                        carryFlip * config.carrySpillsPerRow * u32(config.heightInTiles);
                 return true;
             }
 
+            // Gathered for the host to size the carry spills of the next frames.
+            [[block]] struct CarryStats {
+                peakCarriesPerRow: atomic<u32>;
+                droppedCarries: atomic<u32>;
+            };
+            [[group(0), binding(6)]] var<storage, read_write> carryStats : CarryStats;
+
+            fn record_stored_carries() {
+                ignore(atomicMax(&carryStats.peakCarriesPerRow, carries[storeCarryIndex].count));
+            }
+
             fn append_output_layer_carry(tileY: i32, layer: u32, covers: CarryCovers) {
                 // Really??? Can we get rid of var vs. let already?
                 var localCovers = covers;
@@ -198,91 +400,99 @@ namespace cassia {
                     var spillIndex : u32;
                     if (!compute_carry_spill_index(&spillIndex,
                             storeCarryIndex, tileY, carries[storeCarryIndex].count)) {
+                        ignore(atomicAdd(&carryStats.droppedCarries, 1u));
                         return;
                     }
                     carrySpills.spills[spillIndex].rows = covers;
                     carrySpills.spills[spillIndex].layer = layer;
                     carries[storeCarryIndex].count = carries[storeCarryIndex].count + 1u;
+                    add_counter(COUNTER_CARRIES_ENQUEUED, 1u);
+                    add_counter(COUNTER_CARRIES_SPILLED, 1u);
                     return;
                 }
 
+                add_counter(COUNTER_CARRIES_ENQUEUED, 1u);
                 carries[storeCarryIndex].data[carries[storeCarryIndex].count].rows = covers;
                 carries[storeCarryIndex].data[carries[storeCarryIndex].count].layer = layer;
                 carries[storeCarryIndex].count = carries[storeCarryIndex].count + 1u;
             }
 
-            fn consume_input_layer_carry(tileY: i32, thredIdx: u32) -> i32 {
+            fn input_layer_carry_layer(tileY: i32, index: u32) -> u32 {
                 var readIndex = 1u - storeCarryIndex;
-                var localLayerIndex = readLayerIndex;
-                readLayerIndex = readLayerIndex + 1u;
-
-                if (thredIdx >= TILE_HEIGHT) {
-                    return 0;
+                if (index >= WORKGROUP_CARRIES) {
+                    var spillIndex : u32;
+                    if (!compute_carry_spill_index(&spillIndex, readIndex, tileY, index)) {
+                        // Should never happen.
+                        return 0u;
+                    }
+                    return carrySpills.spills[spillIndex].layer;
                 }
+                return carries[readIndex].data[index].layer;
+            }
 
-                if (localLayerIndex >= WORKGROUP_CARRIES) {
+            fn input_layer_carry_cover(tileY: i32, index: u32, row: u32) -> i32 {
+                var readIndex = 1u - storeCarryIndex;
+                if (index >= WORKGROUP_CARRIES) {
                     var spillIndex : u32;
-                    if (!compute_carry_spill_index(&spillIndex, readIndex, tileY, localLayerIndex)) {
+                    if (!compute_carry_spill_index(&spillIndex, readIndex, tileY, index)) {
                         // Should never happen.
                         return 0;
                     }
-                    return carrySpills.spills[spillIndex].rows[thredIdx];
+                    return carrySpills.spills[spillIndex].rows[row];
                 }
+                return carries[readIndex].data[index].rows[row];
+            }
 
-                return carries[readIndex].data[localLayerIndex].rows[thredIdx];
+            fn consume_input_layer_carry(tileY: i32, thredIdx: u32) -> i32 {
+                var localLayerIndex = readLayerIndex;
+                readLayerIndex = readLayerIndex + 1u;
+
+                if (thredIdx >= TILE_HEIGHT) {
+                    return 0;
+                }
+                return input_layer_carry_cover(tileY, localLayerIndex, thredIdx);
             }
 
             fn peek_layer_for_next_input_layer_carry(tileY: i32) -> u32 {
                 var readIndex = 1u - storeCarryIndex;
                 if (readLayerIndex < carries[readIndex].count) {
-                    if (readLayerIndex >= WORKGROUP_CARRIES) {
-                        var spillIndex : u32;
-                        if (!compute_carry_spill_index(&spillIndex, readIndex, tileY, readLayerIndex)) {
-                            // Should never happen.
-                            return 0u;
-                        }
-                        return carrySpills.spills[spillIndex].layer;
-                    }
-                    return carries[readIndex].data[readLayerIndex].layer;
+                    return input_layer_carry_layer(tileY, readLayerIndex);
                 }
                 return INVALID_LAYER;
             }
 
-            var<workgroup> subgroupAnyBool : bool;
-            fn fakeSubgroupAny(b: bool) -> bool {
-                var targetBool = !subgroupAnyBool;
-                if (b) {
-                    subgroupAnyBool = targetBool;
-                }
-                workgroupBarrier();
-                return (subgroupAnyBool == targetBool);
-            }
+            // Whether any row of the layer has a carry, voted by the rows while computing the carries
+            // and read after the barrier that follows. It is reset before the barrier that starts
+            // the next vote, once all the rows have read it.
+            var<workgroup> rowCarryVote : atomic<u32>;
 
-            var<workgroup> foo : atomic<i32>;
-            fn append_output_layer_carry2(tileY: i32, layer: u32, threadIdx: u32, cover: i32) {
-                if (!fakeSubgroupAny(cover != 0 && threadIdx < TILE_HEIGHT)) {
-                    return;
-                }
-
-                if (threadIdx < TILE_HEIGHT) {
-                    var prevCarryCount = carries[storeCarryIndex].count;
-
-                    if (prevCarryCount >= WORKGROUP_CARRIES) {
-                        var spillIndex : u32;
-                        if (!compute_carry_spill_index(&spillIndex,
-                                storeCarryIndex, tileY, prevCarryCount)) {
-                            return;
+            // Each row stores its cover of the carry at `index`, which the rows read before the
+            // barrier preceding this so that they all agree on it.
+            fn store_output_layer_carry_row(tileY: i32, layer: u32, index: u32, row: u32, cover: i32) {
+                if (index >= WORKGROUP_CARRIES) {
+                    var spillIndex : u32;
+                    if (!compute_carry_spill_index(&spillIndex, storeCarryIndex, tileY, index)) {
+                        if (row == 0u) {
+                            ignore(atomicAdd(&carryStats.droppedCarries, 1u));
                         }
-                        carrySpills.spills[spillIndex].rows[threadIdx] = cover;
-                        carrySpills.spills[spillIndex].layer = layer;
-                        carries[storeCarryIndex].count = prevCarryCount + 1u;
                         return;
                     }
+                    carrySpills.spills[spillIndex].rows[row] = cover;
+                    carrySpills.spills[spillIndex].layer = layer;
+                    carries[storeCarryIndex].count = index + 1u;
+                    if (row == 0u) {
+                        add_counter(COUNTER_CARRIES_ENQUEUED, 1u);
+                        add_counter(COUNTER_CARRIES_SPILLED, 1u);
+                    }
+                    return;
+                }
 
-                    carries[storeCarryIndex].data[prevCarryCount].rows[threadIdx] = cover;
-                    carries[storeCarryIndex].data[prevCarryCount].layer = layer;
-                    carries[storeCarryIndex].count = prevCarryCount + 1u;
+                if (row == 0u) {
+                    add_counter(COUNTER_CARRIES_ENQUEUED, 1u);
                 }
+                carries[storeCarryIndex].data[index].rows[row] = cover;
+                carries[storeCarryIndex].data[index].layer = layer;
+                carries[storeCarryIndex].count = index + 1u;
             }
 
             ///////////////////////////////////////////////////////////////////
@@ -296,48 +506,216 @@ namespace cassia {
             var<workgroup> psegmentsProcessed : atomic<u32>;
             var<workgroup> nextPsegmentIndex : u32;
 
+            ///////////////////////////////////////////////////////////////////
+            //  Occlusion
+            ///////////////////////////////////////////////////////////////////
+
+            // The layers under the topmost layer that makes the whole tile opaque are hidden. They
+            // are not accumulated but their psegments still update the carries.
+            var<private> firstVisibleLayer : u32 = 0u;
+            var<workgroup> sharedFirstVisibleLayer : atomic<u32>;
+
+            // The index of the first psegment of the range with a layer that isn't below `layer`.
+            fn lower_bound_layer(tileRange: Range, layer: u32) -> u32 {
+                // The psegments of the tile are sorted by layer.
+                var low = tileRange.start;
+                var high = tileRange.end;
+                loop {
+                    if (low >= high) {
+                        break;
+                    }
+                    var middle = (low + high) / 2u;
+                    if (psegment_layer(segments.data[middle]) < layer) {
+                        low = middle + 1u;
+                    } else {
+                        high = middle;
+                    }
+                }
+                return low;
+            }
+
+            fn tile_has_layer(tileRange: Range, layer: u32) -> bool {
+                var low = lower_bound_layer(tileRange, layer);
+                return low < tileRange.end && psegment_layer(segments.data[low]) == layer;
+            }
+
+            // The psegments of the tile in the rasterized range of layers.
+            fn rasterized_layers(tileRange: Range) -> Range {
+                if (config.layerBegin == 0u && config.layerEnd > 0xFFFFu) {
+                    return tileRange;
+                }
+                return Range(lower_bound_layer(tileRange, config.layerBegin),
+                             lower_bound_layer(tileRange, config.layerEnd));
+            }
+
+            // Only the carry-only layers have a coverage known before the psegments are processed,
+            // so they are the ones that can hide the others.
+            fn compute_first_visible_layer(tileY: i32, tileRange: Range, threadIdx: u32) {
+                if (threadIdx == 0u) {
+                    atomicStore(&sharedFirstVisibleLayer, 0u);
+                }
+                workgroupBarrier();
+
+                var carryCount = carries[1u - storeCarryIndex].count;
+                for (var i = threadIdx; i < carryCount; i = i + WORKGROUP_SIZE) {
+                    var layer = input_layer_carry_layer(tileY, i);
+                    var occludes = true;
+                    for (var row = 0u; row < TILE_HEIGHT; row = row + 1u) {
+                        if (!row_occludes(layer, input_layer_carry_cover(tileY, i, row))) {
+                            occludes = false;
+                            break;
+                        }
+                    }
+                    if (occludes && !tile_has_layer(tileRange, layer)) {
+                        ignore(atomicMax(&sharedFirstVisibleLayer, layer));
+                    }
+                }
+
+                workgroupBarrier();
+                firstVisibleLayer = atomicLoad(&sharedFirstVisibleLayer);
+            }
+
             fn accumulate_layer_and_save_carry(tileY: i32, layer: u32, threadIdx: u32) {
+                if (threadIdx == 0u) {
+                    atomicStore(&rowCarryVote, 0u);
+                    add_counter(COUNTER_LAYERS_VISITED, 1u);
+                }
                 workgroupBarrier();
                 var cover = 0;
+                var carryIndex = 0u;
 
                 if (threadIdx < TILE_HEIGHT) {
-                    for (var x = 0; x < TILE_WIDTH; x = x + 1) {
+                    for (var x = 0u; x < TILE_WIDTH; x = x + 1u) {
                         cover = cover + atomicLoad(&covers[x][threadIdx]);
                         atomicStore(&covers[x][threadIdx], cover);
                     }
                     cover = cover + atomicExchange(&covers[TILE_WIDTH][threadIdx], 0);
+                    if (cover != 0) {
+                        ignore(atomicOr(&rowCarryVote, 1u));
+                    }
+                    carryIndex = carries[storeCarryIndex].count;
                 }
 
-                append_output_layer_carry2(tileY, layer, threadIdx, cover);
-
                 workgroupBarrier();
 
+                if (threadIdx < TILE_HEIGHT && atomicLoad(&rowCarryVote) != 0u) {
+                    store_output_layer_carry_row(tileY, layer, carryIndex, threadIdx, cover);
+                }
+
                 for (var y = 0; y < i32(TILE_HEIGHT); y = y + WORKGROUP_HEIGHT_IN_ROWS) {
-                    var tx = i32(threadIdx & 7u);
+                    var tx = i32(threadIdx & (TILE_WIDTH - 1u));
                     var ty = i32(threadIdx >> TILE_WIDTH_SHIFT) + y;
 
                     var tarea = atomicExchange(&areas[tx][ty], 0);
                     var tcover = atomicExchange(&covers[tx][ty], 0);
 
+                    if (layer >= firstVisibleLayer) {
+                        var localAccumulator = accumulators[tx][ty];
+                        accumulate(&localAccumulator, layer, tcover, tarea);
+                        accumulators[tx][ty] = localAccumulator;
+                    }
+                }
+
+                workgroupBarrier();
+            }
+
+            // A layer with a carry but no psegments in the tile has the same coverage for all the
+            // pixels of a row, and its carry goes through the tile unchanged. The pixels are
+            // accumulated directly, without the atomics and barriers of the psegments.
+            fn accumulate_carry_only_layer(tileY: i32, layer: u32, threadIdx: u32) {
+                var index = readLayerIndex;
+                readLayerIndex = readLayerIndex + 1u;
+
+                if (threadIdx == 0u) {
+                    var covers : CarryCovers;
+                    for (var i = 0u; i < TILE_HEIGHT; i = i + 1u) {
+                        covers[i] = input_layer_carry_cover(tileY, index, i);
+                    }
+                    append_output_layer_carry(tileY, layer, covers);
+                    add_counter(COUNTER_LAYERS_VISITED, 1u);
+                }
+
+                if (layer < firstVisibleLayer) {
+                    return;
+                }
+                for (var y = 0; y < i32(TILE_HEIGHT); y = y + WORKGROUP_HEIGHT_IN_ROWS) {
+                    var tx = i32(threadIdx & (TILE_WIDTH - 1u));
+                    var ty = i32(threadIdx >> TILE_WIDTH_SHIFT) + y;
+
                     var localAccumulator = accumulators[tx][ty];
-                    accumulate(&localAccumulator, layer, tcover, tarea);
+                    accumulate(&localAccumulator, layer, input_layer_carry_cover(tileY, index, u32(ty)), 0);
                     accumulators[tx][ty] = localAccumulator;
                 }
+            }
 
-                workgroupBarrier();
+            // Tiles without psegments are either empty or only have carry-only layers. Their
+            // pixels are computed without touching the workgroup memory, and since the carries are
+            // unchanged the input queue is reused as the output queue.
+            fn rasterizeTileWithoutSegments(tileId: vec2<i32>, threadIdx: u32) {
+                var readIndex = 1u - storeCarryIndex;
+                var carryCount = carries[readIndex].count;
+                if (threadIdx == 0u) {
+                    add_counter(COUNTER_TILES, 1u);
+                    add_counter(COUNTER_LAYERS_VISITED, carryCount);
+                    if (carryCount == 0u) {
+                        add_counter(COUNTER_EMPTY_TILES, 1u);
+                    }
+                }
+
+                for (var y = 0; y < i32(TILE_HEIGHT); y = y + WORKGROUP_HEIGHT_IN_ROWS) {
+                    var tx = i32(threadIdx & (TILE_WIDTH - 1u));
+                    var ty = i32(threadIdx >> TILE_WIDTH_SHIFT) + y;
+
+                    // Only the layers from the topmost one hiding the row are visible.
+                    var firstVisible = 0u;
+                    for (var i = carryCount; i > 0u; i = i - 1u) {
+                        if (row_occludes(input_layer_carry_layer(tileId.y, i - 1u),
+                                         input_layer_carry_cover(tileId.y, i - 1u, u32(ty)))) {
+                            firstVisible = i - 1u;
+                            break;
+                        }
+                    }
+
+                    var localAccumulator = base_layers_pixel(tile_origin(tileId) + vec2<i32>(tx, ty));
+                    for (var i = firstVisible; i < carryCount; i = i + 1u) {
+                        accumulate(&localAccumulator, input_layer_carry_layer(tileId.y, i),
+                                   input_layer_carry_cover(tileId.y, i, u32(ty)), 0);
+                    }
+                    textureStore(out, tile_origin(tileId) + vec2<i32>(tx, ty), localAccumulator);
+                }
+
+                // The flip after the tile makes the input queue the input of the next tile again.
+                storeCarryIndex = readIndex;
             }
 
             fn rasterizeTile(tileId: vec2<i32>, threadIdx: u32) {
-                var tileRange = tileRanges.data[tile_index(tileId.x, tileId.y)];
+                var tileRange = rasterized_layers(tileRanges.data[tile_index(tileId.x, tileId.y)]);
+                if (tileRange.start == tileRange.end) {
+                    rasterizeTileWithoutSegments(tileId, threadIdx);
+                    return;
+                }
+
+                // Each invocation only touches the accumulators of its pixels.
+                for (var y = 0; y < i32(TILE_HEIGHT); y = y + WORKGROUP_HEIGHT_IN_ROWS) {
+                    var tx = i32(threadIdx & (TILE_WIDTH - 1u));
+                    var ty = i32(threadIdx >> TILE_WIDTH_SHIFT) + y;
+                    accumulators[tx][ty] = base_layers_pixel(tile_origin(tileId) + vec2<i32>(tx, ty));
+                }
+
+                compute_first_visible_layer(tileId.y, tileRange, threadIdx);
 
                 var currentLayer : u32 = INVALID_LAYER;
                 if (threadIdx == 0u) {
                     nextPsegmentIndex = tileRange.start;
                     atomicStore(&psegmentsProcessed, 0u);
+                    add_counter(COUNTER_TILES, 1u);
                 }
 
                 loop {
                     workgroupBarrier();
+                    if (threadIdx == 0u) {
+                        add_counter(COUNTER_BARRIER_ITERATIONS, 1u);
+                    }
                     var carryLayer = peek_layer_for_next_input_layer_carry(tileId.y);
                     var segmentLayer = INVALID_LAYER;
                     if (nextPsegmentIndex < tileRange.end) {
@@ -356,6 +734,12 @@ namespace cassia {
                         currentLayer = minLayer;
                     }
 
+                    if (segmentLayer != minLayer) {
+                        accumulate_carry_only_layer(tileId.y, minLayer, threadIdx);
+                        currentLayer = INVALID_LAYER;
+                        continue;
+                    }
+
                     if (carryLayer == minLayer){
                         var carry = consume_input_layer_carry(tileId.y, threadIdx);
                         if (threadIdx < TILE_HEIGHT) {
@@ -375,14 +759,21 @@ namespace cassia {
                                 var segmentCover = psegment_cover(segment);
                                 var segmentArea = psegment_area(segment);
 
-                                ignore(atomicAdd(&covers[segmentLocalX + 1u][segmentLocalY], segmentCover));
-                                ignore(atomicAdd(&areas[segmentLocalX][segmentLocalY], segmentArea));
+                                if (segmentLayer < firstVisibleLayer) {
+                                    // Only the carry of hidden layers is needed.
+                                    ignore(atomicAdd(&covers[TILE_WIDTH][segmentLocalY], segmentCover));
+                                } else {
+                                    ignore(atomicAdd(&covers[segmentLocalX + 1u][segmentLocalY], segmentCover));
+                                    ignore(atomicAdd(&areas[segmentLocalX][segmentLocalY], segmentArea));
+                                }
                             }
                         }
 
                         workgroupBarrier();
                         if (threadIdx == 0u) {
-                            nextPsegmentIndex = nextPsegmentIndex + atomicExchange(&psegmentsProcessed, 0u);
+                            var processed = atomicExchange(&psegmentsProcessed, 0u);
+                            nextPsegmentIndex = nextPsegmentIndex + processed;
+                            add_counter(COUNTER_PSEGMENTS, processed);
                         }
                         continue;
                     }
@@ -392,12 +783,11 @@ namespace cassia {
                     accumulate_layer_and_save_carry(tileId.y, currentLayer, threadIdx);
                 }
 
-                var tx = i32(threadIdx & 7u);
+                var tx = i32(threadIdx & (TILE_WIDTH - 1u));
                 var ty = i32(threadIdx >> TILE_WIDTH_SHIFT);
 
                 for (var y = 0; y < i32(TILE_HEIGHT); y = y + WORKGROUP_HEIGHT_IN_ROWS) {
-                    textureStore(out, tileId * 8 + vec2<i32>(tx, y + ty), accumulators[tx][y + ty]);
-                    accumulators[tx][y + ty] = vec4<f32>(0.0);
+                    textureStore(out, tile_origin(tileId) + vec2<i32>(tx, y + ty), accumulators[tx][y + ty]);
                 }
             }
 
@@ -407,11 +797,14 @@ namespace cassia {
                 flip_carry_stores();
 
                 var tileY = i32(WorkgroupId.x) % config.heightInTiles;
+                if (config.damagedRowsOnly != 0u) {
+                    tileY = i32(damagedRows.rows[WorkgroupId.x]);
+                }
                 var threadIdx = LocalId.x;
 
                 // TODO make parallel over whole subgroup
                 if (threadIdx == 0u) {
-                    var tileRange = tileRanges.data[tile_index(-1, tileY)];
+                    var tileRange = rasterized_layers(tileRanges.data[tile_index(-1, tileY)]);
 
                     var currentCovers : CarryCovers;
                     var currentLayer = INVALID_LAYER;
@@ -431,6 +824,7 @@ namespace cassia {
                         currentCovers[segmentLocalY] = currentCovers[segmentLocalY] + cover;
                     }
                     append_output_layer_carry(tileY, currentLayer, currentCovers);
+                    record_stored_carries();
                 }
 
                 workgroupBarrier();
@@ -441,110 +835,501 @@ namespace cassia {
                     rasterizeTile(tileId, threadIdx);
 
                     workgroupBarrier(); // TODO not needed? or put in the flipping of carry stores?
+                    if (threadIdx == 0u) {
+                        record_stored_carries();
+                    }
                     flip_carry_stores();
                 }
+
+                if (threadIdx == 0u) {
+                    add_counter(COUNTER_ROWS, 1u);
+                    flush_row_counters();
+                }
             }
         )";
+        }
+    }
 
-        wgpu::ShaderModule module = utils::CreateShaderModule(mDevice, code.c_str());
+    struct TileWorkgroupRasterizer::FrameResources {
+        uint32_t widthInTiles;
+        uint32_t heightInTiles;
+        uint32_t tileRangeCount;
+        uint32_t carriesPerRow;
+        uint32_t carrySpillsPerRow;
+        // The carries a row has room for, in workgroup memory and in the spills.
+        uint32_t carryCapacity;
+        RasterVariant* rasterVariant;
+        wgpu::Buffer tileRanges;
+        wgpu::Buffer carrySpills;
+        wgpu::Buffer carryStats;
+        // Null when the raster variant doesn't gather counters.
+        wgpu::Buffer counters;
+    };
+
+    TileWorkgroupRasterizer::TileWorkgroupRasterizer(wgpu::Device device, ResourcePool* pool,
+                                                     const TileWorkgroupKernelConfig& kernelConfig)
+        : mDevice(std::move(device)),
+          mPool(pool),
+          mKernelConfig(kernelConfig),
+          mStatsReadback(mDevice, "TileWorkgroupRasterizer::mStatsReadback",
+                         sizeof(CarryStats) + sizeof(KernelCounters),
+                         [this](const void* data) { OnStatsRead(data); }) {
+        // Each row of the tile needs a thread, and the pixels are processed in whole rows.
+        mKernelConfig.workgroupSize = std::min(std::max({mKernelConfig.workgroupSize, TILE_WIDTH, TILE_HEIGHT}),
+                                               TILE_WIDTH * TILE_HEIGHT);
+
+        for (uint32_t workgroupCarries : kWorkgroupCarries) {
+            if (workgroupCarries >= mKernelConfig.minWorkgroupCarries) {
+                mRasterVariants.push_back({workgroupCarries, false, {}});
+            }
+        }
+        if (mRasterVariants.empty()) {
+            mRasterVariants.push_back({mKernelConfig.minWorkgroupCarries, false, {}});
+        }
+        for (const RasterVariant& variant : mRasterVariants) {
+            mCounterRasterVariants.push_back({variant.workgroupCarries, true, {}});
+        }
+
+        wgpu::ShaderModule module = utils::CreateShaderModule(mDevice,
+                GetShaderCode(mKernelConfig, mRasterVariants[0].workgroupCarries, false).c_str());
 
         wgpu::ComputePipelineDescriptor pDesc;
+        pDesc.label = "TileWorkgroupRasterizer::mClearTileRangePipeline";
+        pDesc.compute.module = module;
+        pDesc.compute.entryPoint = "clearTileRanges";
+        mClearTileRangePipeline.Create(mDevice, pDesc);
+
         pDesc.label = "TileWorkgroupRasterizer::mTileRangePipeline";
         pDesc.compute.module = module;
         pDesc.compute.entryPoint = "computeTileRanges";
-        mTileRangePipeline = mDevice.CreateComputePipeline(&pDesc);
+        mTileRangePipeline.Create(mDevice, pDesc);
+
+        pDesc.label = "TileWorkgroupRasterizer::mFindDamagedRowsPipeline";
+        pDesc.compute.module = module;
+        pDesc.compute.entryPoint = "findDamagedRows";
+        mFindDamagedRowsPipeline.Create(mDevice, pDesc);
+
+        CreateRasterPipeline(&mRasterVariants[0], module);
+    }
 
+    void TileWorkgroupRasterizer::CreateRasterPipeline(RasterVariant* variant, const wgpu::ShaderModule& module) {
+        wgpu::ComputePipelineDescriptor pDesc;
         pDesc.label = "TileWorkgroupRasterizer::mRasterPipeline";
+        pDesc.compute.module = module;
         pDesc.compute.entryPoint = "rasterizeTileRow";
-        mRasterPipeline = mDevice.CreateComputePipeline(&pDesc);
+        variant->pipeline.Create(mDevice, pDesc);
+    }
+
+    TileWorkgroupRasterizer::RasterVariant* TileWorkgroupRasterizer::GetRasterVariant(uint32_t carriesPerRow,
+                                                                                      bool gatherCounters) {
+        std::vector<RasterVariant>& variants = gatherCounters ? mCounterRasterVariants : mRasterVariants;
+        RasterVariant* variant = &variants.back();
+        for (RasterVariant& candidate : variants) {
+            if (candidate.workgroupCarries >= carriesPerRow) {
+                variant = &candidate;
+                break;
+            }
+        }
+
+        if (!variant->pipeline.IsStarted()) {
+            wgpu::ShaderModule module = utils::CreateShaderModule(mDevice,
+                    GetShaderCode(mKernelConfig, variant->workgroupCarries, variant->gatherCounters).c_str());
+            CreateRasterPipeline(variant, module);
+        }
+        if (variant->pipeline.IsReady()) {
+            return variant;
+        }
+
+        // Until it is created, use the largest ready carry queue and spill the other carries.
+        RasterVariant* fallback = nullptr;
+        for (RasterVariant& candidate : variants) {
+            if (candidate.pipeline.IsReady()) {
+                fallback = &candidate;
+            }
+        }
+        if (fallback == nullptr && gatherCounters) {
+            // The frames aren't counted until a build with the counters is ready.
+            return GetRasterVariant(carriesPerRow, false);
+        }
+        assert(fallback != nullptr);
+        return fallback;
+    }
+
+    bool TileWorkgroupRasterizer::IsReady() const {
+        if (!mClearTileRangePipeline.IsReady() || !mTileRangePipeline.IsReady() ||
+            !mFindDamagedRowsPipeline.IsReady()) {
+            return false;
+        }
+        for (const RasterVariant& variant : mRasterVariants) {
+            if (variant.pipeline.IsReady()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t TileWorkgroupRasterizer::ComputeCarriesPerRow(uint32_t stylingCount) const {
+        // A row has at most one carry per layer.
+        uint32_t carriesPerRow = std::max(stylingCount, 1u);
+        if (mHasCarryMeasurement) {
+            uint64_t measured = StatsReadback::WithHeadroom(mMeasuredCarriesPerRow);
+            carriesPerRow = static_cast<uint32_t>(std::min(uint64_t(carriesPerRow), measured));
+        }
+        return carriesPerRow;
+    }
+
+    bool TileWorkgroupRasterizer::Precompile() {
+        bool success = mClearTileRangePipeline.Wait(mDevice);
+        success = mTileRangePipeline.Wait(mDevice) && success;
+        success = mFindDamagedRowsPipeline.Wait(mDevice) && success;
+        for (RasterVariant& variant : mRasterVariants) {
+            if (!variant.pipeline.IsStarted()) {
+                wgpu::ShaderModule module = utils::CreateShaderModule(mDevice,
+                        GetShaderCode(mKernelConfig, variant.workgroupCarries, false).c_str());
+                CreateRasterPipeline(&variant, module);
+            }
+        }
+        for (RasterVariant& variant : mRasterVariants) {
+            success = variant.pipeline.Wait(mDevice) && success;
+        }
+        return success;
     }
 
-    wgpu::Texture TileWorkgroupRasterizer::Rasterize(EncodingContext* context,
-        wgpu::Buffer sortedPsegments, wgpu::Buffer stylingsBuffer,
+    bool TileWorkgroupRasterizer::CanReusePreviousPicture(const LayerRangePass& layerPass, const Inputs& inputs,
+            uint32_t stylingCount, const FrameResources& frame, uint32_t layerBegin, uint32_t layerEnd,
+            const wgpu::Texture& outTexture) const {
+        if (!layerPass.hasPrevious || layerPass.previousLayerBegin != layerBegin ||
+            layerPass.previousLayerEnd != layerEnd) {
+            return false;
+        }
+        // The pooled resources are reallocated with undefined contents when the size changes.
+        if (layerPass.previousPicture.Get() != outTexture.Get() ||
+            layerPass.previousRowFingerprints.Get() != layerPass.rowFingerprints.Get()) {
+            return false;
+        }
+        // The rows that dropped carries for lack of room are redrawn once there is more.
+        if (frame.carryCapacity > layerPass.previousCarryCapacity) {
+            return false;
+        }
+        // A styling can change any row so only the psegments are compared per row.
+        return inputs.hostStylings != nullptr && layerPass.previousStylings.size() == stylingCount &&
+               std::equal(layerPass.previousStylings.begin(), layerPass.previousStylings.end(), inputs.hostStylings,
+                          [](const CassiaStyling& a, const CassiaStyling& b) {
+                              return memcmp(&a, &b, sizeof(CassiaStyling)) == 0;
+                          });
+    }
+
+    void TileWorkgroupRasterizer::OnSubmitted() {
+        mStatsReadback.OnSubmitted();
+    }
+
+    void TileWorkgroupRasterizer::OnStatsRead(const void* data) {
+        const char* mapped = static_cast<const char*>(data);
+        CarryStats stats;
+        memcpy(&stats, mapped, sizeof(CarryStats));
+        if (mCountersInFlight) {
+            KernelCounters counters;
+            memcpy(&counters, mapped + sizeof(CarryStats), sizeof(KernelCounters));
+            mCounters.rows = counters.rows;
+            mCounters.tiles = counters.tiles;
+            mCounters.emptyTiles = counters.emptyTiles;
+            mCounters.psegments = counters.psegments;
+            mCounters.peakRowPsegments = counters.peakRowPsegments;
+            mCounters.layersVisited = counters.layersVisited;
+            mCounters.carriesEnqueued = counters.carriesEnqueued;
+            mCounters.carriesSpilled = counters.carriesSpilled;
+            mCounters.carriesDropped = stats.droppedCarries;
+            mCounters.barrierIterations = counters.barrierIterations;
+            mHasCounters = true;
+        }
+
+        mDroppedCarries += stats.droppedCarries;
+        uint32_t measured = stats.peakCarriesPerRow;
+        if (stats.droppedCarries != 0) {
+            // The peak is capped by the capacity when carries are dropped, so grow past it.
+            measured = std::max(stats.peakCarriesPerRow, mCarriesPerRowInFlight) * 2;
+        }
+        // The peak of a frame that only rasterized its damaged rows misses the other rows, so
+        // it can only grow the measurement of the full frames.
+        if (mPartialStatsInFlight) {
+            if (!mHasCarryMeasurement) {
+                return;
+            }
+            measured = std::max(measured, mMeasuredCarriesPerRow);
+        }
+        mHasCarryMeasurement = true;
+        mMeasuredCarriesPerRow = measured;
+    }
+
+    uint64_t TileWorkgroupRasterizer::GetDroppedCarries() const {
+        return mDroppedCarries;
+    }
+
+    bool TileWorkgroupRasterizer::GetCounters(CassiaRasterCounters* counters) const {
+        if (!mHasCounters) {
+            return false;
+        }
+        *counters = mCounters;
+        return true;
+    }
+
+    wgpu::Texture TileWorkgroupRasterizer::Rasterize(EncodingContext* context, const Inputs& inputs,
         const Config& config) {
-        uint32_t widthInTiles = (config.width + TILE_WIDTH_SHIFT - 1) >> TILE_WIDTH_SHIFT;
-        uint32_t heightInTiles = (config.height + TILE_HEIGHT_SHIFT - 1) >> TILE_HEIGHT_SHIFT;
-        uint32_t tileRangeCount = (widthInTiles + 1) * heightInTiles;
-        constexpr uint64_t kCarrySpillsPerRow = 100;
+        FrameResources frame;
+        frame.widthInTiles = WidthInTiles(config.width);
+        frame.heightInTiles = HeightInTiles(config.height);
+        frame.tileRangeCount = (frame.widthInTiles + 1) * frame.heightInTiles;
+        uint32_t tileRangeWorkgroupSize = mKernelConfig.tileRangeWorkgroupSize;
+
+        frame.carriesPerRow = ComputeCarriesPerRow(config.stylingCount);
+        frame.rasterVariant = GetRasterVariant(frame.carriesPerRow, inputs.gatherCounters);
+        // The measured carries only pick the queue in workgroup memory: the spills have room for
+        // a carry per layer so that a scene gaining carries isn't drawn with some dropped until
+        // the next measurement. They are only smaller when that wouldn't fit in a binding.
+        uint32_t maxCarriesPerRow = std::max(config.stylingCount, 1u);
+        frame.carrySpillsPerRow = maxCarriesPerRow > frame.rasterVariant->workgroupCarries
+                                      ? maxCarriesPerRow - frame.rasterVariant->workgroupCarries
+                                      : 0;
+        frame.carrySpillsPerRow = static_cast<uint32_t>(
+                std::min(uint64_t(frame.carrySpillsPerRow), MaxCarrySpillsPerRow(frame.heightInTiles)));
+        frame.carryCapacity = frame.rasterVariant->workgroupCarries + frame.carrySpillsPerRow;
+
+        // Tile ranges computed while sorting on the host are used directly.
+        frame.tileRanges = inputs.tileRanges;
+        if (frame.tileRanges == nullptr) {
+            frame.tileRanges = mPool->GetBuffer("TileWorkgroupRasterizer::TileRanges",
+                    frame.tileRangeCount * sizeof(TileRange), wgpu::BufferUsage::Storage);
+        }
 
-        ConfigUniforms uniformData = {
-            config.width,
-            config.height,
-            widthInTiles,
-            heightInTiles,
-            config.segmentCount,
-            tileRangeCount,
-            kCarrySpillsPerRow,
-        };
-        wgpu::Buffer uniforms = utils::CreateBufferFromData(
-                mDevice, &uniformData, sizeof(uniformData), wgpu::BufferUsage::Uniform);
+        frame.carrySpills = mPool->GetBuffer("TileWorkgroupRasterizer::CarrySpills",
+                2 * kSizeofCarry * std::max(uint64_t(frame.carrySpillsPerRow) * frame.heightInTiles, uint64_t(1)),
+                wgpu::BufferUsage::Storage);
 
-        wgpu::BufferDescriptor tileRangeDesc;
-        tileRangeDesc.size = tileRangeCount *  sizeof(TileRange);
-        tileRangeDesc.usage = wgpu::BufferUsage::Storage;
-        wgpu::Buffer tileRangeBuffer = mDevice.CreateBuffer(&tileRangeDesc);
+        frame.carryStats = mPool->GetBuffer("TileWorkgroupRasterizer::CarryStats", sizeof(CarryStats),
+                wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc | wgpu::BufferUsage::CopyDst);
+        CarryStats zeroStats = {};
+        mDevice.GetQueue().WriteBuffer(frame.carryStats, 0, &zeroStats, sizeof(zeroStats));
 
-        constexpr uint64_t kSizeofCarry = sizeof(uint32_t) + 8 * sizeof(int32_t);
-        wgpu::BufferDescriptor tileCarrySpillDesc;
-        tileCarrySpillDesc.size = 2 * kSizeofCarry * kCarrySpillsPerRow * heightInTiles;
-        tileCarrySpillDesc.usage = wgpu::BufferUsage::Storage;
-        wgpu::Buffer tileCarrySpillBuffer = mDevice.CreateBuffer(&tileCarrySpillDesc);
+        if (frame.rasterVariant->gatherCounters) {
+            frame.counters = mPool->GetBuffer("TileWorkgroupRasterizer::Counters", sizeof(KernelCounters),
+                    wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc | wgpu::BufferUsage::CopyDst);
+            KernelCounters zeroCounters = {};
+            mDevice.GetQueue().WriteBuffer(frame.counters, 0, &zeroCounters, sizeof(zeroCounters));
+        }
 
-        {
-            wgpu::BindGroup bg = utils::MakeBindGroup(mDevice, mTileRangePipeline.GetBindGroupLayout(0), {
-                {0, uniforms},
-                {1, sortedPsegments},
-                {2, tileRangeBuffer},
-            });
+        // The layers below the boundary are composited in their own picture, which only changes
+        // in the rows where they do, and seeds the accumulators of the layers above.
+        uint32_t cacheBoundary = std::min(inputs.layerCacheBoundary, config.stylingCount);
+        wgpu::Texture baseLayers;
+        if (cacheBoundary != 0) {
+            baseLayers = mPool->GetTexture("TileWorkgroupRasterizer::BaseLayers",
+                    config.width, config.height, wgpu::TextureFormat::RGBA16Float,
+                    wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::TextureBinding);
+        } else {
+            mBaseLayersPass.hasPrevious = false;
+        }
+
+        wgpu::Texture outTexture = mPool->GetTexture("TileWorkgroupRasterizer::Output",
+                config.width, config.height, wgpu::TextureFormat::RGBA16Float,
+                wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::TextureBinding);
+        wgpu::Buffer uniforms = WriteLayerRangeUniforms(&mPicturePass, inputs, config, frame,
+                cacheBoundary, kNoLayerEnd, inputs.reusePreviousPicture, outTexture, baseLayers);
 
-            // TODO reuse tile range buffer instead?
+        if (inputs.tileRanges == nullptr) {
             {
-                ScopedComputePass pass(context, "TileWorkgroupRasterizer::FakePassToFactorOutLazyClearCost");
+                if (mClearTileRangeBindGroup.IsStale({uniforms.Get(), frame.tileRanges.Get()})) {
+                    mClearTileRangeBindGroup.Set(utils::MakeBindGroup(mDevice, mClearTileRangePipeline.Get().GetBindGroupLayout(0), {
+                        {0, uniforms},
+                        {2, frame.tileRanges},
+                    }));
+                }
+
+                ScopedComputePass pass(context, "TileWorkgroupRasterizer::ClearTileRanges");
+
+                pass->SetBindGroup(0, mClearTileRangeBindGroup.Get());
+                pass->SetPipeline(mClearTileRangePipeline.Get());
+                pass->Dispatch((frame.tileRangeCount + tileRangeWorkgroupSize - 1) / tileRangeWorkgroupSize);
+            }
+
+            {
+                if (mTileRangeBindGroup.IsStale({uniforms.Get(), inputs.sortedPsegments.Get(), frame.tileRanges.Get()})) {
+                    mTileRangeBindGroup.Set(utils::MakeBindGroup(mDevice, mTileRangePipeline.Get().GetBindGroupLayout(0), {
+                        {0, uniforms},
+                        {1, inputs.sortedPsegments},
+                        {2, frame.tileRanges},
+                    }));
+                }
+                const wgpu::BindGroup& bg = mTileRangeBindGroup.Get();
+
+                {
+                    ScopedComputePass pass(context, "TileWorkgroupRasterizer::FakePassToFactorOutLazyClearCost");
+                    pass->SetBindGroup(0, bg);
+                    pass->SetPipeline(mTileRangePipeline.Get());
+                    pass->Dispatch(0);
+                }
+
+                ScopedComputePass pass(context, "TileWorkgroupRasterizer::TileRangeComputation");
+
                 pass->SetBindGroup(0, bg);
-                pass->SetPipeline(mTileRangePipeline);
-                pass->Dispatch(0);
+                pass->SetPipeline(mTileRangePipeline.Get());
+                pass->Dispatch((config.segmentCount + tileRangeWorkgroupSize - 1) / tileRangeWorkgroupSize);
             }
+        }
 
-            ScopedComputePass pass(context, "TileWorkgroupRasterizer::TileRangeComputation");
+        if (cacheBoundary != 0) {
+            // Only the rows of the base layers that changed are rasterized again.
+            wgpu::Buffer baseUniforms = WriteLayerRangeUniforms(&mBaseLayersPass, inputs, config, frame,
+                    0, cacheBoundary, true, baseLayers, nullptr);
+            RasterizeLayerRange(context, &mBaseLayersPass, inputs, frame, baseUniforms, baseLayers, nullptr);
+        }
+        RasterizeLayerRange(context, &mPicturePass, inputs, frame, uniforms, outTexture, baseLayers);
 
-            pass->SetBindGroup(0, bg);
-            pass->SetPipeline(mTileRangePipeline);
-            pass->Dispatch((config.segmentCount + 255) / 256);
+        if (mStatsReadback.IsIdle()) {
+            mStatsReadback.Copy(context, frame.carryStats, 0, sizeof(CarryStats));
+            if (frame.counters != nullptr) {
+                mStatsReadback.Copy(context, frame.counters, sizeof(CarryStats), sizeof(KernelCounters));
+            }
+            mCarriesPerRowInFlight = frame.carriesPerRow;
+            mPartialStatsInFlight = mPicturePass.partialDispatch ||
+                                    (cacheBoundary != 0 && mBaseLayersPass.partialDispatch);
+            mCountersInFlight = frame.counters != nullptr;
         }
 
-        wgpu::TextureDescriptor texDesc;
-        texDesc.label = "rasterized paths";
-        texDesc.size = {config.width, config.height};
-        texDesc.usage = wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::TextureBinding;
-        texDesc.format = wgpu::TextureFormat::RGBA16Float;
-        wgpu::Texture outTexture = mDevice.CreateTexture(&texDesc);
+        return outTexture;
+    }
 
-        {
-            wgpu::BindGroup bg = utils::MakeBindGroup(mDevice, mRasterPipeline.GetBindGroupLayout(0), {
-                {0, uniforms},
-                {1, sortedPsegments},
-                {2, tileRangeBuffer},
-                {3, tileCarrySpillBuffer},
-                {4, stylingsBuffer},
-                {5, outTexture.CreateView()}
-            });
+    wgpu::Buffer TileWorkgroupRasterizer::WriteLayerRangeUniforms(LayerRangePass* layerPass, const Inputs& inputs,
+            const Config& config, const FrameResources& frame, uint32_t layerBegin, uint32_t layerEnd,
+            bool damagedRowsOnly, const wgpu::Texture& outTexture, const wgpu::Texture& baseLayers) {
+        std::string name = std::string("TileWorkgroupRasterizer::") + layerPass->name;
+        layerPass->rowFingerprints = mPool->GetBuffer(name + "::RowFingerprints",
+                4 * sizeof(uint32_t) * std::max(frame.heightInTiles, 1u), wgpu::BufferUsage::Storage);
+        layerPass->damagedRows = mPool->GetBuffer(name + "::DamagedRows",
+                sizeof(kDamagedRowsDispatch) + sizeof(uint32_t) * std::max(frame.heightInTiles, 1u),
+                wgpu::BufferUsage::Storage | wgpu::BufferUsage::Indirect | wgpu::BufferUsage::CopyDst);
+
+        // The stylings of the layers above the range don't change its pixels.
+        uint32_t stylingCount = std::min(layerEnd, config.stylingCount);
+        bool damageAllRows = !damagedRowsOnly ||
+                             !CanReusePreviousPicture(*layerPass, inputs, stylingCount, frame, layerBegin,
+                                                      layerEnd, outTexture);
+        layerPass->damagedRowsOnly = damagedRowsOnly;
+        layerPass->partialDispatch = damagedRowsOnly && !damageAllRows;
+        layerPass->hasPrevious = damagedRowsOnly;
+        if (damagedRowsOnly) {
+            mDevice.GetQueue().WriteBuffer(layerPass->damagedRows, 0, kDamagedRowsDispatch, sizeof(kDamagedRowsDispatch));
+            layerPass->previousPicture = outTexture;
+            layerPass->previousRowFingerprints = layerPass->rowFingerprints;
+            layerPass->previousLayerBegin = layerBegin;
+            layerPass->previousLayerEnd = layerEnd;
+            layerPass->previousCarryCapacity = frame.carryCapacity;
+            if (inputs.hostStylings != nullptr) {
+                layerPass->previousStylings.assign(inputs.hostStylings, inputs.hostStylings + stylingCount);
+            } else {
+                layerPass->previousStylings.clear();
+            }
+        }
 
-            {
-                ScopedComputePass pass(context, "TileWorkgroupRasterizer::FakePassToFactorOutLazyClearCost");
+        ConfigUniforms uniformData = {
+            config.width,
+            config.height,
+            frame.widthInTiles,
+            frame.heightInTiles,
+            config.segmentCount,
+            frame.tileRangeCount,
+            frame.carrySpillsPerRow,
+            damagedRowsOnly,
+            damageAllRows,
+            layerBegin,
+            layerEnd,
+            baseLayers != nullptr,
+        };
+        wgpu::Buffer uniforms = mPool->GetBuffer(name + "::Uniforms", sizeof(uniformData),
+                wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst);
+        mDevice.GetQueue().WriteBuffer(uniforms, 0, &uniformData, sizeof(uniformData));
+        return uniforms;
+    }
 
-                pass->SetBindGroup(0, bg);
-                pass->SetPipeline(mRasterPipeline);
-                pass->Dispatch(0);
+    void TileWorkgroupRasterizer::RasterizeLayerRange(EncodingContext* context, LayerRangePass* layerPass,
+            const Inputs& inputs, const FrameResources& frame, const wgpu::Buffer& uniforms,
+            const wgpu::Texture& outTexture, const wgpu::Texture& baseLayers) {
+        std::string name = std::string("TileWorkgroupRasterizer::") + layerPass->name;
+        const wgpu::Buffer& damagedRows = layerPass->damagedRows;
+
+        if (layerPass->damagedRowsOnly) {
+            if (layerPass->findDamagedRowsBindGroup.IsStale({uniforms.Get(), inputs.sortedPsegments.Get(),
+                    frame.tileRanges.Get(), layerPass->rowFingerprints.Get(), damagedRows.Get()})) {
+                layerPass->findDamagedRowsBindGroup.Set(utils::MakeBindGroup(mDevice, mFindDamagedRowsPipeline.Get().GetBindGroupLayout(0), {
+                    {0, uniforms},
+                    {1, inputs.sortedPsegments},
+                    {2, frame.tileRanges},
+                    {7, layerPass->rowFingerprints},
+                    {8, damagedRows},
+                }));
             }
 
-            ScopedComputePass pass(context, "TileWorkgroupRasterizer::Raster");
+            ScopedComputePass pass(context, (name + "::FindDamagedRows").c_str());
+
+            pass->SetBindGroup(0, layerPass->findDamagedRowsBindGroup.Get());
+            pass->SetPipeline(mFindDamagedRowsPipeline.Get());
+            pass->Dispatch(frame.heightInTiles);
+        }
+
+        // The base layers binding is always used by the shader.
+        wgpu::Texture seed = baseLayers;
+        if (seed == nullptr) {
+            seed = mPool->GetTexture("TileWorkgroupRasterizer::NoBaseLayers", 1, 1,
+                    wgpu::TextureFormat::RGBA16Float, wgpu::TextureUsage::TextureBinding);
+        }
+
+        const wgpu::ComputePipeline& pipeline = frame.rasterVariant->pipeline.Get();
+        CachedBindGroup& bindGroup = layerPass->rasterBindGroup;
+        if (bindGroup.IsStale({pipeline.Get(), uniforms.Get(), inputs.sortedPsegments.Get(), frame.tileRanges.Get(),
+                               frame.carrySpills.Get(), inputs.stylings.Get(), outTexture.Get(),
+                               frame.carryStats.Get(), damagedRows.Get(), seed.Get()})) {
+            bindGroup.Set(utils::MakeBindGroup(mDevice, pipeline.GetBindGroupLayout(0), {
+                {0, uniforms},
+                {1, inputs.sortedPsegments},
+                {2, frame.tileRanges},
+                {3, frame.carrySpills},
+                {4, inputs.stylings},
+                {5, outTexture.CreateView()},
+                {6, frame.carryStats},
+                {8, damagedRows},
+                {9, seed.CreateView()},
+            }));
+        }
+        const wgpu::BindGroup& bg = bindGroup.Get();
+        if (frame.counters != nullptr &&
+            mCountersBindGroup.IsStale({pipeline.Get(), frame.counters.Get()})) {
+            mCountersBindGroup.Set(utils::MakeBindGroup(mDevice, pipeline.GetBindGroupLayout(1), {
+                {0, frame.counters},
+            }));
+        }
+
+        {
+            ScopedComputePass pass(context, "TileWorkgroupRasterizer::FakePassToFactorOutLazyClearCost");
 
             pass->SetBindGroup(0, bg);
-            pass->SetPipeline(mRasterPipeline);
-            pass->Dispatch(heightInTiles);
+            if (frame.counters != nullptr) {
+                pass->SetBindGroup(1, mCountersBindGroup.Get());
+            }
+            pass->SetPipeline(pipeline);
+            pass->Dispatch(0);
         }
 
-        return outTexture;
+        ScopedComputePass pass(context, (name + "::Raster").c_str());
+
+        pass->SetBindGroup(0, bg);
+        if (frame.counters != nullptr) {
+            pass->SetBindGroup(1, mCountersBindGroup.Get());
+        }
+        pass->SetPipeline(pipeline);
+        if (layerPass->damagedRowsOnly) {
+            pass->DispatchIndirect(damagedRows, 0);
+        } else {
+            pass->Dispatch(frame.heightInTiles);
+        }
     }
 
 } // namespace cassia
@@ -1,23 +1,122 @@
 #ifndef CASSIA_TILEWORKGROUPRASTERIZER_H
 #define CASSIA_TILEWORKGROUPRASTERIZER_H
 
+#include "AsyncComputePipeline.h"
 #include "Rasterizer.h"
+#include "ResourcePool.h"
+
+#include <vector>
 
 namespace cassia {
 
+    // The parameters of the kernels that only change their performance, see KernelAutotuner.
+    struct TileWorkgroupKernelConfig {
+        // The invocations rasterizing a tile, a power of two between the tile's width or height and
+        // its number of pixels.
+        uint32_t workgroupSize = 32;
+        // The invocations per workgroup of the passes computing the tile ranges.
+        uint32_t tileRangeWorkgroupSize = 256;
+        // The smallest carry queue in workgroup memory, rows with more carries use larger ones.
+        uint32_t minWorkgroupCarries = 10;
+    };
+
     class TileWorkgroupRasterizer final : public Rasterizer {
       public:
-        TileWorkgroupRasterizer(wgpu::Device device);
+        TileWorkgroupRasterizer(wgpu::Device device, ResourcePool* pool,
+                                const TileWorkgroupKernelConfig& kernelConfig = {});
         ~TileWorkgroupRasterizer() override = default;
 
-        wgpu::Texture Rasterize(EncodingContext* context,
-            wgpu::Buffer sortedPsegments, wgpu::Buffer stylingsBuffer,
+        wgpu::Texture Rasterize(EncodingContext* context, const Inputs& inputs,
             const Config& config) override;
+        void OnSubmitted() override;
+        bool IsReady() const override;
+        bool Precompile() override;
+        bool GetCounters(CassiaRasterCounters* counters) const override;
+        uint64_t GetDroppedCarries() const override;
 
       private:
+        // The raster pipeline compiled for a size of the carry queue in workgroup memory, with or
+        // without the counters.
+        struct RasterVariant {
+            uint32_t workgroupCarries;
+            bool gatherCounters;
+            AsyncComputePipeline pipeline;
+        };
+
+        // Rasterizes a range of layers in a picture that is kept between frames so that only the
+        // rows that changed can be rasterized again.
+        struct LayerRangePass {
+            const char* name;
+            CachedBindGroup findDamagedRowsBindGroup;
+            CachedBindGroup rasterBindGroup;
+            wgpu::Buffer rowFingerprints;
+            wgpu::Buffer damagedRows;
+            bool damagedRowsOnly = false;
+            // Whether the rows that didn't change are skipped this frame, then the carry stats
+            // only cover some of the rows.
+            bool partialDispatch = false;
+
+            // What the picture was last rasterized from.
+            bool hasPrevious = false;
+            wgpu::Texture previousPicture;
+            wgpu::Buffer previousRowFingerprints;
+            uint32_t previousLayerBegin = 0;
+            uint32_t previousLayerEnd = 0;
+            uint32_t previousCarryCapacity = 0;
+            std::vector<CassiaStyling> previousStylings;
+        };
+        // The resources shared by the layer range passes of a frame, defined in the .cpp.
+        struct FrameResources;
+
+        void CreateRasterPipeline(RasterVariant* variant, const wgpu::ShaderModule& module);
+        // The variant with room for carriesPerRow, or the largest ready one while it is created,
+        // which doesn't gather counters if none of those that do are ready.
+        RasterVariant* GetRasterVariant(uint32_t carriesPerRow, bool gatherCounters);
+        // The number of carries each row is expected to have, from the peak measured on the GPU
+        // when there is one, or the number of layers otherwise.
+        uint32_t ComputeCarriesPerRow(uint32_t stylingCount) const;
+        void OnStatsRead(const void* data);
+        // Whether the rows whose psegments didn't change can keep the pixels of the previous
+        // picture, otherwise all the rows are rasterized again.
+        bool CanReusePreviousPicture(const LayerRangePass& layerPass, const Inputs& inputs, uint32_t stylingCount,
+                                     const FrameResources& frame, uint32_t layerBegin, uint32_t layerEnd,
+                                     const wgpu::Texture& outTexture) const;
+        wgpu::Buffer WriteLayerRangeUniforms(LayerRangePass* layerPass, const Inputs& inputs, const Config& config,
+                                             const FrameResources& frame, uint32_t layerBegin, uint32_t layerEnd,
+                                             bool damagedRowsOnly, const wgpu::Texture& outTexture,
+                                             const wgpu::Texture& baseLayers);
+        void RasterizeLayerRange(EncodingContext* context, LayerRangePass* layerPass, const Inputs& inputs,
+                                 const FrameResources& frame, const wgpu::Buffer& uniforms,
+                                 const wgpu::Texture& outTexture, const wgpu::Texture& baseLayers);
+
         wgpu::Device mDevice;
-        wgpu::ComputePipeline mTileRangePipeline;
-        wgpu::ComputePipeline mRasterPipeline;
+        ResourcePool* mPool;
+        TileWorkgroupKernelConfig mKernelConfig;
+        AsyncComputePipeline mClearTileRangePipeline;
+        AsyncComputePipeline mTileRangePipeline;
+        AsyncComputePipeline mFindDamagedRowsPipeline;
+        std::vector<RasterVariant> mRasterVariants;
+        // Only compiled once counters are requested.
+        std::vector<RasterVariant> mCounterRasterVariants;
+
+        CachedBindGroup mClearTileRangeBindGroup;
+        CachedBindGroup mTileRangeBindGroup;
+        CachedBindGroup mCountersBindGroup;
+
+        // The layers below the cache boundary and the picture seeded with them.
+        LayerRangePass mBaseLayersPass = {"BaseLayers"};
+        LayerRangePass mPicturePass = {"Picture"};
+
+        // The CarryStats followed by the KernelCounters when the frame gathered them.
+        StatsReadback mStatsReadback;
+        uint32_t mCarriesPerRowInFlight = 0;
+        bool mPartialStatsInFlight = false;
+        bool mCountersInFlight = false;
+        bool mHasCarryMeasurement = false;
+        uint32_t mMeasuredCarriesPerRow = 0;
+        uint64_t mDroppedCarries = 0;
+        bool mHasCounters = false;
+        CassiaRasterCounters mCounters = {};
     };
 
 } // namespace cassia
@@ -0,0 +1,83 @@
+#include "TraceWriter.h"
+
+#include "JSON.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+
+namespace cassia {
+
+    namespace {
+        constexpr uint32_t kCpuThreadId = 1;
+        constexpr uint32_t kGpuThreadId = 2;
+    }
+
+    // static
+    std::unique_ptr<TraceWriter> TraceWriter::Create(const std::string& path) {
+        std::ofstream file(path, std::ios::trunc);
+        if (!file) {
+            return nullptr;
+        }
+        return std::unique_ptr<TraceWriter>(new TraceWriter(std::move(file)));
+    }
+
+    TraceWriter::TraceWriter(std::ofstream file) : mFile(std::move(file)) {
+        // Microseconds with nanosecond precision, never in scientific notation.
+        mFile << std::fixed << std::setprecision(3);
+        mFile << "{\"traceEvents\":[\n";
+        mFile << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << kCpuThreadId
+              << ",\"args\":{\"name\":\"CPU\"}},\n";
+        mFile << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << kGpuThreadId
+              << ",\"args\":{\"name\":\"GPU\"}}";
+        mHasEvents = true;
+    }
+
+    TraceWriter::~TraceWriter() {
+        mFile << "\n]}\n";
+    }
+
+    void TraceWriter::AddFrame(const FrameTimings& frame) {
+        // The GPU clock has its own origin. Its first timestamp of the frame is placed at the
+        // submit, which is when the GPU can start at the earliest, so the GPU passes are drawn
+        // no earlier than they really ran.
+        uint64_t firstGpuNs = std::numeric_limits<uint64_t>::max();
+        for (const PassTiming& pass : frame.passes) {
+            if (pass.hasGPU) {
+                firstGpuNs = std::min(firstGpuNs, pass.gpuStartNs);
+            }
+        }
+
+        if (!mHasOrigin) {
+            mHasOrigin = true;
+            mOriginNs = frame.submitCpuTimeNs;
+            for (const PassTiming& pass : frame.passes) {
+                mOriginNs = std::min(mOriginNs, pass.cpuStartNs);
+            }
+        }
+
+        for (const PassTiming& pass : frame.passes) {
+            WriteEvent(pass.name, "cpu", kCpuThreadId, pass.cpuStartNs, pass.cpuTimeMs);
+            if (pass.hasGPU) {
+                WriteEvent(pass.name, "gpu", kGpuThreadId,
+                           frame.submitCpuTimeNs + (pass.gpuStartNs - firstGpuNs), pass.gpuTimeMs);
+            }
+        }
+        mFile.flush();
+    }
+
+    void TraceWriter::WriteEvent(const std::string& name, const char* category, uint32_t threadId,
+                                 uint64_t startNs, double durationMs) {
+        // Events from before the origin, if any, are clamped to it.
+        double startUs = startNs > mOriginNs ? (startNs - mOriginNs) / 1000.0 : 0.0;
+
+        if (mHasEvents) {
+            mFile << ",\n";
+        }
+        mHasEvents = true;
+        mFile << "{\"name\":\"" << EscapeJSON(name) << "\",\"cat\":\"" << category
+              << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId << ",\"ts\":" << startUs
+              << ",\"dur\":" << durationMs * 1000.0 << "}";
+    }
+
+} // namespace cassia
@@ -0,0 +1,38 @@
+#ifndef CASSIA_TRACEWRITER_H
+#define CASSIA_TRACEWRITER_H
+
+#include "EncodingContext.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+namespace cassia {
+
+    // Writes the timings of the frames as a Chrome trace, which chrome://tracing and Perfetto can
+    // open. The CPU scopes and the GPU passes are two threads of the same timeline.
+    class TraceWriter {
+      public:
+        // Returns null if the file can't be created.
+        static std::unique_ptr<TraceWriter> Create(const std::string& path);
+        // Terminates the trace so that the file is valid JSON.
+        ~TraceWriter();
+
+        void AddFrame(const FrameTimings& frame);
+
+      private:
+        TraceWriter(std::ofstream file);
+
+        void WriteEvent(const std::string& name, const char* category, uint32_t threadId,
+                        uint64_t startNs, double durationMs);
+
+        std::ofstream mFile;
+        bool mHasEvents = false;
+        // The host time of the first frame, the timeline starts there.
+        bool mHasOrigin = false;
+        uint64_t mOriginNs = 0;
+    };
+
+} // namespace cassia
+
+#endif // CASSIA_TRACEWRITER_H
@@ -1,14 +1,31 @@
 import argparse
 import ctypes
+import os
+import re
 import numpy as np
 from PIL import Image
 
+# The default tile size is the one in CommonWGSL.h, libraries built with another CASSIA_TILE_SIZE
+# need it passed with --tile-size.
+def default_tile_shifts():
+    header = os.path.join(os.path.dirname(__file__), '..', 'src', 'CommonWGSL.h')
+    with open(header) as f:
+        source = f.read()
+    width = re.search(r'#\s*define CASSIA_TILE_WIDTH_SHIFT (\d+)', source)
+    height = re.search(r'#\s*define CASSIA_TILE_HEIGHT_SHIFT (\d+)', source)
+    return int(width.group(1)), int(height.group(1))
+
+def tile_shifts(size):
+    width, height = (int(v) for v in size.split('x'))
+    return width.bit_length() - 1, height.bit_length() - 1
+
 parser = argparse.ArgumentParser(exit_on_error=False)
 parser.add_argument('input', type=argparse.FileType('rb'))
+parser.add_argument('--tile-size', help='WIDTHxHEIGHT of the tiles, like CASSIA_TILE_SIZE')
 args = parser.parse_args()
 
-TILE_WIDTH_SHIFT = 3
-TILE_HEIGHT_SHIFT = 3
+TILE_WIDTH_SHIFT, TILE_HEIGHT_SHIFT = tile_shifts(args.tile_size) if args.tile_size else default_tile_shifts()
+TILE_X_OFFSET = 256
 TILE_WIDTH = 1<<TILE_WIDTH_SHIFT
 TILE_HEIGHT = 1<<TILE_HEIGHT_SHIFT
 COVER_SCALE = (1.0 / 16.0)
@@ -37,7 +54,7 @@ a = np.fromfile(args.input, dtype=np.uint64)
 # Shift X position to avoid negative X.
 for i in range(len(a)):
     pseg = PSegment(asbyte=a[i])
-    pseg.b.tile_x += 256
+    pseg.b.tile_x += TILE_X_OFFSET
     a[i] = pseg.asbyte
 
 segments = np.sort(a)
@@ -78,7 +95,7 @@ class SimpleComputeSim:
 
 
 class TileRasterizerSim(SimpleComputeSim):
-    WORKGROUP_WIDTH = 8
+    WORKGROUP_WIDTH = TILE_HEIGHT
     WORKGROUP_HEIGHT = 1
     WORKGROUP_DEPTH = 1
 
@@ -137,7 +154,7 @@ class TileRasterizerSim(SimpleComputeSim):
         ###########################################################
         # Now loop through the tiles
         for pos_x in range(0, img.size[0], TILE_WIDTH):
-            pos_tile_x = (pos_x >> TILE_WIDTH_SHIFT) + 256
+            pos_tile_x = (pos_x >> TILE_WIDTH_SHIFT) + TILE_X_OFFSET
 
             ###########################################################
             # Cooperatively accumulate the areas & covers in the tile
@@ -168,7 +185,7 @@ class TileRasterizerSim(SimpleComputeSim):
             ###########################################################
             # Output the tile
             cover = 0
-            for loc_x in range(0, TILE_HEIGHT):
+            for loc_x in range(0, TILE_WIDTH):
                 area = sdata.areas[local_y, loc_x]
                 sdata.areas[local_y, loc_x] = 0
                 cover += sdata.covers[local_y, loc_x]
@@ -176,11 +193,12 @@ class TileRasterizerSim(SimpleComputeSim):
 
                 coverage = cover * COVER_SCALE + area * AREA_SCALE
                 grey = int(max(0, min(1.0, coverage)) * 255)
-                pixels[pos_x + loc_x, (tile_y<<3) + local_y] = (grey, grey, grey)
+                if pos_x + loc_x < img.size[0]:
+                    pixels[pos_x + loc_x, (tile_y << TILE_HEIGHT_SHIFT) + local_y] = (grey, grey, grey)
 
             # Save output covers for next tile
-            sdata.covers[local_y, 0] = cover + sdata.covers[local_y, TILE_HEIGHT]
-            sdata.covers[local_y, TILE_HEIGHT] = 0
+            sdata.covers[local_y, 0] = cover + sdata.covers[local_y, TILE_WIDTH]
+            sdata.covers[local_y, TILE_WIDTH] = 0
 
 
 tile_rasterizer = TileRasterizerSim()